@@ -1,32 +1,614 @@
+#include <X11/Xatom.h>
+#include <X11/Xutil.h>
 #include <X11/extensions/XTest.h>
 #include <X11/extensions/XInput.h>
+#include <X11/extensions/XInput2.h>
+#ifdef HAVE_XCB
+#include <X11/Xlib-xcb.h>
+#include <xcb/xcbext.h>
+#include <xcb/xinput.h>
+#include <xcb/xtest.h>
+#endif
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
 #include <time.h>
+#include <unistd.h>
+
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+// 2^64, the smallest double too big to convert to a uint64_t
+#define UINT64_LIMIT 18446744073709551616.0
+
+typedef enum
+{
+	INPUT_XI2,  // Event-driven, raw button events (falls back to XI1 if unavailable)
+	INPUT_XI1,  // Poll the device state every tick
+	INPUT_EVDEV // Read /dev/input/eventN directly, without going through X
+} input_type;
+
+typedef enum
+{
+	OVERRUN_CATCHUP,  // Emit the missed clicks in a burst
+	OVERRUN_SKIP      // Drop the missed clicks and stay on the original cadence
+} overrun_policy;
+
+typedef enum
+{
+	OUTPUT_XTEST,  // Fake button events through the X server
+	OUTPUT_UINPUT  // A virtual mouse created through /dev/uinput
+} output_type;
+
+// Most input devices one daemon will watch
+#define MAX_DEVICES 16
+
+// Most trigger/toggle -> click mappings
+#define MAX_BINDINGS 64
+
+// The device of the binding that's driven through the control socket instead of a button
+#define REMOTE_DEVICE -1
+
+// Most clicks in one compiled sequence
+#define MAX_SEQUENCE_EVENTS 65536
+
+// How often a drag moves the pointer, unless its sequence says otherwise: 1 kHz
+#define DRAG_STEP_NS NS_PER_MS
+
+// Most points on one drag's path
+#define MAX_DRAG_POINTS 64
+
+// Most X displays one daemon will click on
+#define MAX_DISPLAYS 256
+
+// Shortest time between two tries at finding a missing window target
+#define WINDOW_LOOKUP_NS (100 * NS_PER_MS)
+
+typedef enum
+{
+	SEQ_CLICK,
+	SEQ_PRESS,
+	SEQ_RELEASE,
+	SEQ_MOVE     // Only moves the pointer
+} seq_action;
+
+// One step of a sequence. A step that moves the pointer and clicks goes out as one batch.
+typedef struct
+{
+	uint64_t offset_ns;  // When to click, from the start of a pass through the sequence, or in a burst, the deadline
+	int button;
+	seq_action action;
+	bool moves;          // Whether the pointer moves to (x, y) on the screen first
+	int x, y;
+} seq_event_t;
+
+// A sequence file, compiled once when it's loaded so playing it back is just walking an array
+typedef struct
+{
+	seq_event_t* events;
+	int num_events;
+	uint64_t length_ns;   // From the start of one pass to the start of the next
+	uint64_t min_gap_ns;  // Shortest non-zero time between two clicks
+	bool moves;           // Whether any step moves the pointer
+} sequence_t;
 
 typedef struct
 {
-	int click_button;
-	int trigger_button;
-	int toggle_button;
 	int device_id;
 	char* device_name;
-	uint32_t delay_ms;
+	int trigger_button;
+	int toggle_button;
+} device_opts_t;
+
+typedef struct
+{
+	const char* name;             // As given to XOpenDisplay(), e.g. ":5"
+	const char* config_filename;  // The display's own options, or NULL to share the main ones
+} display_opts_t;
+
+// An in-process stand-in for the X server, for tests and benchmarks (see below)
+typedef struct mock_backend mock_backend_t;
+
+typedef enum
+{
+	WINDOW_BY_ID,
+	WINDOW_BY_CLASS,
+	WINDOW_BY_TITLE
+} window_match;
+
+// A window a binding clicks into with XSendEvent, wherever the pointer is. The window is looked up
+// once and cached until events about it say the lookup is out of date.
+typedef struct
+{
+	window_match match;
+	char* value;              // The WM_CLASS class or instance name, title or ID to look for
+	int x, y;                 // Where to click, relative to the window
+	Window window;            // The window that was found, or None
+	bool lookup_due;          // Whether to look for the window again at the next click
+	uint64_t next_lookup_ns;  // When it can be looked for again after a lookup that failed
+	bool reported;            // Whether the window being missing has been reported
+	Window subwindow;         // The innermost window under (x, y), which gets the events, or None
+	int sub_x, sub_y;         // (x, y) relative to subwindow
+	int root_x, root_y;       // ...and to the root window
+} window_target_t;
+
+typedef struct
+{
+	int device;          // Index into opts_t.devices, or REMOTE_DEVICE
+	int trigger_button;  // Clicks while held, or -1
+	int toggle_button;   // Switches clicking on and off, or -1
+	int click_button;
+	uint64_t period_ns;
+	const sequence_t* sequence;  // Played instead of clicking click_button every period_ns, or NULL
+	window_target_t* window;     // Where the clicks go instead of the output, or NULL
+} binding_t;
+
+typedef struct
+{
+	int click_button;
+	uint64_t delay_ns;
 	const char* config_filename;
 
+	// The devices to watch, each with its own trigger/toggle buttons
+	device_opts_t devices[MAX_DEVICES];
+	int num_devices;
+
+	// What each trigger/toggle button clicks, and how fast. Filled in from the devices' buttons
+	// and any explicit bindings by finish_bindings().
+	binding_t bindings[MAX_BINDINGS];
+	int num_bindings;
+
 	// Alternate modes
 	bool calibrate_mode;
+	bool calibrate_continuous;
 	bool list_mode;
 
+	// Keep latency histograms and print them on exit and on SIGUSR1
+	bool latency_stats;
+
+	// Keep loop statistics and dump them on exit, on SIGUSR1 and every stats_interval_ns
+	bool loop_stats;
+	uint64_t stats_interval_ns;  // 0 to only dump on demand
+	char* stats_filename;        // NULL for stderr
+
+	// Unix socket for controlling the daemon from scripts, or NULL
+	char* control_path;
+
 	// Button behavior
 	bool disable_default_action;
+
+	// How trigger/toggle presses are detected
+	input_type input;
+
+	// Watch the buttons on a thread of its own, so slow input can't hold up the clicks
+	bool threads;
+
+	// Query the buttons and send XTest clicks through XCB, without waiting on round trips
+	bool xcb;
+
+	// Realtime scheduling, locked memory, CPU pinning and minimal timer slack for the clicks
+	bool realtime;
+	int rt_policy;    // SCHED_FIFO or SCHED_RR
+	int rt_priority;
+	int rt_cpu;       // CPU to pin the clicking thread to, or -1
+
+	// What to do when the loop falls behind the click cadence
+	overrun_policy overrun;
+
+	// Where the clicks go
+	output_type output;
+
+	// Click on each of these displays from the one process, with its own connection, devices,
+	// bindings and schedule, instead of just on $DISPLAY
+	display_opts_t displays[MAX_DISPLAYS];
+	int num_displays;
+
+	// Record a device's buttons and motion to a file, or play a recording back, instead of
+	// clicking
+	const char* record_filename;
+	const char* replay_filename;
+	double replay_speed;  // 2 plays a recording back twice as fast
+
+	// Use this instead of X for the buttons and the clicks, or NULL. Never set from the command
+	// line; tests and benchmarks fill it in after read_opts().
+	mock_backend_t* mock;
 } opts_t;
 
+// X reports the state of up to 256 buttons, one bit each
+#define BUTTON_MASK_WORDS 4
+
+typedef struct
+{
+	uint64_t bits[BUTTON_MASK_WORDS];
+} button_mask_t;
+
+typedef struct output_ops output_ops_t;
+
+typedef struct
+{
+	const output_ops_t* ops;
+	output_type type;
+	Display* display;
+	int uinput_fd;
+	mock_backend_t* mock;
+#ifdef HAVE_XCB
+	xcb_connection_t* xcb;  // The display's own connection, for the XCB backend
+#endif
+
+	// Window targets get a connection of their own, so the window events they ask for don't end
+	// up in the input's queue. It's opened when the first one is clicked.
+	Display* window_display;
+	bool window_failed;  // Whether it couldn't be opened
+	Atom net_wm_name;
+	Atom utf8_string;
+} output_t;
+
+// One output backend: how it clicks, presses or releases a button, and moves the pointer
+struct output_ops
+{
+	void (*click)(output_t* out, int button);
+	void (*button)(output_t* out, int button, bool pressed);
+	void (*motion)(output_t* out, int dx, int dy);
+	void (*step)(output_t* out, const seq_event_t* step);  // Move and click with one flush
+};
+
+// The first bytes of a --record file, which identify it and its layout
+#define RECORD_MAGIC "ACREC\0\0\1"
+
+typedef struct
+{
+	char magic[8];
+	uint32_t record_size;  // sizeof(record_t) when the file was written
+	uint32_t reserved;
+} record_header_t;
+
+typedef enum
+{
+	REC_WAIT,     // Nothing happened; only there to carry a delta too long for one record
+	REC_PRESS,
+	REC_RELEASE,
+	REC_MOTION
+} record_type;
+
+// One recorded input event. Every record is the same size, so a recording is just an array of
+// them after the header, in host byte order.
+typedef struct
+{
+	uint32_t delta_us;  // Time since the previous record (or the start of the recording)
+	uint8_t type;       // record_type
+	uint8_t button;     // REC_PRESS/REC_RELEASE
+	int16_t dx;         // REC_MOTION, in pixels
+	int16_t dy;
+	uint16_t reserved;
+} record_t;
+
+typedef struct
+{
+	FILE* fp;
+	uint64_t last_ns;      // Time of the last record, as the deltas written so far add up to
+	double rem_x, rem_y;   // Motion too small to have been written yet
+	uint64_t records;
+} recorder_t;
+
+// A recording mapped into memory for replay
+typedef struct
+{
+	void* map;
+	size_t map_len;
+	const record_t* records;
+	size_t num_records;
+} recording_t;
+
+typedef struct
+{
+	int fd;              // The /dev/input/eventN device
+	int passthrough_fd;  // uinput clone that replays what we don't swallow while grabbed, or -1
+	button_mask_t buttons;  // The X buttons the bindings watch; everything else is passed on
+	bool monotonic_stamps;  // Whether event timestamps are on CLOCK_MONOTONIC
+	bool dropped;           // Events were lost, and the rest up to the next SYN_REPORT are skipped
+} evdev_input_t;
+
+typedef struct
+{
+	const device_opts_t* opts;
+	int device_id;          // XI1/XI2: the device's current ID, or -1 while it's unplugged
+	button_mask_t buttons;  // Every trigger and toggle button bound on this device
+	XDevice* device;        // XI1/XI2
+	evdev_input_t evdev;    // evdev
+#ifdef HAVE_XCB
+	unsigned int query_seq; // XCB: the button state query in flight, or 0
+#endif
+} input_device_t;
+
+typedef struct input_ops input_ops_t;
+
+// Most pointer devices the server can have that we keep track of
+#define MAX_KNOWN_DEVICES 128
+
+typedef struct
+{
+	int id;
+	char* name;
+} known_device_t;
+
+// The server's pointer devices by name, kept up to date from hierarchy events so finding an
+// unplugged device again doesn't take a fresh device list
+typedef struct
+{
+	int count;
+	known_device_t devices[MAX_KNOWN_DEVICES];
+} device_table_t;
+
+typedef struct
+{
+	const input_ops_t* ops;  // XI1/XI2: how the devices are reached
+	input_type type;
+	Display* display;
+	int xi_opcode;
+	int epoll_fd;  // evdev: every device's fd, so one wait covers all of them
+	bool grabbed;  // X input: the bound buttons are grabbed to disable their default action
+	mock_backend_t* mock;
+#ifdef HAVE_XCB
+	xcb_connection_t* xcb;  // The display's own connection, for the XCB backend
+#endif
+	device_table_t known;   // XI1/XI2: what hierarchy events have told us about the devices
+	int num_devices;
+	input_device_t devices[MAX_DEVICES];
+} input_t;
+
+// How the X input methods open a device, read its buttons and grab them: through the X server, or
+// through the mock backend
+struct input_ops
+{
+	bool (*open_device)(input_t* in, input_device_t* d);
+	bool (*query_buttons)(input_t* in, input_device_t* d, button_mask_t* mask);
+
+	// Like query_buttons, for polling: may return false straight away if the answer isn't in yet
+	bool (*poll_buttons)(input_t* in, input_device_t* d, button_mask_t* mask);
+
+	bool (*grab_button)(input_t* in, input_device_t* d, int button);
+	void (*ungrab_button)(input_t* in, input_device_t* d, int button);
+	void (*close_device)(input_t* in, input_device_t* d);
+	void (*flush)(input_t* in);
+};
+
+// Most emitted events the mock backend logs; later ones are only counted
+#define MOCK_MAX_EVENTS 4096
+
+typedef enum
+{
+	MOCK_CLICK,
+	MOCK_PRESS,
+	MOCK_RELEASE,
+	MOCK_MOTION,
+	MOCK_WINDOW_CLICK,  // At (dx, dy) in a binding's window
+	MOCK_MOVE_TO        // To (dx, dy) on the screen
+} mock_event_type;
+
+typedef struct
+{
+	mock_event_type type;
+	int button;
+	int dx, dy;
+	uint64_t time_ns;  // CLOCK_MONOTONIC, when it was emitted
+} mock_event_t;
+
+typedef struct
+{
+	int device_id;
+	bool open;
+	button_mask_t held;     // Set by the caller to script what the buttons do
+	button_mask_t grabbed;
+} mock_device_t;
+
+// The mock backend: button states are scripted by the caller, and everything the daemon emits is
+// logged with a timestamp, so the click loop can be tested and benchmarked without an X server
+struct mock_backend
+{
+	mock_device_t devices[MAX_DEVICES];
+	int num_devices;
+	uint64_t queries;  // Button state round trips a real server would have made
+	mock_event_t events[MOCK_MAX_EVENTS];
+	int num_events;
+	uint64_t total_events;
+	uint64_t flushes;  // Batches a real backend would have sent
+};
+
+typedef struct
+{
+	bool trigger_held;
+	bool toggle_active;
+	bool toggle_prev_pressed;
+	uint64_t start_ns;  // When the buttons last asked for clicking to start
+	uint64_t stop_ns;   // ...and to stop
+	uint64_t toggles;   // Number of times the toggle button flipped clicking on or off
+} click_state_t;
+
+// Never emit more than this many clicks at once when catching up on missed deadlines
+#define MAX_CATCHUP_CLICKS 64
+
+// Histogram buckets: each power of two is split into 2^HIST_SUB_BITS linear buckets, which keeps
+// every recorded value within ~3% of its bucket's bounds from nanoseconds up to centuries
+#define HIST_SUB_BITS 5
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((65 - HIST_SUB_BITS) * HIST_SUB_BUCKETS)
+
+typedef struct
+{
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t min;
+	uint64_t max;
+} hist_t;
+
+typedef struct
+{
+	hist_t press_to_click;    // Trigger press/toggle on -> first click
+	hist_t release_to_last;   // Trigger release/toggle off -> last click (0 if none came after)
+	hist_t interval_error;    // |time between clicks - configured delay|
+} latency_t;
+
+typedef struct
+{
+	uint64_t count;
+	uint64_t total_ns;
+	uint64_t max_ns;
+} stage_timer_t;
+
+// Which of the realtime settings took effect
+typedef struct
+{
+	bool sched;
+	bool mlock;
+	bool affinity;
+	bool slack;
+} realtime_status_t;
+
+typedef struct
+{
+	stage_timer_t input;  // Reading button state: XQueryDeviceState round trips or event processing
+	stage_timer_t emit;   // Sending clicks, including XFlush
+	stage_timer_t wait;   // Sleeping until the next click or button change
+	hist_t wake_late;     // How long after a click deadline the loop woke up for it
+	realtime_status_t realtime;
+	uint64_t loops;
+	uint64_t clicks;
+	uint64_t start_ns;
+} loop_stats_t;
+
+typedef struct
+{
+	uint64_t next_ns;    // Absolute CLOCK_MONOTONIC deadline of the next click
+	uint64_t period_ns;
+	overrun_policy policy;
+	uint64_t overruns;   // Click slots we woke up too late for
+
+	// A sequence to play in a loop instead of clicking every period_ns, or NULL
+	const sequence_t* seq;
+	int seq_pos;         // The event due at next_ns
+	uint64_t pass_ns;    // When the current pass through the sequence started
+} click_sched_t;
+
+// One binding's clicks: its button state and its place in the shared schedule
+typedef struct
+{
+	click_state_t state;
+	click_sched_t sched;
+	bool clicking;              // Whether the stream has been started
+	uint64_t clicks;
+	uint64_t last_click_ns;
+	bool first_click_pending;   // For the latency stats
+	int pressed_button;         // Held down by a drag that hasn't finished, or 0
+} click_stream_t;
+
+typedef struct
+{
+	int fd;                  // inotify fd watching the config file's directory, or -1
+	char name[NAME_MAX + 1]; // The config file's name within the directory
+} config_watch_t;
+
+// Most scripts connected to the control socket at once
+#define MAX_CONTROL_CLIENTS 6
+#define CONTROL_LINE_MAX 256
+
+typedef struct
+{
+	int fd;
+	size_t len;
+	char buf[CONTROL_LINE_MAX];  // Partial command line
+} control_client_t;
+
+typedef struct
+{
+	int listen_fd;
+	int epoll_fd;  // The listening socket and every client, so one fd says when there's work
+	const char* path;
+	control_client_t clients[MAX_CONTROL_CLIENTS];
+} control_t;
+
+// Room for every binding to switch on and off a couple of times before the clicking thread catches up
+#define CLICK_RING_SIZE 256
+
+// A binding's buttons switching its clicks on or off, passed from the input thread to the clicking thread
+typedef struct
+{
+	int binding;
+	bool clicking;
+	uint64_t time_ns;  // When the buttons asked for it
+	uint64_t toggles;  // The binding's toggle count so far, for the stats
+} click_event_t;
+
+// Single-producer, single-consumer queue of click events
+typedef struct
+{
+	click_event_t events[CLICK_RING_SIZE];
+	_Atomic uint32_t head;  // Next slot the input thread fills
+	_Atomic uint32_t tail;  // Next slot the clicking thread empties
+} click_ring_t;
+
+typedef struct
+{
+	input_t* in;
+	opts_t* opts;                          // Only changed while holding lock
+	uint64_t poll_ns;                      // XI1 polling interval for opts
+	click_stream_t streams[MAX_BINDINGS];  // The real button state; only .state is used
+	uint64_t published;                    // Bit i: binding i was last reported as clicking (MAX_BINDINGS is 64)
+	click_ring_t ring;
+	pthread_mutex_t lock;                  // Held by the input thread while it reads the buttons
+	int wake_fd;                           // eventfd, signalled when click events are queued
+	int stop_fd;                           // eventfd, signalled to shut the input thread down
+	pthread_t thread;
+} input_thread_t;
+
+// What woke the main loop up, as the epoll data of each source
+enum
+{
+	WAKE_INPUT = 1 << 0,    // The X connection, the evdev epoll set or the input thread
+	WAKE_TIMER = 1 << 1,    // The next click, XI1 poll or stats dump is due
+	WAKE_SIGNAL = 1 << 2,
+	WAKE_CONFIG = 1 << 3,   // The config file's directory changed
+	WAKE_CONTROL = 1 << 4,  // The control socket has a connection or a command
+	WAKE_WINDOW = 1 << 5,   // The window targets' connection has events
+};
+
+typedef struct
+{
+	int epoll_fd;
+	int timer_fd;             // Absolute CLOCK_MONOTONIC deadline of the next thing to do
+	int signal_fd;            // SIGINT/SIGTERM to stop, SIGUSR1 to dump stats, SIGHUP to reload
+	uint64_t timer_ns;        // What the timer is armed for, 0 if it isn't
+	Display* display;         // X connection whose queued events count as input, or NULL
+	Display* window_display;  // The window targets' connection, once it's watched
+} event_loop_t;
+
 typedef enum
 {
 	DELAY,
@@ -35,6 +617,16 @@ typedef enum
 	TOGGLE_BUTTON,
 	DEV_ID,
 	DEV_NAME,
+	INPUT,
+	OVERRUN,
+	STATS_INTERVAL,
+	STATS_FILE,
+	DELAY_US,
+	RATE,
+	OUTPUT,
+	BIND,
+	CONTROL,
+	DISPLAY,
 	COMMENT,
 	BLANK,
 	INVALID
@@ -42,435 +634,5424 @@ typedef enum
 
 
 bool read_opts(int argc, char** argv, opts_t* opts);
+void wait_for_fds(struct pollfd* pfds, int count, uint64_t deadline_ns);
+
+// Cleared by SIGINT/SIGTERM to shut the main loop down
+static volatile sig_atomic_t running = 1;
+
+// Set by SIGUSR1 to ask the main loop for a stats dump
+static volatile sig_atomic_t dump_requested = 0;
+
+// The mask the main thread waits with, once defer_signals() has blocked the signals above
+// everywhere else
+static sigset_t wait_sigmask;
+static pthread_t signal_thread;
+static bool signals_deferred = false;
+
+// The errors one X connection can get that aren't worth stopping for (see handle_x_error())
+typedef struct
+{
+	Display* display;
+	int bad_device;   // XInput's BadDevice code, once we're watching for devices coming and going, or -1
+	bool bad_window;  // Whether it's a window targets' connection, where BadWindow means one went away
+} x_error_filter_t;
+
+// Each display's input connection and window targets' connection can have one
+static x_error_filter_t x_error_filters[2 * MAX_DISPLAYS];
+static int num_x_error_filters = 0;
+static XErrorHandler default_x_error_handler = NULL;
+
+void handle_exit_signal(int sig)
+{
+	(void)sig;
+	running = 0;
+}
+
+void handle_dump_signal(int sig)
+{
+	(void)sig;
+	dump_requested = 1;
+}
 
 /**
- * Sleep for the specified number of milliseconds.
+ * Block the exit and dump signals in the calling thread, except while it's waiting in
+ * wait_for_fds() or sleep_until(). A signal that arrives just after a loop has checked running
+ * is then held until the next wait, which it cuts short, instead of being handled just before
+ * that wait starts and leaving it to run its full course.
  */
-void msleep(uint32_t ms)
+void defer_signals(void)
 {
-	struct timespec ts;
-	int res;
-
-	ts.tv_sec = ms / 1000;
-	ts.tv_nsec = (ms % 1000) * 1000000;
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGUSR1);
 
-	do
+	if (pthread_sigmask(SIG_BLOCK, &signals, &wait_sigmask) == 0)
 	{
-		res = nanosleep(&ts, &ts);
-	} while (res && errno == EINTR);
+		sigdelset(&wait_sigmask, SIGINT);
+		sigdelset(&wait_sigmask, SIGTERM);
+		sigdelset(&wait_sigmask, SIGUSR1);
+		signal_thread = pthread_self();
+		signals_deferred = true;
+	}
 }
 
 /**
- * Generate one synthetic mouse click.
+ * Return the signal mask for a wait in the calling thread to use, or NULL to leave it as it is.
  */
-void do_click(Display* display, int button)
+const sigset_t* waiting_sigmask(void)
 {
-	XTestFakeButtonEvent(display, button, 1, CurrentTime);
-	XFlush(display);
-	XTestFakeButtonEvent(display, button, 0, CurrentTime);
-	XFlush(display);
+	return signals_deferred && pthread_equal(pthread_self(), signal_thread) ? &wait_sigmask : NULL;
 }
 
 /**
- * Find and display a list of pointer devices.
+ * Return a connection's error filter, or NULL if it doesn't have one. If add is set, a connection
+ * without one gets a new one that lets nothing through, unless there's no room for it.
  */
-void find_mouse_device(Display* display)
+x_error_filter_t* x_error_filter(Display* display, bool add)
 {
-	XDeviceInfo* info;
-	int num_devices;
-
-	info = XListInputDevices(display, &num_devices);
-
-	for (int i = 0; i < num_devices; ++i)
+	for (int i = 0; i < num_x_error_filters; ++i)
 	{
-		if (info[i].use == IsXPointer || info[i].use == IsXExtensionPointer)
+		if (x_error_filters[i].display == display)
 		{
-			printf("Found pointing device (%d): %s -> %d\n", info[i].use, info[i].name, (int)info[i].id);
+			return &x_error_filters[i];
 		}
 	}
+	if (!add || num_x_error_filters == (int)(sizeof(x_error_filters) / sizeof(x_error_filters[0])))
+	{
+		return NULL;
+	}
 
-	XFreeDeviceList(info);
+	x_error_filter_t* filter = &x_error_filters[num_x_error_filters++];
+	filter->display = display;
+	filter->bad_device = -1;
+	filter->bad_window = false;
+	return filter;
 }
 
 /**
- * Return the device ID for the device with the given name, or -1 if not found.
+ * Drop a connection's error filter, before it's closed and its Display can be reused.
  */
-int get_device_id_from_name(Display* display, const char* name)
+void forget_x_errors(Display* display)
 {
-	XDeviceInfo* info;
-	int num_devices;
-	int ret = -1;
+	x_error_filter_t* filter = x_error_filter(display, false);
 
-	info = XListInputDevices(display, &num_devices);
-
-	for (int i = 0; i < num_devices; ++i)
+	if (filter != NULL)
 	{
-		if (info[i].use == IsXPointer || info[i].use == IsXExtensionPointer)
-		{
-			if (strcmp(name, info[i].name) == 0)
-			{
-				ret = (int)info[i].id;
-				break;
-			}
-		}
+		*filter = x_error_filters[--num_x_error_filters];
 	}
-
-	XFreeDeviceList(info);
-
-	return ret;
 }
 
 /**
- * Check the given device to determine if the given button is pressed.
+ * Ignore the BadDevice errors from requests about a device that was unplugged before the server
+ * got to them. The hierarchy event that says it went away is on its way, and takes care of it.
+ * Every other error but BadWindow goes to Xlib's own handler.
+ *
+ * Each connection has its own XInput error codes, so what's ignored is looked up by connection.
  */
-bool check_button_state(Display* display, XDevice* device, int button)
+int handle_x_error(Display* display, XErrorEvent* err)
 {
-	bool ret = false;
-	XDeviceState* st = XQueryDeviceState(display, device);
+	const x_error_filter_t* filter = x_error_filter(display, false);
 
-	if (!st)
+	if (filter != NULL && filter->bad_device >= 0 && err->error_code == filter->bad_device)
 	{
-		fprintf(stderr, "Cannot query device state\n");
-		goto done;
+		return 0;
 	}
 
-	XInputClass* ic = st->data;
-	if (ic->class != ButtonClass)
+	// Likewise for a window target that's closed while we look at it or click into it
+	if (filter != NULL && filter->bad_window && err->error_code == BadWindow)
 	{
-		fprintf(stderr, "Specified device has no buttons\n");
-		goto done;
+		return 0;
 	}
+	return default_x_error_handler(display, err);
+}
 
-	XButtonState* bstate = (XButtonState*)ic;
-	ret = bstate->buttons[button / 8] & (1 << button % 8);
-
-done:
-	XFreeDeviceState(st);
-	return ret;
+void install_x_error_handler(void)
+{
+	if (default_x_error_handler == NULL)
+	{
+		default_x_error_handler = XSetErrorHandler(handle_x_error);
+	}
 }
 
 /**
- * Check each button on the device to determine if it's pressed.
+ * Current CLOCK_MONOTONIC time in nanoseconds.
  */
-int find_pressed_button(Display* display, XDevice* device, int num_buttons)
+uint64_t monotonic_ns(void)
 {
-	// Walk through all available buttons until we find one that's pressed
-	for (int i = 1; i < num_buttons; ++i)
-	{
-		if (check_button_state(display, device, i))
-		{
-			return i;
-		}
-	}
-	return -1;
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
 }
 
 /**
- * Disable the default action of a button using XI1 grab.
- * Returns true on success, false on failure.
+ * Start a new click stream, with the first click due immediately (or, for a sequence, whenever
+ * its first click is due).
  */
-bool disable_button_default_action(Display* display, XDevice* device, int button)
+void sched_start(click_sched_t* sched, uint64_t now_ns)
 {
-	Window root = DefaultRootWindow(display);
-
-	// Use XI1 XGrabDeviceButton instead of XI2 XIGrabButton
-	// This should be more compatible with our XI1 polling approach
-	int result = XGrabDeviceButton(display,
-	                               device,
-	                               button,
-	                               AnyModifier,
-	                               NULL,           // modifier_device
-	                               root,
-	                               True,           // owner_events
-	                               0,              // event_count (we don't want events)
-	                               NULL,           // event_list
-	                               GrabModeAsync,  // this_device_mode
-	                               GrabModeAsync); // other_devices_mode
-
-	if (result != Success)
+	sched->next_ns = now_ns;
+	if (sched->seq != NULL)
 	{
-		return false;
+		sched->seq_pos = 0;
+		sched->pass_ns = now_ns;
+		sched->next_ns = now_ns + sched->seq->events[0].offset_ns;
 	}
-
-	return true;
 }
 
 /**
- * Help the user figure out what the desired device ID and button ID is.
+ * Return how many clicks are due at now_ns and advance the deadline past them.
+ *
+ * Deadlines always move in whole periods from the stream's start time, so time spent
+ * clicking or talking to the X server never accumulates into drift. If we woke up a full
+ * period or more late, the missed slots are counted as overruns and either clicked in a
+ * burst or dropped, depending on the policy.
  */
-void do_calibrate(Display* display)
+int sched_due(click_sched_t* sched, uint64_t now_ns)
 {
-	bool found = false;
-	printf("Press the mouse button you want to identify\n");
-	int button = 0;
-	Window root = RootWindow(display, 0);
-	XGrabPointer(display,
-	             root,
-	             False,
-	             ButtonPressMask | ButtonReleaseMask,
-	             GrabModeAsync,
-	             GrabModeAsync,
-	             root,
-	             None,
-	             CurrentTime);
-
-	while (!found)
+	if (now_ns < sched->next_ns)
 	{
-		// Walk the list of mouse devices until we find a pressed button
-		XDeviceInfo* info;
-		int num_devices;
+		return 0;
+	}
 
-		// Get the list of devices each time in case it changes
-		info = XListInputDevices(display, &num_devices);
+	// No delay at all means click as fast as we can
+	if (sched->period_ns == 0)
+	{
+		sched->next_ns = now_ns;
+		return 1;
+	}
 
-		for (int i = 0; i < num_devices; ++i)
-		{
-			int num_buttons = 0;
+	uint64_t missed = (now_ns - sched->next_ns) / sched->period_ns;
+	sched->next_ns += (missed + 1) * sched->period_ns;
+	sched->overruns += missed;
 
-			if (info[i].use != IsXExtensionPointer)
-			{
-				continue;
-			}
+	if (sched->policy == OVERRUN_SKIP || missed == 0)
+	{
+		return 1;
+	}
+	return missed < MAX_CATCHUP_CLICKS ? (int)missed + 1 : MAX_CATCHUP_CLICKS;
+}
 
-			XAnyClassPtr generic_info = info[i].inputclassinfo;
-			if (generic_info->class == ButtonClass)
-			{
-				XButtonInfoPtr button_info = (XButtonInfoPtr)generic_info;
-				num_buttons = button_info->num_buttons;
-			}
-			else
-			{
-				continue;
-			}
+/**
+ * Drop the steps of a burst that can go without leaving a button held: every move, since the steps
+ * after them have positions of their own, and clicks too if drop_clicks is set. Returns how many
+ * are left.
+ */
+int seq_drop_steps(seq_event_t* steps, int count, bool drop_clicks)
+{
+	int kept = 0;
 
-			// Get an XDevice from the device info
-			XDevice* device = XOpenDevice(display, info[i].id);
-			button = find_pressed_button(display, device, num_buttons);
-			if (button > 0)
-			{
-				printf("Found button: %s -> device %d button %d\n", info[i].name, (int)info[i].id, button);
-				printf("\nTo use this button as a trigger, run one of these commands:\n");
-				printf("  ./ac -i %d -t %d\n", (int)info[i].id, button);
-				printf("  ./ac -n \"%s\" -t %d\n", info[i].name, button);
-				found = true;
-				break;
-			}
+	for (int i = 0; i < count; ++i)
+	{
+		if (steps[i].action != SEQ_MOVE && (!drop_clicks || steps[i].action != SEQ_CLICK))
+		{
+			steps[kept++] = steps[i];
 		}
-
-		XFreeDeviceList(info);
 	}
-	XUngrabPointer(display, CurrentTime);
+	return kept;
 }
 
 /**
- * Compare a line in the config file with the name of a config parameter.
- *
- * Sort of like strcmp but more casual with \0 terminators.
+ * Make room in a full burst for step. Moves go first; a press or release also makes clicks go, and
+ * then whole drags, a press with its release straight after. Returns how many steps are left,
+ * which is still max if step is the one to drop.
  */
-bool comp(const char* config_line, const char* config_parm, size_t parmsize)
+int seq_make_room(seq_event_t* steps, int max, const seq_event_t* step)
 {
-	if (strlen(config_line) < parmsize)
+	bool holds = step->action == SEQ_PRESS || step->action == SEQ_RELEASE;
+	int count = seq_drop_steps(steps, max, holds);
+
+	for (int i = 0; count == max && holds && i + 1 < max; ++i)
 	{
-		return false;
+		if (steps[i].action == SEQ_PRESS && steps[i + 1].action == SEQ_RELEASE && steps[i].button == steps[i + 1].button)
+		{
+			memmove(&steps[i], &steps[i + 2], (max - i - 2) * sizeof(steps[0]));
+			count -= 2;
+		}
 	}
-	return memcmp(config_line, config_parm, parmsize) == 0;
+	return count;
 }
 
 /**
- * Compare a key in the config file with the given option type.
+ * Fill steps with the sequence steps that are due at now_ns, at most max of them, and advance the
+ * deadline past them. Each step's offset_ns is its deadline. Returns how many.
+ *
+ * Like sched_due(), every deadline is measured from the start of the pass, so playback never
+ * drifts however long it loops. If we woke up late enough that later clicks are due too, the ones
+ * we slept through count as overruns, and they're either played in a burst or dropped in favor
+ * of the latest ones. A drag's press and release are never dropped on their own, so a button
+ * can't be left held down.
  */
-#define check_config(_str, _type)          \
-	parmsize = strlen(_str);               \
-	if (pos) *pos = parmsize + 1;          \
-	if (comp(config_line, _str, parmsize)) \
-	{                                      \
-		return _type;                      \
-	}
-
-config_type get_config_type(const char* config_line, size_t line_len, size_t* pos)
+int seq_due(click_sched_t* sched, uint64_t now_ns, seq_event_t* steps, int max)
 {
-	bool start = true;
-	size_t parmsize = 0;
+	const sequence_t* seq = sched->seq;
+	int count = 0;
 
-	if (line_len == 0)
+	// Skip whole passes we slept through rather than walking them event by event. A drag always
+	// starts and finishes within one pass, so this drops whole drags and leaves whatever button
+	// is held now held until the release coming up.
+	if (now_ns > sched->next_ns && now_ns - sched->next_ns > seq->length_ns)
 	{
-		return BLANK;
+		uint64_t passes = (now_ns - sched->next_ns) / seq->length_ns;
+		sched->pass_ns += passes * seq->length_ns;
+		sched->next_ns += passes * seq->length_ns;
+		sched->overruns += passes * seq->num_events;
 	}
 
-	for (size_t i = 0; i < line_len; ++i)
+	uint64_t slot_ns = 0;
+	int in_slot = 0;
+	while (sched->next_ns <= now_ns)
 	{
-		// Ignore leading whitespace
-		if (start && (config_line[i] == ' ' || config_line[i] == '\t'))
-		{
-			continue;
-		}
+		uint64_t deadline_ns = sched->next_ns;
+		const seq_event_t* step = &seq->events[sched->seq_pos];
 
-		// EOL implies blank line
-		if (start && config_line[i] == '\n')
+		if (++sched->seq_pos == seq->num_events)
 		{
-			return BLANK;
+			sched->seq_pos = 0;
+			sched->pass_ns += seq->length_ns;
 		}
+		sched->next_ns = sched->pass_ns + seq->events[sched->seq_pos].offset_ns;
 
-		// Check if this is a comment line
-		if (config_line[i] == '#')
+		// Clicks sharing a deadline are meant to go together; a later one being due as well means
+		// we slept through the earlier ones
+		if (in_slot > 0 && deadline_ns != slot_ns)
 		{
-			if (start)
+			sched->overruns += in_slot;
+			in_slot = 0;
+			if (sched->policy == OVERRUN_SKIP)
 			{
-				return COMMENT;
+				count = seq_drop_steps(steps, count, true);
 			}
-			// I really don't think we should get here
-			return INVALID;
 		}
-
-		start = false;
-
-		// This switch just optimizes the number of strcmps we need to do
-		switch (config_line[i])
+		slot_ns = deadline_ns;
+		in_slot++;
+		if (count == max)
 		{
-		case 'c':
-			check_config("click_button", CLICK_BUTTON);
-			return INVALID;
-		case 't':
-			check_config("trigger_button", TRIGGER_BUTTON);
-			check_config("toggle_button", TOGGLE_BUTTON);
-			return INVALID;
-		case 'd':
-			check_config("delay", DELAY);
-			check_config("dev_id", DEV_ID);
-			check_config("dev_name", DEV_NAME);
-			return INVALID;
-		default:
-			return INVALID;
+			count = seq_make_room(steps, max, step);
+		}
+		if (count < max)
+		{
+			steps[count] = *step;
+			steps[count++].offset_ns = deadline_ns;
 		}
 	}
-	return INVALID;
+	return count;
 }
 
 /**
- * Read an integer from a config file line.
+ * Fill steps with the clicks a stream has due at now_ns, in order, each with its deadline as its
+ * offset_ns, and advance its schedule past them. Returns how many, at most MAX_CATCHUP_CLICKS.
  */
-#define read_int(_dest)                      \
-	value = atoi(&line[pos]);                \
-	if (value > 0)                           \
-	{                                        \
-		_dest = value;                       \
-	}                                        \
-	else                                     \
-	{                                        \
-		fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line); \
-		return false;                        \
+int due_clicks(click_sched_t* sched, int click_button, uint64_t now_ns, seq_event_t* steps)
+{
+	if (sched->seq != NULL)
+	{
+		return seq_due(sched, now_ns, steps, MAX_CATCHUP_CLICKS);
+	}
+
+	// The clicks that go out are the latest ones, a period apart up to the new deadline
+	int count = sched_due(sched, now_ns);
+	for (int i = 0; i < count; ++i)
+	{
+		memset(&steps[i], 0, sizeof(steps[i]));
+		steps[i].offset_ns = sched->next_ns - (uint64_t)(count - i) * sched->period_ns;
+		steps[i].button = click_button;
+		steps[i].action = SEQ_CLICK;
 	}
+	return count;
+}
 
 /**
- * Gross config file parsing logic.
- *
- * Don't read this unless you absolutely have to.
+ * Sleep until the given absolute CLOCK_MONOTONIC time. Returns early if interrupted by a signal.
  */
-bool parse_config_file(const char* filename, opts_t* opts)
+void sleep_until(uint64_t deadline_ns)
 {
-	FILE* fp = NULL;
-	char* line = NULL;
-	size_t line_len = 0;
-	ssize_t read_len = 0;
-	int value = -1;
-	int line_num = 0;
+	struct timespec ts;
 
-	// Open the file
-	fp = fopen(filename, "r");
-	if (fp == NULL)
+	// The signals can only come in during the wait itself
+	if (waiting_sigmask() != NULL)
 	{
-		fprintf(stderr, "Error opening file %s for reading\n", filename);
-		return false;
+		wait_for_fds(NULL, 0, deadline_ns);
+		return;
 	}
 
-	// Read and process each line
-	while ((read_len = getline(&line, &line_len, fp)) != -1)
+	ts.tv_sec = deadline_ns / NS_PER_SEC;
+	ts.tv_nsec = deadline_ns % NS_PER_SEC;
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+}
+
+/**
+ * Return the histogram bucket for a value.
+ */
+int hist_bucket(uint64_t value)
+{
+	if (value < 2 * HIST_SUB_BUCKETS)
 	{
-		++line_num;
-		size_t pos;
-		config_type t = get_config_type(line, line_len, &pos);
+		return (int)value;
+	}
 
-		// Read the value for the parameter
-		switch (t)
-		{
-		case DELAY:
-			read_int(opts->delay_ms);
-			break;
-		case CLICK_BUTTON:
-			read_int(opts->click_button);
-			break;
-		case DEV_ID:
-			read_int(opts->device_id);
-			break;
-		case TRIGGER_BUTTON:
-			read_int(opts->trigger_button);
-			break;
-		case TOGGLE_BUTTON:
-			read_int(opts->toggle_button);
-			break;
-		case DEV_NAME:
-		{
-			int i = 0;
+	int msb = 63 - __builtin_clzll(value);
+	int shift = msb - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB_BUCKETS + (int)((value >> shift) & (HIST_SUB_BUCKETS - 1));
+}
 
-			// Allocate a buffer for the device name and copy the name from the file into it
-			// +1 for null terminator (this gets leaked but it doesn't matter)
-			opts->device_name = malloc(strlen(&line[pos]) + 1);
-			if (opts->device_name == NULL)
-			{
-				fprintf(stderr, "Memory allocation failed\n");
-				fclose(fp);
-				if (line != NULL)
-				{
-					free(line);
-				}
-				return false;
-			}
-			for (char c = line[pos++]; c != '#' && c != '\n' && c != '\0'; c = line[pos++])
-			{
-				opts->device_name[i++] = c;
-			}
-			opts->device_name[i] = '\0';
-		}
-			break;
-		case COMMENT:
-		case BLANK:
-			continue;
-		case INVALID:
-			fprintf(stderr, "Error reading config file on line %d\n", line_num);
-			return false;
-		}
+/**
+ * Return the largest value that lands in the given bucket.
+ */
+uint64_t hist_bucket_max(int bucket)
+{
+	if (bucket < 2 * HIST_SUB_BUCKETS)
+	{
+		return bucket;
 	}
 
-	fclose(fp);
-	if (line != NULL)
+	int shift = bucket / HIST_SUB_BUCKETS - 1;
+	uint64_t mantissa = HIST_SUB_BUCKETS + bucket % HIST_SUB_BUCKETS;
+	return ((mantissa + 1) << shift) - 1;
+}
+
+void hist_record(hist_t* hist, uint64_t value)
+{
+	if (hist->total == 0 || value < hist->min)
 	{
-		free(line);
+		hist->min = value;
 	}
-	return true;
+	if (value > hist->max)
+	{
+		hist->max = value;
+	}
+	hist->counts[hist_bucket(value)]++;
+	hist->total++;
 }
 
-bool read_opts(int argc, char** argv, opts_t* opts)
+/**
+ * Return the value at the given percentile (0-100), to within the bucket precision.
+ */
+uint64_t hist_percentile(const hist_t* hist, double pct)
 {
-	// Set defaults
-	opts->click_button = 1;
-	opts->trigger_button = -1;
-	opts->toggle_button = -1;
-	opts->delay_ms = 50;
-	opts->device_id = -1;
-	opts->device_name = NULL;
-	opts->calibrate_mode = false;
-	opts->list_mode = false;
-	opts->disable_default_action = true;
+	uint64_t target = (uint64_t)(hist->total * pct / 100 + 0.5);
+	uint64_t seen = 0;
 
-	for (int i = 1; i < argc; ++i)
+	if (target == 0)
 	{
-		if (argv[i][0] == '-')
+		target = 1;
+	}
+
+	for (int i = 0; i < HIST_BUCKETS; ++i)
+	{
+		seen += hist->counts[i];
+		if (seen >= target)
 		{
-			// Ensure no reading off the end of the array
-			switch (argv[i][1])
-			{
-			case 'd':
-			case 'b':
+			uint64_t value = hist_bucket_max(i);
+			return value < hist->max ? value : hist->max;
+		}
+	}
+	return hist->max;
+}
+
+/**
+ * Print one line summarizing a histogram of nanosecond values, in microseconds.
+ */
+void hist_print(FILE* fp, const char* name, const hist_t* hist)
+{
+	if (hist->total == 0)
+	{
+		fprintf(fp, "  %-18s no samples\n", name);
+		return;
+	}
+
+	fprintf(fp,
+	        "  %-18s n=%-8" PRIu64 " min=%.1f p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f us\n",
+	        name,
+	        hist->total,
+	        hist->min / (double)NS_PER_US,
+	        hist_percentile(hist, 50) / (double)NS_PER_US,
+	        hist_percentile(hist, 90) / (double)NS_PER_US,
+	        hist_percentile(hist, 99) / (double)NS_PER_US,
+	        hist_percentile(hist, 99.9) / (double)NS_PER_US,
+	        hist->max / (double)NS_PER_US);
+}
+
+/**
+ * Note that one of a stream's clicks went out at click_ns.
+ */
+void latency_click(latency_t* lat, click_stream_t* stream, uint64_t click_ns)
+{
+	if (stream->first_click_pending)
+	{
+		uint64_t start_ns = stream->state.start_ns;
+		hist_record(&lat->press_to_click, click_ns > start_ns ? click_ns - start_ns : 0);
+		stream->first_click_pending = false;
+	}
+	else if (stream->sched.seq == NULL)
+	{
+		// A sequence's gaps vary, so only a steady stream has an interval to miss
+		uint64_t interval = click_ns - stream->last_click_ns;
+		uint64_t period_ns = stream->sched.period_ns;
+		hist_record(&lat->interval_error, interval > period_ns ? interval - period_ns : period_ns - interval);
+	}
+	stream->last_click_ns = click_ns;
+}
+
+/**
+ * Note that a click stream has ended, having been asked to stop at its state's stop_ns.
+ */
+void latency_stop(latency_t* lat, const click_stream_t* stream)
+{
+	uint64_t stop_ns = stream->state.stop_ns;
+
+	if (!stream->first_click_pending)
+	{
+		hist_record(&lat->release_to_last, stream->last_click_ns > stop_ns ? stream->last_click_ns - stop_ns : 0);
+	}
+}
+
+void latency_print(FILE* fp, const latency_t* lat)
+{
+	fprintf(fp, "Latency:\n");
+	hist_print(fp, "press->first click", &lat->press_to_click);
+	hist_print(fp, "release->last click", &lat->release_to_last);
+	hist_print(fp, "interval error", &lat->interval_error);
+}
+
+/**
+ * Add the time since start_ns to a stage timer. Returns the current time.
+ */
+uint64_t stage_end(stage_timer_t* timer, uint64_t start_ns)
+{
+	uint64_t now_ns = monotonic_ns();
+	uint64_t elapsed = now_ns - start_ns;
+
+	timer->count++;
+	timer->total_ns += elapsed;
+	if (elapsed > timer->max_ns)
+	{
+		timer->max_ns = elapsed;
+	}
+	return now_ns;
+}
+
+void stage_print(FILE* fp, const char* name, const stage_timer_t* timer, uint64_t wall_ns)
+{
+	fprintf(fp,
+	        "  %-6s n=%-10" PRIu64 " total=%.3f ms (%.1f%%) avg=%.2f us max=%.2f us\n",
+	        name,
+	        timer->count,
+	        timer->total_ns / (double)NS_PER_MS,
+	        wall_ns > 0 ? 100.0 * timer->total_ns / wall_ns : 0,
+	        timer->count > 0 ? timer->total_ns / (double)timer->count / NS_PER_US : 0,
+	        timer->max_ns / (double)NS_PER_US);
+}
+
+/**
+ * Print the loop statistics.
+ */
+void stats_print(FILE* fp, const loop_stats_t* stats, const click_stream_t* streams, int num_streams)
+{
+	uint64_t wall_ns = monotonic_ns() - stats->start_ns;
+	uint64_t toggles = 0;
+	uint64_t overruns = 0;
+
+	for (int i = 0; i < num_streams; ++i)
+	{
+		toggles += streams[i].state.toggles;
+		overruns += streams[i].sched.overruns;
+	}
+
+	fprintf(fp, "Stats after %.3f s:\n", wall_ns / (double)NS_PER_SEC);
+	fprintf(fp,
+	        "  clicks=%" PRIu64 " toggles=%" PRIu64 " overruns=%" PRIu64 " loops=%" PRIu64 "\n",
+	        stats->clicks,
+	        toggles,
+	        overruns,
+	        stats->loops);
+	stage_print(fp, "input", &stats->input, wall_ns);
+	stage_print(fp, "emit", &stats->emit, wall_ns);
+	stage_print(fp, "wait", &stats->wait, wall_ns);
+	hist_print(fp, "wakeup lateness", &stats->wake_late);
+}
+
+/**
+ * Describe the requested realtime settings and whether each one took effect.
+ */
+void realtime_describe(const opts_t* opts, const realtime_status_t* status, char* buf, size_t len)
+{
+	int n = snprintf(buf,
+	                 len,
+	                 "%s priority %d %s, mlockall %s, ",
+	                 opts->rt_policy == SCHED_RR ? "SCHED_RR" : "SCHED_FIFO",
+	                 opts->rt_priority,
+	                 status->sched ? "on" : "failed",
+	                 status->mlock ? "on" : "failed");
+
+	if (opts->rt_cpu >= 0 && n >= 0 && (size_t)n < len)
+	{
+		n += snprintf(buf + n, len - n, "cpu %d %s, ", opts->rt_cpu, status->affinity ? "on" : "failed");
+	}
+	if (n >= 0 && (size_t)n < len)
+	{
+		snprintf(buf + n, len - n, "timer slack %s", status->slack ? "on" : "failed");
+	}
+}
+
+/**
+ * Print whichever statistics are enabled.
+ */
+void dump_stats(FILE* fp,
+                const opts_t* opts,
+                const loop_stats_t* stats,
+                const click_stream_t* streams,
+                const latency_t* latency)
+{
+	if (opts->loop_stats)
+	{
+		stats_print(fp, stats, streams, opts->num_bindings);
+		if (opts->realtime)
+		{
+			char desc[160];
+			realtime_describe(opts, &stats->realtime, desc, sizeof(desc));
+			fprintf(fp, "  realtime: %s\n", desc);
+		}
+	}
+	if (opts->latency_stats)
+	{
+		latency_print(fp, latency);
+	}
+	fflush(fp);
+}
+
+/**
+ * Generate one synthetic mouse click. The press and release go out in one flush.
+ */
+void do_click(Display* display, int button)
+{
+	XTestFakeButtonEvent(display, button, 1, CurrentTime);
+	XTestFakeButtonEvent(display, button, 0, CurrentTime);
+	XFlush(display);
+}
+
+/**
+ * Translate an X button number into the evdev event that produces it.
+ *
+ * This is the reverse of the mapping the evdev/libinput X drivers use: 1-3 are the usual
+ * buttons, 4-7 are wheel steps and 8 and up are the side/extra buttons. Returns false for
+ * button numbers that have no evdev equivalent.
+ */
+bool x_button_to_evdev(int button, struct input_event* ev)
+{
+	static const struct
+	{
+		uint16_t type;
+		uint16_t code;
+		int32_t value;  // Wheel direction for EV_REL buttons
+	} map[] = {
+	    {EV_KEY, BTN_LEFT, 0},     // 1
+	    {EV_KEY, BTN_MIDDLE, 0},   // 2
+	    {EV_KEY, BTN_RIGHT, 0},    // 3
+	    {EV_REL, REL_WHEEL, 1},    // 4: wheel up
+	    {EV_REL, REL_WHEEL, -1},   // 5: wheel down
+	    {EV_REL, REL_HWHEEL, -1},  // 6: wheel left
+	    {EV_REL, REL_HWHEEL, 1},   // 7: wheel right
+	    {EV_KEY, BTN_SIDE, 0},     // 8
+	    {EV_KEY, BTN_EXTRA, 0},    // 9
+	    {EV_KEY, BTN_FORWARD, 0},  // 10
+	    {EV_KEY, BTN_BACK, 0},     // 11
+	    {EV_KEY, BTN_TASK, 0},     // 12
+	};
+
+	if (button < 1 || button > (int)(sizeof(map) / sizeof(map[0])))
+	{
+		return false;
+	}
+
+	memset(ev, 0, sizeof(*ev));
+	ev->type = map[button - 1].type;
+	ev->code = map[button - 1].code;
+	ev->value = map[button - 1].value;
+	return true;
+}
+
+/**
+ * Fill in the evdev events for one click of the given X button.
+ *
+ * A click is press, sync, release, sync; wheel "buttons" are a single step and a sync.
+ * Returns the number of events written to ev (at most 4), or 0 if the button can't be mapped.
+ */
+int build_click_events(int button, struct input_event ev[4])
+{
+	struct input_event action;
+
+	if (!x_button_to_evdev(button, &action))
+	{
+		return 0;
+	}
+
+	memset(ev, 0, 4 * sizeof(ev[0]));
+	if (action.type == EV_REL)
+	{
+		ev[0] = action;
+		ev[1].type = EV_SYN;
+		ev[1].code = SYN_REPORT;
+		return 2;
+	}
+
+	ev[0] = action;
+	ev[0].value = 1;
+	ev[1].type = EV_SYN;
+	ev[1].code = SYN_REPORT;
+	ev[2] = action;
+	ev[2].value = 0;
+	ev[3].type = EV_SYN;
+	ev[3].code = SYN_REPORT;
+	return 4;
+}
+
+/**
+ * Create a virtual mouse through /dev/uinput. Returns the uinput fd, or -1 on failure.
+ */
+int open_uinput_mouse(void)
+{
+	static const int buttons[] = {
+	    BTN_LEFT, BTN_MIDDLE, BTN_RIGHT, BTN_SIDE, BTN_EXTRA, BTN_FORWARD, BTN_BACK, BTN_TASK};
+	static const int axes[] = {REL_X, REL_Y, REL_WHEEL, REL_HWHEEL};
+	struct uinput_setup setup;
+
+	int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Cannot open /dev/uinput: %s\n", strerror(errno));
+		return -1;
+	}
+
+	// X only treats the device as a pointer if it can also move
+	ioctl(fd, UI_SET_EVBIT, EV_KEY);
+	ioctl(fd, UI_SET_EVBIT, EV_REL);
+	for (size_t i = 0; i < sizeof(buttons) / sizeof(buttons[0]); ++i)
+	{
+		ioctl(fd, UI_SET_KEYBIT, buttons[i]);
+	}
+	for (size_t i = 0; i < sizeof(axes) / sizeof(axes[0]); ++i)
+	{
+		ioctl(fd, UI_SET_RELBIT, axes[i]);
+	}
+
+	memset(&setup, 0, sizeof(setup));
+	setup.id.bustype = BUS_VIRTUAL;
+	snprintf(setup.name, sizeof(setup.name), "autoclickd virtual mouse");
+
+	if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0)
+	{
+		fprintf(stderr, "Cannot create uinput device: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Check that every button a binding clicks can be sent through uinput, and say which one can't.
+ */
+bool check_uinput_buttons(const binding_t* b)
+{
+	// Clicks into a window don't go through uinput
+	if (b->window != NULL)
+	{
+		return true;
+	}
+
+	// The virtual mouse only moves relative to wherever the pointer is
+	if (b->sequence != NULL && b->sequence->moves)
+	{
+		fprintf(stderr, "Moving the pointer to a point on the screen doesn't work through uinput\n");
+		return false;
+	}
+
+	int num_buttons = b->sequence != NULL ? b->sequence->num_events : 1;
+
+	for (int i = 0; i < num_buttons; ++i)
+	{
+		struct input_event ev;
+		int button = b->sequence != NULL ? b->sequence->events[i].button : b->click_button;
+
+		if (!x_button_to_evdev(button, &ev))
+		{
+			fprintf(stderr, "Button %d can't be clicked through uinput\n", button);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Generate one click through the uinput device, as a single write().
+ */
+void uinput_click(int fd, int button)
+{
+	struct input_event ev[4];
+	int count = build_click_events(button, ev);
+
+	if (count > 0 && write(fd, ev, count * sizeof(ev[0])) < 0)
+	{
+		fprintf(stderr, "uinput write failed: %s\n", strerror(errno));
+	}
+}
+
+void xtest_output_click(output_t* out, int button)
+{
+	do_click(out->display, button);
+}
+
+void xtest_output_button(output_t* out, int button, bool pressed)
+{
+	XTestFakeButtonEvent(out->display, button, pressed, CurrentTime);
+	XFlush(out->display);
+}
+
+void xtest_output_motion(output_t* out, int dx, int dy)
+{
+	XTestFakeRelativeMotionEvent(out->display, dx, dy, CurrentTime);
+	XFlush(out->display);
+}
+
+/**
+ * Move the pointer and press, release or click its button with one flush.
+ */
+void xtest_output_step(output_t* out, const seq_event_t* step)
+{
+	if (step->moves)
+	{
+		XTestFakeMotionEvent(out->display, -1, step->x, step->y, CurrentTime);
+	}
+	if (step->action != SEQ_MOVE && step->action != SEQ_RELEASE)
+	{
+		XTestFakeButtonEvent(out->display, step->button, True, CurrentTime);
+	}
+	if (step->action == SEQ_CLICK || step->action == SEQ_RELEASE)
+	{
+		XTestFakeButtonEvent(out->display, step->button, False, CurrentTime);
+	}
+	XFlush(out->display);
+}
+
+const output_ops_t xtest_output_ops = {xtest_output_click, xtest_output_button, xtest_output_motion, xtest_output_step};
+
+void uinput_output_click(output_t* out, int button)
+{
+	uinput_click(out->uinput_fd, button);
+}
+
+/**
+ * Press or release a button as a single write(). Wheel buttons scroll one step when pressed and
+ * do nothing when released.
+ */
+void uinput_output_button(output_t* out, int button, bool pressed)
+{
+	struct input_event ev[2];
+
+	if (!x_button_to_evdev(button, &ev[0]) || (ev[0].type == EV_REL && !pressed))
+	{
+		return;
+	}
+	if (ev[0].type == EV_KEY)
+	{
+		ev[0].value = pressed;
+	}
+	memset(&ev[1], 0, sizeof(ev[1]));
+	ev[1].type = EV_SYN;
+	ev[1].code = SYN_REPORT;
+	if (write(out->uinput_fd, ev, sizeof(ev)) < 0)
+	{
+		fprintf(stderr, "uinput write failed: %s\n", strerror(errno));
+	}
+}
+
+/**
+ * Move the pointer as a single write().
+ */
+void uinput_output_motion(output_t* out, int dx, int dy)
+{
+	struct input_event ev[3];
+	int count = 0;
+
+	memset(ev, 0, sizeof(ev));
+	if (dx != 0)
+	{
+		ev[count].type = EV_REL;
+		ev[count].code = REL_X;
+		ev[count++].value = dx;
+	}
+	if (dy != 0)
+	{
+		ev[count].type = EV_REL;
+		ev[count].code = REL_Y;
+		ev[count++].value = dy;
+	}
+	ev[count].type = EV_SYN;
+	ev[count++].code = SYN_REPORT;
+	if (count > 1 && write(out->uinput_fd, ev, count * sizeof(ev[0])) < 0)
+	{
+		fprintf(stderr, "uinput write failed: %s\n", strerror(errno));
+	}
+}
+
+/**
+ * Sequences that move the pointer are turned down when the output is opened, so this only ever
+ * has a button to press, release or click.
+ */
+void uinput_output_step(output_t* out, const seq_event_t* step)
+{
+	if (step->action == SEQ_CLICK)
+	{
+		uinput_output_click(out, step->button);
+	}
+	else if (step->action != SEQ_MOVE)
+	{
+		uinput_output_button(out, step->button, step->action == SEQ_PRESS);
+	}
+}
+
+const output_ops_t uinput_output_ops = {uinput_output_click, uinput_output_button, uinput_output_motion, uinput_output_step};
+
+/**
+ * Log something the daemon emitted to the mock backend.
+ */
+void mock_log(mock_backend_t* mock, mock_event_type type, int button, int dx, int dy)
+{
+	if (mock->num_events < MOCK_MAX_EVENTS)
+	{
+		mock_event_t* ev = &mock->events[mock->num_events++];
+		ev->type = type;
+		ev->button = button;
+		ev->dx = dx;
+		ev->dy = dy;
+		ev->time_ns = monotonic_ns();
+	}
+	mock->total_events++;
+}
+
+void mock_output_click(output_t* out, int button)
+{
+	mock_log(out->mock, MOCK_CLICK, button, 0, 0);
+	out->mock->flushes++;
+}
+
+void mock_output_button(output_t* out, int button, bool pressed)
+{
+	mock_log(out->mock, pressed ? MOCK_PRESS : MOCK_RELEASE, button, 0, 0);
+	out->mock->flushes++;
+}
+
+void mock_output_motion(output_t* out, int dx, int dy)
+{
+	mock_log(out->mock, MOCK_MOTION, 0, dx, dy);
+	out->mock->flushes++;
+}
+
+void mock_output_step(output_t* out, const seq_event_t* step)
+{
+	if (step->moves)
+	{
+		mock_log(out->mock, MOCK_MOVE_TO, 0, step->x, step->y);
+	}
+	if (step->action != SEQ_MOVE)
+	{
+		mock_event_type type = step->action == SEQ_CLICK ? MOCK_CLICK : step->action == SEQ_PRESS ? MOCK_PRESS : MOCK_RELEASE;
+		mock_log(out->mock, type, step->button, 0, 0);
+	}
+	out->mock->flushes++;
+}
+
+const output_ops_t mock_output_ops = {mock_output_click, mock_output_button, mock_output_motion, mock_output_step};
+
+#ifdef HAVE_XCB
+void xcb_fake_button(output_t* out, int button, bool pressed)
+{
+	xcb_test_fake_input(out->xcb, pressed ? XCB_BUTTON_PRESS : XCB_BUTTON_RELEASE, button, XCB_CURRENT_TIME, XCB_NONE, 0, 0, 0);
+}
+
+/**
+ * Both halves of the click go out in one write, with no reply to wait for.
+ */
+void xcb_output_click(output_t* out, int button)
+{
+	xcb_fake_button(out, button, true);
+	xcb_fake_button(out, button, false);
+	xcb_flush(out->xcb);
+}
+
+void xcb_output_button(output_t* out, int button, bool pressed)
+{
+	xcb_fake_button(out, button, pressed);
+	xcb_flush(out->xcb);
+}
+
+void xcb_output_motion(output_t* out, int dx, int dy)
+{
+	// A detail of 1 makes the motion relative
+	xcb_test_fake_input(out->xcb, XCB_MOTION_NOTIFY, 1, XCB_CURRENT_TIME, XCB_NONE, dx, dy, 0);
+	xcb_flush(out->xcb);
+}
+
+/**
+ * The move and the button events go out in one write.
+ */
+void xcb_output_step(output_t* out, const seq_event_t* step)
+{
+	if (step->moves)
+	{
+		// A detail of 0 makes the motion absolute, on the pointer's screen
+		xcb_test_fake_input(out->xcb, XCB_MOTION_NOTIFY, 0, XCB_CURRENT_TIME, XCB_NONE, step->x, step->y, 0);
+	}
+	if (step->action != SEQ_MOVE && step->action != SEQ_RELEASE)
+	{
+		xcb_fake_button(out, step->button, true);
+	}
+	if (step->action == SEQ_CLICK || step->action == SEQ_RELEASE)
+	{
+		xcb_fake_button(out, step->button, false);
+	}
+	xcb_flush(out->xcb);
+}
+
+const output_ops_t xcb_output_ops = {xcb_output_click, xcb_output_button, xcb_output_motion, xcb_output_step};
+#endif  // HAVE_XCB
+
+/**
+ * Whether any binding clicks into a window.
+ */
+bool has_window_targets(const opts_t* opts)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		if (opts->bindings[i].window != NULL)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Set up the configured output backend. Returns false if it can't be used.
+ */
+bool open_output(output_t* out, const opts_t* opts, Display* display)
+{
+	out->ops = opts->output == OUTPUT_UINPUT ? &uinput_output_ops : &xtest_output_ops;
+	out->type = opts->output;
+	out->display = display;
+	out->uinput_fd = -1;
+	out->mock = opts->mock;
+	out->window_display = NULL;
+	out->window_failed = false;
+
+	if (out->mock != NULL)
+	{
+		out->ops = &mock_output_ops;
+		return true;
+	}
+	if (display == NULL && has_window_targets(opts))
+	{
+		fprintf(stderr, "Clicking into windows needs an X display\n");
+		return false;
+	}
+#ifdef HAVE_XCB
+	if (opts->xcb && out->type == OUTPUT_XTEST)
+	{
+		out->ops = &xcb_output_ops;
+		out->xcb = XGetXCBConnection(display);
+	}
+#endif
+
+	if (out->type == OUTPUT_UINPUT)
+	{
+		for (int i = 0; i < opts->num_bindings; ++i)
+		{
+			if (!check_uinput_buttons(&opts->bindings[i]))
+			{
+				return false;
+			}
+		}
+		out->uinput_fd = open_uinput_mouse();
+		return out->uinput_fd >= 0;
+	}
+
+	return true;
+}
+
+/**
+ * Click the given button through whichever backend is configured.
+ */
+void emit_click(output_t* out, int button)
+{
+	out->ops->click(out, button);
+}
+
+/**
+ * Press or release a button through whichever backend is configured.
+ */
+void emit_button(output_t* out, int button, bool pressed)
+{
+	out->ops->button(out, button, pressed);
+}
+
+/**
+ * Move the pointer by dx, dy pixels through whichever backend is configured.
+ */
+void emit_motion(output_t* out, int dx, int dy)
+{
+	out->ops->motion(out, dx, dy);
+}
+
+/**
+ * Play one step of a sequence through whichever backend is configured. Plain clicks take the
+ * backend's click path.
+ */
+void emit_step(output_t* out, const seq_event_t* step)
+{
+	if (!step->moves && step->action == SEQ_CLICK)
+	{
+		out->ops->click(out, step->button);
+	}
+	else
+	{
+		out->ops->step(out, step);
+	}
+}
+
+/**
+ * The connection window targets are looked up and clicked through, opened the first time it's
+ * needed. Returns NULL if it can't be opened.
+ */
+Display* window_connection(output_t* out)
+{
+	if (out->window_display == NULL && !out->window_failed)
+	{
+		out->window_display = XOpenDisplay(DisplayString(out->display));
+		if (out->window_display == NULL)
+		{
+			fprintf(stderr, "Cannot open X display for the window targets\n");
+			out->window_failed = true;
+			return NULL;
+		}
+		install_x_error_handler();
+		x_error_filter_t* filter = x_error_filter(out->window_display, true);
+		if (filter != NULL)
+		{
+			filter->bad_window = true;
+		}
+		out->net_wm_name = XInternAtom(out->window_display, "_NET_WM_NAME", False);
+		out->utf8_string = XInternAtom(out->window_display, "UTF8_STRING", False);
+
+		// New windows are where missing targets might turn up
+		XSelectInput(out->window_display, DefaultRootWindow(out->window_display), SubstructureNotifyMask);
+	}
+	return out->window_display;
+}
+
+/**
+ * Whether a window is a viewable match for the target's class or title. The title is the UTF-8
+ * _NET_WM_NAME that current toolkits set, or WM_NAME for windows that don't have one.
+ */
+bool window_matches(const output_t* out, Window w, const window_target_t* t)
+{
+	Display* display = out->window_display;
+	bool match = false;
+
+	if (t->match == WINDOW_BY_TITLE)
+	{
+		Atom type = None;
+		int format;
+		unsigned long len, remaining;
+		unsigned char* utf8_name = NULL;
+		char* name = NULL;
+
+		if (XGetWindowProperty(display, w, out->net_wm_name, 0, 1024, False, out->utf8_string, &type, &format,
+		                       &len, &remaining, &utf8_name) == Success &&
+		    utf8_name != NULL && type == out->utf8_string)
+		{
+			match = strcmp((const char*)utf8_name, t->value) == 0;
+		}
+		else if (XFetchName(display, w, &name) && name != NULL)
+		{
+			match = strcmp(name, t->value) == 0;
+			XFree(name);
+		}
+		if (utf8_name != NULL)
+		{
+			XFree(utf8_name);
+		}
+	}
+	else
+	{
+		XClassHint hint = {NULL, NULL};
+		if (XGetClassHint(display, w, &hint))
+		{
+			match = (hint.res_class != NULL && strcmp(hint.res_class, t->value) == 0) ||
+			        (hint.res_name != NULL && strcmp(hint.res_name, t->value) == 0);
+			XFree(hint.res_name);
+			XFree(hint.res_class);
+		}
+	}
+
+	XWindowAttributes attrs;
+	return match && XGetWindowAttributes(display, w, &attrs) && attrs.map_state == IsViewable;
+}
+
+/**
+ * Search the window tree below w for the target's window, topmost windows first. Returns None if
+ * there's no match.
+ */
+Window find_window(const output_t* out, Window w, const window_target_t* t)
+{
+	Window root, parent, *children = NULL;
+	unsigned int num_children = 0;
+	Window found = None;
+
+	if (window_matches(out, w, t))
+	{
+		return w;
+	}
+	if (!XQueryTree(out->window_display, w, &root, &parent, &children, &num_children))
+	{
+		return None;
+	}
+	for (unsigned int i = num_children; i-- > 0 && found == None;)
+	{
+		found = find_window(out, children[i], t);
+	}
+	if (children != NULL)
+	{
+		XFree(children);
+	}
+	return found;
+}
+
+const char* window_match_name(window_match match)
+{
+	return match == WINDOW_BY_ID ? "ID" : match == WINDOW_BY_CLASS ? "class" : "title";
+}
+
+/**
+ * Make sure the target's window and the subwindow under the click point are known, looking them up
+ * if they aren't. Returns false if the window isn't there; it's looked for again once a window is
+ * mapped, but no sooner than WINDOW_LOOKUP_NS after the last try.
+ */
+bool resolve_window_target(const output_t* out, window_target_t* t)
+{
+	Display* display = out->window_display;
+	Window root = DefaultRootWindow(display);
+
+	// A burst of windows being mapped, like a desktop session starting, would otherwise walk the
+	// whole window tree for each one
+	if (t->window == None && t->lookup_due && monotonic_ns() >= t->next_lookup_ns)
+	{
+		XWindowAttributes attrs;
+
+		t->lookup_due = false;
+		if (t->match == WINDOW_BY_ID)
+		{
+			Window id = strtoul(t->value, NULL, 0);
+			t->window = XGetWindowAttributes(display, id, &attrs) ? id : None;
+		}
+		else
+		{
+			t->window = find_window(out, root, t);
+		}
+
+		if (t->window == None)
+		{
+			t->next_lookup_ns = monotonic_ns() + WINDOW_LOOKUP_NS;
+			if (!t->reported)
+			{
+				fprintf(stderr, "Window with %s '%s' not found, waiting for it to appear\n", window_match_name(t->match), t->value);
+				t->reported = true;
+			}
+			return false;
+		}
+
+		// Hear about it changing its name, moving, resizing or going away
+		XSelectInput(display, t->window, PropertyChangeMask | StructureNotifyMask);
+		t->subwindow = None;
+		t->reported = false;
+	}
+	if (t->window == None)
+	{
+		return false;
+	}
+
+	// The events go to the innermost window under the point, like a real click's would
+	if (t->subwindow == None)
+	{
+		Window child = None;
+		int x = t->x;
+		int y = t->y;
+
+		if (!XTranslateCoordinates(display, t->window, root, x, y, &t->root_x, &t->root_y, &child))
+		{
+			t->window = None;
+			t->lookup_due = true;
+			return false;
+		}
+		t->subwindow = t->window;
+		XTranslateCoordinates(display, t->window, t->window, x, y, &x, &y, &child);
+		while (child != None && XTranslateCoordinates(display, t->subwindow, child, x, y, &x, &y, &child))
+		{
+			t->subwindow = child;
+			t->sub_x = x;
+			t->sub_y = y;
+		}
+		if (t->subwindow == t->window)
+		{
+			t->sub_x = t->x;
+			t->sub_y = t->y;
+		}
+	}
+	return true;
+}
+
+/**
+ * Forget whatever the window events say is out of date about the targets' windows.
+ */
+void process_window_events(output_t* out, const opts_t* opts)
+{
+	Display* display = out->window_display;
+
+	while (XPending(display))
+	{
+		XEvent ev;
+		XNextEvent(display, &ev);
+
+		for (int i = 0; i < opts->num_bindings; ++i)
+		{
+			window_target_t* t = opts->bindings[i].window;
+
+			if (t == NULL)
+			{
+				continue;
+			}
+			if (ev.xany.window == DefaultRootWindow(display))
+			{
+				// A window appearing might be the one a missing target is after
+				if (t->window == None && (ev.type == MapNotify || ev.type == ReparentNotify))
+				{
+					t->lookup_due = true;
+				}
+				continue;
+			}
+			if (ev.xany.window != t->window)
+			{
+				continue;
+			}
+
+			switch (ev.type)
+			{
+			case PropertyNotify:
+				// A window found by its class or title might not match any more
+				if (t->match != WINDOW_BY_ID &&
+				    (ev.xproperty.atom == XA_WM_NAME || ev.xproperty.atom == XA_WM_CLASS ||
+				     ev.xproperty.atom == out->net_wm_name))
+				{
+					t->window = None;
+					t->lookup_due = true;
+				}
+				break;
+			case ConfigureNotify:
+				t->subwindow = None;
+				break;
+			case UnmapNotify:
+			case DestroyNotify:
+				t->window = None;
+				t->lookup_due = true;
+				break;
+			}
+		}
+	}
+}
+
+void send_window_button(Display* display, const window_target_t* t, int button, bool pressed)
+{
+	XEvent ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.xbutton.type = pressed ? ButtonPress : ButtonRelease;
+	ev.xbutton.display = display;
+	ev.xbutton.window = t->subwindow;
+	ev.xbutton.root = DefaultRootWindow(display);
+	ev.xbutton.subwindow = None;
+	ev.xbutton.time = CurrentTime;
+	ev.xbutton.x = t->sub_x;
+	ev.xbutton.y = t->sub_y;
+	ev.xbutton.x_root = t->root_x;
+	ev.xbutton.y_root = t->root_y;
+
+	// The state is from just before the event, so a release has its own button down
+	ev.xbutton.state = !pressed && button <= 5 ? Button1Mask << (button - 1) : 0;
+	ev.xbutton.button = button;
+	ev.xbutton.same_screen = True;
+	XSendEvent(display, t->subwindow, True, pressed ? ButtonPressMask : ButtonReleaseMask, &ev);
+}
+
+/**
+ * Click into a binding's window with synthetic events, without touching the pointer. The press
+ * and release go out in one flush. If the window isn't there, the click is dropped.
+ */
+void emit_window_click(output_t* out, window_target_t* t, int button)
+{
+	if (out->mock != NULL)
+	{
+		mock_log(out->mock, MOCK_WINDOW_CLICK, button, t->x, t->y);
+		return;
+	}
+
+	Display* display = window_connection(out);
+	if (display == NULL || !resolve_window_target(out, t))
+	{
+		return;
+	}
+	send_window_button(display, t, button, true);
+	send_window_button(display, t, button, false);
+	XFlush(display);
+}
+
+/**
+ * Tear down the output backend.
+ */
+void close_output(output_t* out)
+{
+	if (out->uinput_fd >= 0)
+	{
+		ioctl(out->uinput_fd, UI_DEV_DESTROY);
+		close(out->uinput_fd);
+		out->uinput_fd = -1;
+	}
+	if (out->window_display != NULL)
+	{
+		forget_x_errors(out->window_display);
+		XCloseDisplay(out->window_display);
+		out->window_display = NULL;
+	}
+}
+
+/**
+ * Find and display a list of pointer devices.
+ */
+void find_mouse_device(Display* display)
+{
+	XDeviceInfo* info;
+	int num_devices;
+
+	info = XListInputDevices(display, &num_devices);
+
+	for (int i = 0; i < num_devices; ++i)
+	{
+		if (info[i].use == IsXPointer || info[i].use == IsXExtensionPointer)
+		{
+			printf("Found pointing device (%d): %s -> %d\n", info[i].use, info[i].name, (int)info[i].id);
+		}
+	}
+
+	XFreeDeviceList(info);
+}
+
+/**
+ * Return the device ID for the device with the given name, or -1 if not found.
+ */
+int get_device_id_from_name(Display* display, const char* name)
+{
+	XDeviceInfo* info;
+	int num_devices;
+	int ret = -1;
+
+	info = XListInputDevices(display, &num_devices);
+
+	for (int i = 0; i < num_devices; ++i)
+	{
+		if (info[i].use == IsXPointer || info[i].use == IsXExtensionPointer)
+		{
+			if (strcmp(name, info[i].name) == 0)
+			{
+				ret = (int)info[i].id;
+				break;
+			}
+		}
+	}
+
+	XFreeDeviceList(info);
+
+	return ret;
+}
+
+/**
+ * Remember a device's name, replacing whatever was known about its ID before. Returns false if
+ * the table is full.
+ */
+bool device_table_add(device_table_t* table, int id, const char* name)
+{
+	known_device_t* dev = NULL;
+
+	for (int i = 0; i < table->count && dev == NULL; ++i)
+	{
+		if (table->devices[i].id == id)
+		{
+			dev = &table->devices[i];
+			free(dev->name);
+		}
+	}
+	if (dev == NULL)
+	{
+		if (table->count == MAX_KNOWN_DEVICES)
+		{
+			return false;
+		}
+		dev = &table->devices[table->count++];
+	}
+
+	dev->id = id;
+	dev->name = strdup(name);
+	return dev->name != NULL;
+}
+
+/**
+ * Forget the device with the given ID, if it's known.
+ */
+void device_table_remove(device_table_t* table, int id)
+{
+	for (int i = 0; i < table->count; ++i)
+	{
+		if (table->devices[i].id == id)
+		{
+			free(table->devices[i].name);
+			table->devices[i] = table->devices[--table->count];
+			return;
+		}
+	}
+}
+
+/**
+ * Return the name of the device with the given ID, or NULL if it isn't known.
+ */
+const char* device_table_name(const device_table_t* table, int id)
+{
+	for (int i = 0; i < table->count; ++i)
+	{
+		if (table->devices[i].id == id)
+		{
+			return table->devices[i].name;
+		}
+	}
+	return NULL;
+}
+
+void device_table_clear(device_table_t* table)
+{
+	for (int i = 0; i < table->count; ++i)
+	{
+		free(table->devices[i].name);
+	}
+	table->count = 0;
+}
+
+/**
+ * Add the pointing devices among the given XI2 device IDs (or XIAllDevices) to the table.
+ */
+void device_table_query(Display* display, device_table_t* table, int id)
+{
+	int num_devices;
+	XIDeviceInfo* info = XIQueryDevice(display, id, &num_devices);
+
+	for (int i = 0; i < num_devices; ++i)
+	{
+		if (info[i].use == XIMasterPointer || info[i].use == XISlavePointer || info[i].use == XIFloatingSlave)
+		{
+			device_table_add(table, info[i].deviceid, info[i].name);
+		}
+	}
+
+	if (info != NULL)
+	{
+		XIFreeDeviceInfo(info);
+	}
+}
+
+/**
+ * Return a copy of the name of the pointing device with the given ID, or NULL if not found.
+ */
+char* get_device_name_from_id(Display* display, int id)
+{
+	XDeviceInfo* info;
+	int num_devices;
+	char* ret = NULL;
+
+	info = XListInputDevices(display, &num_devices);
+
+	for (int i = 0; i < num_devices; ++i)
+	{
+		if ((info[i].use == IsXPointer || info[i].use == IsXExtensionPointer) && (int)info[i].id == id)
+		{
+			ret = strdup(info[i].name);
+			break;
+		}
+	}
+
+	XFreeDeviceList(info);
+
+	return ret;
+}
+
+/**
+ * Build a button mask from the byte array in an XButtonState.
+ */
+void button_mask_from_bytes(const char* bytes, int num_bytes, button_mask_t* mask)
+{
+	memset(mask, 0, sizeof(*mask));
+	for (int i = 0; i < num_bytes && i < BUTTON_MASK_WORDS * 8; ++i)
+	{
+		mask->bits[i / 8] |= (uint64_t)(unsigned char)bytes[i] << (8 * (i % 8));
+	}
+}
+
+/**
+ * Set a button in a mask. Buttons outside the mask's range are ignored.
+ */
+void button_mask_set(button_mask_t* mask, int button)
+{
+	if (button >= 0 && button < BUTTON_MASK_WORDS * 64)
+	{
+		mask->bits[button / 64] |= 1ULL << (button % 64);
+	}
+}
+
+/**
+ * Clear a button in a mask. Buttons outside the mask's range are ignored.
+ */
+void button_mask_clear(button_mask_t* mask, int button)
+{
+	if (button >= 0 && button < BUTTON_MASK_WORDS * 64)
+	{
+		mask->bits[button / 64] &= ~(1ULL << (button % 64));
+	}
+}
+
+bool button_mask_test(const button_mask_t* mask, int button)
+{
+	if (button < 0 || button >= BUTTON_MASK_WORDS * 64)
+	{
+		return false;
+	}
+	return (mask->bits[button / 64] >> (button % 64)) & 1;
+}
+
+/**
+ * Return the lowest pressed button number that is >= from, or -1 if there isn't one.
+ */
+int button_mask_next(const button_mask_t* mask, int from)
+{
+	if (from < 0)
+	{
+		from = 0;
+	}
+
+	for (int word = from / 64; word < BUTTON_MASK_WORDS; ++word)
+	{
+		uint64_t bits = mask->bits[word];
+
+		// Ignore buttons below the start point in the first word
+		if (word == from / 64)
+		{
+			bits &= ~0ULL << (from % 64);
+		}
+		if (bits != 0)
+		{
+			return word * 64 + __builtin_ctzll(bits);
+		}
+	}
+	return -1;
+}
+
+/**
+ * Return the number of pressed buttons.
+ */
+int button_mask_count(const button_mask_t* mask)
+{
+	int count = 0;
+
+	for (int word = 0; word < BUTTON_MASK_WORDS; ++word)
+	{
+		count += __builtin_popcountll(mask->bits[word]);
+	}
+	return count;
+}
+
+/**
+ * Fetch the state of every button on the device with a single XQueryDeviceState round trip.
+ */
+bool query_button_mask(Display* display, XDevice* device, button_mask_t* mask)
+{
+	bool ret = false;
+	XDeviceState* st = XQueryDeviceState(display, device);
+
+	memset(mask, 0, sizeof(*mask));
+
+	if (!st)
+	{
+		fprintf(stderr, "Cannot query device state\n");
+		return false;
+	}
+
+	// The button state is one of several classes, each with its own length
+	XInputClass* ic = st->data;
+	for (int i = 0; i < st->num_classes; ++i)
+	{
+		if (ic->class == ButtonClass)
+		{
+			XButtonState* bstate = (XButtonState*)ic;
+			button_mask_from_bytes(bstate->buttons, sizeof(bstate->buttons), mask);
+			ret = true;
+			break;
+		}
+		ic = (XInputClass*)((char*)ic + ic->length);
+	}
+
+	if (!ret)
+	{
+		fprintf(stderr, "Specified device has no buttons\n");
+	}
+
+	XFreeDeviceState(st);
+	return ret;
+}
+
+/**
+ * Check the given device to determine if the given button is pressed.
+ */
+bool check_button_state(Display* display, XDevice* device, int button)
+{
+	button_mask_t mask;
+
+	return query_button_mask(display, device, &mask) && button_mask_test(&mask, button);
+}
+
+/**
+ * Check each button on the device to determine if it's pressed.
+ */
+int find_pressed_button(Display* display, XDevice* device, int num_buttons)
+{
+	button_mask_t mask;
+
+	if (!query_button_mask(display, device, &mask))
+	{
+		return -1;
+	}
+
+	// Button 0 doesn't exist; the buttons are numbered from 1
+	int button = button_mask_next(&mask, 1);
+	return button <= num_buttons ? button : -1;
+}
+
+/**
+ * Disable the default action of a button using XI1 grab.
+ * Returns true on success, false on failure.
+ */
+bool disable_button_default_action(Display* display, XDevice* device, int button)
+{
+	Window root = DefaultRootWindow(display);
+
+	// Use XI1 XGrabDeviceButton instead of XI2 XIGrabButton
+	// This should be more compatible with our XI1 polling approach
+	int result = XGrabDeviceButton(display,
+	                               device,
+	                               button,
+	                               AnyModifier,
+	                               NULL,           // modifier_device
+	                               root,
+	                               True,           // owner_events
+	                               0,              // event_count (we don't want events)
+	                               NULL,           // event_list
+	                               GrabModeAsync,  // this_device_mode
+	                               GrabModeAsync); // other_devices_mode
+
+	if (result != Success)
+	{
+		return false;
+	}
+
+	return true;
+}
+
+bool should_click(const click_state_t* state);
+
+/**
+ * Update the click state for a press or release of the given button at time_ns.
+ */
+void update_click_state(const binding_t* b, click_state_t* state, int button, bool pressed, uint64_t time_ns)
+{
+	bool was_clicking = should_click(state);
+
+	if (button == b->trigger_button)
+	{
+		state->trigger_held = pressed;
+	}
+	else if (button == b->toggle_button)
+	{
+		// Detect transition from not-pressed to pressed (button press event)
+		if (pressed && !state->toggle_prev_pressed)
+		{
+			state->toggle_active = !state->toggle_active;
+			state->toggles++;
+		}
+		state->toggle_prev_pressed = pressed;
+	}
+
+	// Remember when clicking was switched on or off, for the latency stats
+	if (should_click(state) && !was_clicking)
+	{
+		state->start_ns = time_ns;
+	}
+	else if (!should_click(state) && was_clicking)
+	{
+		state->stop_ns = time_ns;
+	}
+}
+
+/**
+ * Whether the current state calls for clicking.
+ */
+bool should_click(const click_state_t* state)
+{
+	return state->trigger_held || state->toggle_active;
+}
+
+/**
+ * Pass a press or release of a button on the given device to every binding on that device.
+ */
+void dispatch_button(const opts_t* opts, click_stream_t* streams, int device, int button, bool pressed, uint64_t time_ns)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		if (opts->bindings[i].device == device)
+		{
+			update_click_state(&opts->bindings[i], &streams[i].state, button, pressed, time_ns);
+		}
+	}
+}
+
+/**
+ * Bring every binding on the given device up to date with a snapshot of its buttons.
+ */
+void apply_button_mask(const opts_t* opts,
+                       click_stream_t* streams,
+                       int device,
+                       const button_mask_t* mask,
+                       uint64_t time_ns)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		const binding_t* b = &opts->bindings[i];
+
+		if (b->device != device)
+		{
+			continue;
+		}
+		if (b->trigger_button >= 0)
+		{
+			update_click_state(b, &streams[i].state, b->trigger_button, button_mask_test(mask, b->trigger_button), time_ns);
+		}
+		if (b->toggle_button >= 0)
+		{
+			update_click_state(b, &streams[i].state, b->toggle_button, button_mask_test(mask, b->toggle_button), time_ns);
+		}
+	}
+}
+
+/**
+ * Pick up the buttons on the given device that were already held before we started watching it.
+ * A toggle button held down then only counts as pressed once it's let go and pressed again, so
+ * it doesn't switch its clicks on just by being held while we start.
+ */
+void pick_up_held_buttons(const opts_t* opts, click_stream_t* streams, int device, const button_mask_t* mask, uint64_t time_ns)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		const binding_t* b = &opts->bindings[i];
+
+		if (b->device == device && b->toggle_button >= 0)
+		{
+			streams[i].state.toggle_prev_pressed = button_mask_test(mask, b->toggle_button);
+		}
+	}
+	apply_button_mask(opts, streams, device, mask, time_ns);
+}
+
+/**
+ * Collect the trigger and toggle buttons of every binding on the given device.
+ */
+void bound_buttons(const opts_t* opts, int device, button_mask_t* mask)
+{
+	memset(mask, 0, sizeof(*mask));
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		const binding_t* b = &opts->bindings[i];
+
+		if (b->device == device)
+		{
+			button_mask_set(mask, b->trigger_button);
+			button_mask_set(mask, b->toggle_button);
+		}
+	}
+}
+
+/**
+ * Fill order with the indexes of the streams that have clicks due at now_ns, earliest deadline
+ * first, so the clicks of independent streams go out in the order they were scheduled.
+ * Returns the number of streams due.
+ */
+int due_streams(const click_stream_t* streams, int count, uint64_t now_ns, int* order)
+{
+	int num_due = 0;
+
+	for (int i = 0; i < count; ++i)
+	{
+		if (!streams[i].clicking || streams[i].sched.next_ns > now_ns)
+		{
+			continue;
+		}
+
+		// Insertion sort; there are only ever a handful of streams
+		int j = num_due++;
+		while (j > 0 && streams[order[j - 1]].sched.next_ns > streams[i].sched.next_ns)
+		{
+			order[j] = order[j - 1];
+			--j;
+		}
+		order[j] = i;
+	}
+	return num_due;
+}
+
+#define BITS_PER_LONG (sizeof(unsigned long) * 8)
+#define NLONGS(_bits) (((_bits) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+
+static bool test_bit(unsigned int bit, const unsigned long* bits)
+{
+	return bits[bit / BITS_PER_LONG] & (1UL << (bit % BITS_PER_LONG));
+}
+
+/**
+ * Return the X button number for an evdev button code, or -1 if it doesn't have one.
+ */
+int evdev_to_x_button(uint16_t code)
+{
+	struct input_event ev;
+
+	for (int button = 1; x_button_to_evdev(button, &ev); ++button)
+	{
+		if (ev.type == EV_KEY && ev.code == code)
+		{
+			return button;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Open the /dev/input/eventN device with the given name that has the given button.
+ *
+ * X names its input devices after the kernel devices, so this matches the names shown by
+ * --list. A mouse can have several event devices with the same name (e.g. a separate one for
+ * its media keys), so we skip any that don't report the button we care about.
+ * Returns the device fd, or -1 if there's no such device.
+ */
+int open_evdev_by_name(const char* name, uint16_t code)
+{
+	DIR* dir = opendir("/dev/input");
+	struct dirent* entry;
+	int ret = -1;
+
+	if (dir == NULL)
+	{
+		fprintf(stderr, "Cannot open /dev/input: %s\n", strerror(errno));
+		return -1;
+	}
+
+	while (ret < 0 && (entry = readdir(dir)) != NULL)
+	{
+		char path[300];
+		char dev_name[256] = {0};
+		unsigned long keys[NLONGS(KEY_CNT)] = {0};
+
+		if (strncmp(entry->d_name, "event", 5) != 0)
+		{
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "/dev/input/%s", entry->d_name);
+		int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+		if (fd < 0)
+		{
+			continue;
+		}
+
+		if (ioctl(fd, EVIOCGNAME(sizeof(dev_name) - 1), dev_name) >= 0 &&
+		    strcmp(dev_name, name) == 0 && ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(keys)), keys) >= 0 &&
+		    test_bit(code, keys))
+		{
+			ret = fd;
+		}
+		else
+		{
+			close(fd);
+		}
+	}
+
+	closedir(dir);
+	return ret;
+}
+
+/**
+ * Create a uinput copy of an input device, so events can be passed on while it's grabbed.
+ * Returns the uinput fd, or -1 on failure.
+ */
+int open_passthrough_device(int src_fd, const char* name)
+{
+	static const struct
+	{
+		int type;
+		int max;
+		unsigned long request;
+	} types[] = {
+	    {EV_KEY, KEY_MAX, UI_SET_KEYBIT},
+	    {EV_REL, REL_MAX, UI_SET_RELBIT},
+	    {EV_MSC, MSC_MAX, UI_SET_MSCBIT},
+	};
+	unsigned long evbits[NLONGS(EV_CNT)] = {0};
+	struct uinput_setup setup;
+
+	int fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0)
+	{
+		fprintf(stderr, "Cannot open /dev/uinput: %s\n", strerror(errno));
+		return -1;
+	}
+
+	ioctl(src_fd, EVIOCGBIT(0, sizeof(evbits)), evbits);
+	for (size_t t = 0; t < sizeof(types) / sizeof(types[0]); ++t)
+	{
+		unsigned long codes[NLONGS(KEY_CNT)] = {0};
+
+		if (!test_bit(types[t].type, evbits))
+		{
+			continue;
+		}
+
+		ioctl(fd, UI_SET_EVBIT, types[t].type);
+		ioctl(src_fd, EVIOCGBIT(types[t].type, sizeof(codes)), codes);
+		for (int code = 0; code <= types[t].max; ++code)
+		{
+			if (test_bit(code, codes))
+			{
+				ioctl(fd, types[t].request, code);
+			}
+		}
+	}
+
+	// Absolute axes (tablets, touchpads) need their ranges as well as their codes
+	if (test_bit(EV_ABS, evbits))
+	{
+		unsigned long codes[NLONGS(ABS_CNT)] = {0};
+
+		ioctl(fd, UI_SET_EVBIT, EV_ABS);
+		ioctl(src_fd, EVIOCGBIT(EV_ABS, sizeof(codes)), codes);
+		for (int code = 0; code <= ABS_MAX; ++code)
+		{
+			struct uinput_abs_setup abs = {.code = code};
+
+			if (test_bit(code, codes) && ioctl(src_fd, EVIOCGABS(code), &abs.absinfo) == 0)
+			{
+				ioctl(fd, UI_SET_ABSBIT, code);
+				ioctl(fd, UI_ABS_SETUP, &abs);
+			}
+		}
+	}
+
+	// ...and the properties that tell clients how to read them, like INPUT_PROP_DIRECT
+	unsigned long props[NLONGS(INPUT_PROP_CNT)] = {0};
+	ioctl(src_fd, EVIOCGPROP(sizeof(props)), props);
+	for (int prop = 0; prop <= INPUT_PROP_MAX; ++prop)
+	{
+		if (test_bit(prop, props))
+		{
+			ioctl(fd, UI_SET_PROPBIT, prop);
+		}
+	}
+
+	memset(&setup, 0, sizeof(setup));
+	ioctl(src_fd, EVIOCGID, &setup.id);
+	snprintf(setup.name, sizeof(setup.name), "%s (autoclickd)", name);
+
+	if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0)
+	{
+		fprintf(stderr, "Cannot create uinput device: %s\n", strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/**
+ * Fill pressed with the bound buttons that are held down on the device right now. Returns false
+ * if the device can't be asked.
+ */
+bool read_evdev_buttons(const evdev_input_t* in, button_mask_t* pressed)
+{
+	unsigned long keys[NLONGS(KEY_CNT)] = {0};
+	struct input_event ev;
+
+	memset(pressed, 0, sizeof(*pressed));
+	if (ioctl(in->fd, EVIOCGKEY(sizeof(keys)), keys) < 0)
+	{
+		return false;
+	}
+	for (int button = button_mask_next(&in->buttons, 1); button > 0; button = button_mask_next(&in->buttons, button + 1))
+	{
+		if (x_button_to_evdev(button, &ev) && test_bit(ev.code, keys))
+		{
+			button_mask_set(pressed, button);
+		}
+	}
+	return true;
+}
+
+/**
+ * Read the current state of the bound buttons straight from the device.
+ */
+void sync_evdev_buttons(evdev_input_t* in, const opts_t* opts, int device, click_stream_t* streams)
+{
+	button_mask_t pressed;
+
+	if (read_evdev_buttons(in, &pressed))
+	{
+		apply_button_mask(opts, streams, device, &pressed, monotonic_ns());
+	}
+}
+
+/**
+ * Open a device for evdev input, by name, to watch the given X buttons.
+ *
+ * With grab set, the device is grabbed so nothing else sees its events, and everything except
+ * the watched buttons is replayed through a uinput copy of the device. That keeps the
+ * mouse working while the buttons' default actions are suppressed.
+ */
+bool open_evdev_input(evdev_input_t* in, const device_opts_t* dev, const button_mask_t* buttons, bool grab)
+{
+	struct input_event ev;
+	const char* name = dev->device_name;
+	int clock = CLOCK_MONOTONIC;
+	uint16_t first_code = KEY_RESERVED;
+
+	in->fd = in->passthrough_fd = -1;
+	in->buttons = *buttons;
+	in->dropped = false;
+
+	// Make sure every bound button has an evdev code to watch
+	for (int button = button_mask_next(buttons, 1); button > 0; button = button_mask_next(buttons, button + 1))
+	{
+		if (!x_button_to_evdev(button, &ev) || ev.type != EV_KEY)
+		{
+			fprintf(stderr, "Button %d can't be used as a trigger or toggle with evdev input\n", button);
+			return false;
+		}
+		if (first_code == KEY_RESERVED)
+		{
+			first_code = ev.code;
+		}
+	}
+
+	in->fd = open_evdev_by_name(name, first_code);
+	if (in->fd < 0)
+	{
+		fprintf(stderr, "No event device named '%s' found in /dev/input (check permissions)\n", name);
+		return false;
+	}
+
+	// Timestamp events on the same clock the scheduler uses
+	in->monotonic_stamps = ioctl(in->fd, EVIOCSCLOCKID, &clock) == 0;
+
+	if (grab)
+	{
+		if (ioctl(in->fd, EVIOCGRAB, 1) < 0)
+		{
+			fprintf(stderr, "Warning: Failed to grab %s: %s\n", name, strerror(errno));
+			fprintf(stderr, "The buttons will still trigger their normal actions.\n");
+		}
+		else
+		{
+			in->passthrough_fd = open_passthrough_device(in->fd, name);
+			if (in->passthrough_fd < 0)
+			{
+				// Don't leave the user with a dead mouse
+				ioctl(in->fd, EVIOCGRAB, 0);
+				fprintf(stderr, "Warning: Can't pass events through, not grabbing %s\n", name);
+			}
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Pass events on through the passthrough device, if there is one.
+ */
+void forward_evdev_events(const evdev_input_t* in, const struct input_event* ev, size_t count)
+{
+	if (in->passthrough_fd >= 0 && count > 0 && write(in->passthrough_fd, ev, count * sizeof(ev[0])) < 0)
+	{
+		fprintf(stderr, "uinput write failed: %s\n", strerror(errno));
+	}
+}
+
+/**
+ * Bring the passthrough device back in line with the real one after events were lost, by passing
+ * on the current state of every key and absolute axis it copies. The input core drops the ones
+ * that haven't changed, so only what was lost goes out.
+ */
+void resync_passthrough(const evdev_input_t* in)
+{
+	unsigned long supported[NLONGS(KEY_CNT)] = {0};
+	unsigned long keys[NLONGS(KEY_CNT)] = {0};
+	struct input_event ev[64];
+	size_t count = 0;
+
+	if (in->passthrough_fd < 0)
+	{
+		return;
+	}
+
+	memset(ev, 0, sizeof(ev));
+	if (ioctl(in->fd, EVIOCGBIT(EV_KEY, sizeof(supported)), supported) >= 0 &&
+	    ioctl(in->fd, EVIOCGKEY(sizeof(keys)), keys) >= 0)
+	{
+		for (int code = 0; code <= KEY_MAX; ++code)
+		{
+			// The bound buttons are never passed on, so they're left out here too
+			if (test_bit(code, supported) && !button_mask_test(&in->buttons, evdev_to_x_button(code)))
+			{
+				ev[count].type = EV_KEY;
+				ev[count].code = code;
+				ev[count++].value = test_bit(code, keys);
+			}
+			if (count == sizeof(ev) / sizeof(ev[0]) - 1)
+			{
+				forward_evdev_events(in, ev, count);
+				count = 0;
+			}
+		}
+	}
+
+	memset(supported, 0, sizeof(supported));
+	if (ioctl(in->fd, EVIOCGBIT(EV_ABS, sizeof(supported)), supported) >= 0)
+	{
+		for (int code = 0; code <= ABS_MAX; ++code)
+		{
+			struct input_absinfo abs;
+
+			if (test_bit(code, supported) && ioctl(in->fd, EVIOCGABS(code), &abs) == 0)
+			{
+				ev[count].type = EV_ABS;
+				ev[count].code = code;
+				ev[count++].value = abs.value;
+			}
+			if (count == sizeof(ev) / sizeof(ev[0]) - 1)
+			{
+				forward_evdev_events(in, ev, count);
+				count = 0;
+			}
+		}
+	}
+
+	ev[count].type = EV_SYN;
+	ev[count].code = SYN_REPORT;
+	ev[count++].value = 0;
+	forward_evdev_events(in, ev, count);
+}
+
+/**
+ * Read all pending events from the device, updating its bindings and passing the rest on.
+ *
+ * When the kernel's buffer overflows, it sends SYN_DROPPED, and the events up to the next
+ * SYN_REPORT are an incomplete packet. They're skipped, and at the SYN_REPORT the bound buttons
+ * and the passthrough device are brought up to date with the device's state instead.
+ */
+void process_evdev_events(evdev_input_t* in, const opts_t* opts, int device, click_stream_t* streams)
+{
+	struct input_event ev[64];
+	struct input_event forward[64];
+	ssize_t len;
+
+	while ((len = read(in->fd, ev, sizeof(ev))) > 0)
+	{
+		size_t count = len / sizeof(ev[0]);
+		size_t num_forward = 0;
+
+		for (size_t i = 0; i < count; ++i)
+		{
+			if (ev[i].type == EV_SYN && ev[i].code == SYN_DROPPED)
+			{
+				in->dropped = true;
+				continue;
+			}
+			if (in->dropped)
+			{
+				if (ev[i].type == EV_SYN && ev[i].code == SYN_REPORT)
+				{
+					in->dropped = false;
+					sync_evdev_buttons(in, opts, device, streams);
+
+					// What was already read goes out before the state that follows it
+					forward_evdev_events(in, forward, num_forward);
+					num_forward = 0;
+					resync_passthrough(in);
+				}
+				continue;
+			}
+			if (ev[i].type == EV_KEY && ev[i].value != 2 &&
+			    button_mask_test(&in->buttons, evdev_to_x_button(ev[i].code)))
+			{
+				// Use the kernel's timestamp of the press where we can
+				uint64_t time_ns = in->monotonic_stamps ? (uint64_t)ev[i].input_event_sec * NS_PER_SEC +
+				                                              ev[i].input_event_usec * NS_PER_US
+				                                        : monotonic_ns();
+				dispatch_button(opts, streams, device, evdev_to_x_button(ev[i].code), ev[i].value, time_ns);
+				continue;
+			}
+			forward[num_forward++] = ev[i];
+		}
+		forward_evdev_events(in, forward, num_forward);
+	}
+}
+
+/**
+ * Release the grab and tear down the passthrough device.
+ */
+void close_evdev_input(evdev_input_t* in)
+{
+	if (in->passthrough_fd >= 0)
+	{
+		ioctl(in->passthrough_fd, UI_DEV_DESTROY);
+		close(in->passthrough_fd);
+	}
+	if (in->fd >= 0)
+	{
+		ioctl(in->fd, EVIOCGRAB, 0);
+		close(in->fd);
+	}
+	in->fd = in->passthrough_fd = -1;
+}
+
+/**
+ * Whether the XInput version the server agreed to is at least major.minor.
+ */
+bool xi_version_at_least(int server_major, int server_minor, int major, int minor)
+{
+	return server_major > major || (server_major == major && server_minor >= minor);
+}
+
+/**
+ * Ask the server to send us raw button events from the given devices.
+ *
+ * Raw events are delivered to the root window even while the button is grabbed (XI 2.1+),
+ * so this works alongside disable_button_default_action(). All the devices are selected in
+ * one request, and their events all arrive on the one connection, along with hierarchy events
+ * for every device so we find out when one is unplugged or plugged back in. With no devices,
+ * only the hierarchy events are selected. Returns the XInput extension opcode, or -1 if the
+ * server doesn't support XI 2.1.
+ */
+int select_input_events(Display* display, const int* device_ids, int count)
+{
+	int opcode, event, error;
+	int major = 2;
+	int minor = 1;
+
+	if (!XQueryExtension(display, "XInputExtension", &opcode, &event, &error))
+	{
+		return -1;
+	}
+
+	// The server answers with the version it supports, which can be older than the one asked for
+	if (XIQueryVersion(display, &major, &minor) != Success || !xi_version_at_least(major, minor, 2, 1))
+	{
+		return -1;
+	}
+
+	unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {0};
+	unsigned char hierarchy_bits[XIMaskLen(XI_LASTEVENT)] = {0};
+	XIEventMask masks[MAX_DEVICES + 1];
+	XISetMask(mask_bits, XI_RawButtonPress);
+	XISetMask(mask_bits, XI_RawButtonRelease);
+	XISetMask(hierarchy_bits, XI_HierarchyChanged);
+
+	for (int i = 0; i < count; ++i)
+	{
+		masks[i].deviceid = device_ids[i];
+		masks[i].mask_len = sizeof(mask_bits);
+		masks[i].mask = mask_bits;
+	}
+	masks[count].deviceid = XIAllDevices;
+	masks[count].mask_len = sizeof(hierarchy_bits);
+	masks[count].mask = hierarchy_bits;
+
+	XISelectEvents(display, DefaultRootWindow(display), masks, count + 1);
+	XFlush(display);
+
+	// From here on, requests about a device that has just gone away aren't fatal
+	x_error_filter_t* filter = x_error_filter(display, true);
+	if (filter != NULL)
+	{
+		filter->bad_device = error + XI_BadDevice;
+	}
+	install_x_error_handler();
+
+	return opcode;
+}
+
+/**
+ * Block until one of the fds is readable, the absolute CLOCK_MONOTONIC deadline passes, or a
+ * signal arrives. A deadline of 0 waits forever. Entries with a negative fd are ignored.
+ */
+void wait_for_fds(struct pollfd* pfds, int count, uint64_t deadline_ns)
+{
+	struct timespec timeout;
+	struct timespec* tp = NULL;
+
+	if (deadline_ns != 0)
+	{
+		uint64_t now_ns = monotonic_ns();
+		uint64_t wait_ns = deadline_ns > now_ns ? deadline_ns - now_ns : 0;
+		timeout.tv_sec = wait_ns / NS_PER_SEC;
+		timeout.tv_nsec = wait_ns % NS_PER_SEC;
+		tp = &timeout;
+	}
+
+	for (int i = 0; i < count; ++i)
+	{
+		pfds[i].events = POLLIN;
+		pfds[i].revents = 0;
+	}
+	ppoll(pfds, count, tp, waiting_sigmask());
+}
+
+/**
+ * Block until fd is readable, the deadline passes, or a signal arrives.
+ */
+void wait_for_fd(int fd, uint64_t deadline_ns)
+{
+	struct pollfd pfd = {fd, POLLIN, 0};
+
+	wait_for_fds(&pfd, 1, deadline_ns);
+}
+
+bool x_open_device(input_t* in, input_device_t* d)
+{
+	d->device = XOpenDevice(in->display, d->device_id);
+	return d->device != NULL;
+}
+
+bool x_query_buttons(input_t* in, input_device_t* d, button_mask_t* mask)
+{
+	return query_button_mask(in->display, d->device, mask);
+}
+
+bool x_grab_button(input_t* in, input_device_t* d, int button)
+{
+	return disable_button_default_action(in->display, d->device, button);
+}
+
+void x_ungrab_button(input_t* in, input_device_t* d, int button)
+{
+	XUngrabDeviceButton(in->display, d->device, button, AnyModifier, NULL, DefaultRootWindow(in->display));
+}
+
+void x_close_device(input_t* in, input_device_t* d)
+{
+	XCloseDevice(in->display, d->device);
+	d->device = NULL;
+}
+
+void x_flush(input_t* in)
+{
+	XFlush(in->display);
+}
+
+const input_ops_t x_input_ops = {x_open_device, x_query_buttons, x_query_buttons, x_grab_button, x_ungrab_button, x_close_device, x_flush};
+
+/**
+ * Find a device in the mock backend, adding it if it isn't there yet. Returns NULL if there's no
+ * room for another.
+ */
+mock_device_t* mock_device(mock_backend_t* mock, int device_id)
+{
+	for (int i = 0; i < mock->num_devices; ++i)
+	{
+		if (mock->devices[i].device_id == device_id)
+		{
+			return &mock->devices[i];
+		}
+	}
+	if (mock->num_devices == MAX_DEVICES)
+	{
+		return NULL;
+	}
+
+	mock_device_t* dev = &mock->devices[mock->num_devices++];
+	memset(dev, 0, sizeof(*dev));
+	dev->device_id = device_id;
+	return dev;
+}
+
+/**
+ * Script a button press or release on a mock device.
+ */
+void mock_set_button(mock_backend_t* mock, int device_id, int button, bool pressed)
+{
+	mock_device_t* dev = mock_device(mock, device_id);
+
+	if (dev != NULL && pressed)
+	{
+		button_mask_set(&dev->held, button);
+	}
+	else if (dev != NULL)
+	{
+		button_mask_clear(&dev->held, button);
+	}
+}
+
+bool mock_open_device(input_t* in, input_device_t* d)
+{
+	mock_device_t* dev = mock_device(in->mock, d->device_id);
+
+	if (dev == NULL)
+	{
+		return false;
+	}
+	dev->open = true;
+	return true;
+}
+
+bool mock_query_buttons(input_t* in, input_device_t* d, button_mask_t* mask)
+{
+	mock_device_t* dev = mock_device(in->mock, d->device_id);
+
+	in->mock->queries++;
+	if (dev == NULL || !dev->open)
+	{
+		memset(mask, 0, sizeof(*mask));
+		return false;
+	}
+	*mask = dev->held;
+	return true;
+}
+
+bool mock_grab_button(input_t* in, input_device_t* d, int button)
+{
+	mock_device_t* dev = mock_device(in->mock, d->device_id);
+
+	if (dev == NULL)
+	{
+		return false;
+	}
+	button_mask_set(&dev->grabbed, button);
+	return true;
+}
+
+void mock_ungrab_button(input_t* in, input_device_t* d, int button)
+{
+	mock_device_t* dev = mock_device(in->mock, d->device_id);
+
+	if (dev != NULL)
+	{
+		button_mask_clear(&dev->grabbed, button);
+	}
+}
+
+void mock_close_device(input_t* in, input_device_t* d)
+{
+	mock_device_t* dev = mock_device(in->mock, d->device_id);
+
+	if (dev != NULL)
+	{
+		dev->open = false;
+	}
+}
+
+void mock_flush(input_t* in)
+{
+	(void)in;
+}
+
+const input_ops_t mock_input_ops = {mock_open_device, mock_query_buttons, mock_query_buttons, mock_grab_button, mock_ungrab_button, mock_close_device, mock_flush};
+
+#ifdef HAVE_XCB
+/**
+ * Read the button mask out of an XCB QueryDeviceState reply. The classes follow the reply, laid
+ * out as for XQueryDeviceState.
+ */
+bool xcb_button_mask(const xcb_input_query_device_state_reply_t* reply, button_mask_t* mask)
+{
+	const uint8_t* class = (const uint8_t*)(reply + 1);
+	const uint8_t* end = class + reply->length * 4;
+
+	memset(mask, 0, sizeof(*mask));
+	for (int i = 0; i < reply->num_classes && class + 2 <= end && class[1] > 0; ++i)
+	{
+		// Class, length in bytes and, for buttons, their count, a pad byte and 32 bytes of state
+		if (class[0] == ButtonClass && class + 4 + 32 <= end)
+		{
+			button_mask_from_bytes((const char*)class + 4, 32, mask);
+			return true;
+		}
+		class += class[1];
+	}
+	fprintf(stderr, "Specified device has no buttons\n");
+	return false;
+}
+
+bool xcb_open_device(input_t* in, input_device_t* d)
+{
+	d->query_seq = 0;
+	return x_open_device(in, d);
+}
+
+/**
+ * Forget a polled query that's still in flight.
+ */
+void xcb_discard_query(input_t* in, input_device_t* d)
+{
+	if (d->query_seq != 0)
+	{
+		xcb_discard_reply(in->xcb, d->query_seq);
+		d->query_seq = 0;
+	}
+}
+
+bool xcb_query_buttons(input_t* in, input_device_t* d, button_mask_t* mask)
+{
+	// Whatever polling had in flight would be older than this answer
+	xcb_discard_query(in, d);
+
+	xcb_input_query_device_state_cookie_t cookie = xcb_input_query_device_state(in->xcb, d->device_id);
+	xcb_input_query_device_state_reply_t* reply = xcb_input_query_device_state_reply(in->xcb, cookie, NULL);
+	bool ok = reply != NULL && xcb_button_mask(reply, mask);
+
+	if (reply == NULL)
+	{
+		fprintf(stderr, "Cannot query device state\n");
+	}
+	free(reply);
+	return ok;
+}
+
+/**
+ * Pick up the answer to the last query if it's in, and send the next one.
+ *
+ * There's always one query in flight per device, so the round trip overlaps with clicking and
+ * sleeping instead of stalling the loop. The state is at most one poll interval older than a
+ * blocking query's would be.
+ */
+bool xcb_poll_buttons(input_t* in, input_device_t* d, button_mask_t* mask)
+{
+	bool ok = false;
+
+	if (d->query_seq != 0)
+	{
+		void* reply = NULL;
+		xcb_generic_error_t* error = NULL;
+
+		if (!xcb_poll_for_reply(in->xcb, d->query_seq, &reply, &error))
+		{
+			return false;
+		}
+		ok = reply != NULL && xcb_button_mask(reply, mask);
+		if (reply == NULL)
+		{
+			fprintf(stderr, "Cannot query device state\n");
+		}
+		free(reply);
+		free(error);
+	}
+
+	d->query_seq = xcb_input_query_device_state(in->xcb, d->device_id).sequence;
+	xcb_flush(in->xcb);
+	return ok;
+}
+
+void xcb_close_device(input_t* in, input_device_t* d)
+{
+	xcb_discard_query(in, d);
+	x_close_device(in, d);
+}
+
+// Grabs happen once, so they stay on Xlib
+const input_ops_t xcb_input_ops = {xcb_open_device, xcb_query_buttons, xcb_poll_buttons, x_grab_button, x_ungrab_button, xcb_close_device, x_flush};
+#endif  // HAVE_XCB
+
+/**
+ * Grab a device's bound buttons so they don't do anything else.
+ */
+void disable_device_default_actions(input_t* in, input_device_t* d)
+{
+	const button_mask_t* buttons = &d->buttons;
+
+	for (int button = button_mask_next(buttons, 1); button > 0; button = button_mask_next(buttons, button + 1))
+	{
+		if (!in->ops->grab_button(in, d, button))
+		{
+			fprintf(stderr, "Warning: Failed to disable default action for button %d\n", button);
+			fprintf(stderr, "The button will still trigger its normal action.\n");
+			fprintf(stderr, "You can suppress this with --no-disable-default\n");
+		}
+	}
+}
+
+/**
+ * Stop watching a device that was unplugged. Its triggers count as released, and it's skipped
+ * until a device that matches it comes back.
+ */
+void detach_device(input_t* in, const opts_t* opts, click_stream_t* streams, int device)
+{
+	input_device_t* d = &in->devices[device];
+	button_mask_t released;
+
+	if (d->opts->device_name != NULL)
+	{
+		fprintf(stderr, "Device '%s' (%d) went away, waiting for it to come back\n", d->opts->device_name, d->device_id);
+	}
+	else
+	{
+		fprintf(stderr, "Device %d went away, waiting for it to come back\n", d->device_id);
+	}
+
+	uint64_t now_ns = monotonic_ns();
+	memset(&released, 0, sizeof(released));
+	apply_button_mask(opts, streams, device, &released, now_ns);
+
+	// Nothing could switch the device's toggles off again while it's gone, so they stop with it
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		click_state_t* state = &streams[i].state;
+
+		if (opts->bindings[i].device == device && state->toggle_active)
+		{
+			state->toggle_active = false;
+			if (!should_click(state))
+			{
+				state->stop_ns = now_ns;
+			}
+		}
+	}
+
+	// The server drops the grabs along with the device
+	in->ops->close_device(in, d);
+	d->device_id = -1;
+}
+
+/**
+ * Start watching a device again under its new ID, with its buttons grabbed like they were before.
+ * Returns false if it can't be opened, leaving it detached.
+ */
+bool attach_device(input_t* in, const opts_t* opts, click_stream_t* streams, int device, int device_id)
+{
+	input_device_t* d = &in->devices[device];
+	button_mask_t mask;
+
+	d->device_id = device_id;
+	if (!in->ops->open_device(in, d))
+	{
+		fprintf(stderr, "Cannot open device with ID %d\n", device_id);
+		d->device_id = -1;
+		return false;
+	}
+	if (d->opts->device_name != NULL)
+	{
+		fprintf(stderr, "Device '%s' is back as %d, watching it again\n", d->opts->device_name, device_id);
+	}
+	else
+	{
+		fprintf(stderr, "Device %d is back, watching it again\n", device_id);
+	}
+
+	if (opts->disable_default_action)
+	{
+		disable_device_default_actions(in, d);
+	}
+	in->ops->flush(in);
+
+	// Pick up triggers that are already held
+	if (in->ops->query_buttons(in, d, &mask))
+	{
+		pick_up_held_buttons(opts, streams, device, &mask, monotonic_ns());
+	}
+	return true;
+}
+
+/**
+ * React to a device being plugged in (present) or unplugged. An unplugged device that's named in
+ * the options is attached again when a device with the same name appears, whatever its new ID;
+ * one given only by ID has to come back with the same ID. Returns the index of the device that
+ * was attached, or -1 if none was.
+ */
+int hotplug_device(input_t* in, const opts_t* opts, click_stream_t* streams, int device_id, const char* name, bool present)
+{
+	for (int i = 0; i < in->num_devices; ++i)
+	{
+		input_device_t* d = &in->devices[i];
+
+		if (!present && d->device_id == device_id)
+		{
+			detach_device(in, opts, streams, i);
+		}
+		else if (present && d->device_id < 0)
+		{
+			bool matches = d->opts->device_name != NULL
+			                   ? name != NULL && strcmp(d->opts->device_name, name) == 0
+			                   : d->opts->device_id == device_id;
+
+			if (matches && attach_device(in, opts, streams, i, device_id))
+			{
+				return i;
+			}
+		}
+	}
+	return -1;
+}
+
+/**
+ * Keep the device table and the watched devices up to date with a change to the device hierarchy.
+ */
+void process_hierarchy_event(input_t* in, const opts_t* opts, click_stream_t* streams, const XIHierarchyEvent* ev)
+{
+	for (int i = 0; i < ev->num_info; ++i)
+	{
+		const XIHierarchyInfo* info = &ev->info[i];
+
+		if (info->flags & (XISlaveRemoved | XIDeviceDisabled))
+		{
+			hotplug_device(in, opts, streams, info->deviceid, NULL, false);
+		}
+		if (info->flags & XISlaveRemoved)
+		{
+			device_table_remove(&in->known, info->deviceid);
+		}
+
+		// The hierarchy event has no name, so ask for the new device's; just that one device
+		if (info->flags & XISlaveAdded)
+		{
+			device_table_query(in->display, &in->known, info->deviceid);
+		}
+
+		// A device can only be opened once it's enabled, which comes after it's added
+		if (info->flags & XIDeviceEnabled)
+		{
+			const char* name = device_table_name(&in->known, info->deviceid);
+
+			if (hotplug_device(in, opts, streams, info->deviceid, name, true) >= 0 && in->type == INPUT_XI2)
+			{
+				select_input_events(in->display, &info->deviceid, 1);
+			}
+		}
+	}
+}
+
+/**
+ * Drain all queued X events, passing raw button events on to the bindings of their device and
+ * following devices as they're unplugged and plugged back in.
+ */
+void process_x_events(input_t* in, const opts_t* opts, click_stream_t* streams)
+{
+	while (XPending(in->display))
+	{
+		XEvent ev;
+		XGenericEventCookie* cookie = &ev.xcookie;
+
+		XNextEvent(in->display, &ev);
+		if (cookie->type != GenericEvent || cookie->extension != in->xi_opcode ||
+		    !XGetEventData(in->display, cookie))
+		{
+			continue;
+		}
+
+		if (cookie->evtype == XI_HierarchyChanged)
+		{
+			process_hierarchy_event(in, opts, streams, cookie->data);
+		}
+		else if (cookie->evtype == XI_RawButtonPress || cookie->evtype == XI_RawButtonRelease)
+		{
+			XIRawEvent* raw = cookie->data;
+			uint64_t now_ns = monotonic_ns();
+
+			for (int i = 0; i < in->num_devices; ++i)
+			{
+				if (in->devices[i].device_id == raw->deviceid)
+				{
+					dispatch_button(opts, streams, i, raw->detail, cookie->evtype == XI_RawButtonPress, now_ns);
+				}
+			}
+		}
+
+		XFreeEventData(in->display, cookie);
+	}
+}
+
+/**
+ * Start watching every device's bound buttons with the configured input method.
+ *
+ * However many devices there are, they're all watched through one wait: a single X connection
+ * for XI2, or a single epoll set for evdev. Falls back from XI2 to XI1 polling if the server
+ * doesn't support XI2.
+ */
+bool open_input(input_t* in, const opts_t* opts, Display* display, click_stream_t* streams)
+{
+	in->ops = &x_input_ops;
+	in->type = opts->input;
+	in->display = display;
+	in->xi_opcode = -1;
+	in->epoll_fd = -1;
+	in->grabbed = false;
+	in->mock = opts->mock;
+	in->known.count = 0;
+	in->num_devices = 0;
+
+	// The mock has no events to wait for, so it's always polled
+	if (in->mock != NULL)
+	{
+		in->ops = &mock_input_ops;
+		in->type = INPUT_XI1;
+	}
+#ifdef HAVE_XCB
+	else if (opts->xcb && in->type != INPUT_EVDEV)
+	{
+		in->ops = &xcb_input_ops;
+		in->xcb = XGetXCBConnection(display);
+	}
+#endif
+
+	if (in->type == INPUT_EVDEV)
+	{
+		in->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (in->epoll_fd < 0)
+		{
+			fprintf(stderr, "Cannot set up epoll: %s\n", strerror(errno));
+			return false;
+		}
+
+		for (int i = 0; i < opts->num_devices; ++i)
+		{
+			input_device_t* d = &in->devices[in->num_devices++];
+			struct epoll_event ep = {EPOLLIN, {.u32 = (uint32_t)i}};
+
+			d->opts = &opts->devices[i];
+			d->device = NULL;
+			bound_buttons(opts, i, &d->buttons);
+			if (!open_evdev_input(&d->evdev, d->opts, &d->buttons, opts->disable_default_action))
+			{
+				return false;
+			}
+			if (epoll_ctl(in->epoll_fd, EPOLL_CTL_ADD, d->evdev.fd, &ep) < 0)
+			{
+				fprintf(stderr, "Cannot set up epoll: %s\n", strerror(errno));
+				return false;
+			}
+
+			button_mask_t mask;
+			if (read_evdev_buttons(&d->evdev, &mask))
+			{
+				pick_up_held_buttons(opts, streams, i, &mask, monotonic_ns());
+			}
+		}
+		return true;
+	}
+
+	int device_ids[MAX_DEVICES];
+	for (int i = 0; i < opts->num_devices; ++i)
+	{
+		input_device_t* d = &in->devices[i];
+
+		d->opts = &opts->devices[i];
+		d->device_id = d->opts->device_id;
+		d->evdev.fd = d->evdev.passthrough_fd = -1;
+		bound_buttons(opts, i, &d->buttons);
+		if (!in->ops->open_device(in, d))
+		{
+			fprintf(stderr, "Cannot open device with ID %d\n", d->device_id);
+			return false;
+		}
+		in->num_devices++;
+		device_ids[i] = d->device_id;
+
+		// Disable the default action of buttons if requested
+		if (opts->disable_default_action)
+		{
+			disable_device_default_actions(in, d);
+			in->grabbed = true;
+		}
+	}
+
+	// Prefer XI2 events; servers without XI2 get the XI1 polling loop. With no devices at all
+	// (a daemon driven only through the control socket) there's nothing to select.
+	if (in->type == INPUT_XI2 && in->num_devices > 0)
+	{
+		in->xi_opcode = select_input_events(display, device_ids, in->num_devices);
+		if (in->xi_opcode < 0)
+		{
+			fprintf(stderr, "XInput2 not available, falling back to polling\n");
+			in->type = INPUT_XI1;
+			return true;
+		}
+		device_table_query(display, &in->known, XIAllDevices);
+
+		// Pick up triggers that were already held before we started listening
+		for (int i = 0; i < in->num_devices; ++i)
+		{
+			button_mask_t mask;
+			if (in->ops->query_buttons(in, &in->devices[i], &mask))
+			{
+				pick_up_held_buttons(opts, streams, i, &mask, monotonic_ns());
+			}
+		}
+	}
+	else if (in->type == INPUT_XI1 && in->mock == NULL && in->num_devices > 0)
+	{
+		// Polling can still follow devices being unplugged if the server has XI2
+		in->xi_opcode = select_input_events(display, NULL, 0);
+		if (in->xi_opcode >= 0)
+		{
+			device_table_query(display, &in->known, XIAllDevices);
+		}
+	}
+
+	return true;
+}
+
+/**
+ * Bring the bindings up to date with whatever the buttons have done since the last call.
+ */
+void process_input(input_t* in, const opts_t* opts, click_stream_t* streams)
+{
+	switch (in->type)
+	{
+	case INPUT_XI2:
+		process_x_events(in, opts, streams);
+		break;
+	case INPUT_XI1:
+		// Hierarchy events only; unplugged devices aren't polled until they're back
+		if (in->xi_opcode >= 0)
+		{
+			process_x_events(in, opts, streams);
+		}
+
+		// One round trip per device covers all of its buttons
+		for (int i = 0; i < in->num_devices; ++i)
+		{
+			button_mask_t mask;
+			if (in->devices[i].device_id >= 0 && in->ops->poll_buttons(in, &in->devices[i], &mask))
+			{
+				apply_button_mask(opts, streams, i, &mask, monotonic_ns());
+			}
+		}
+		break;
+	case INPUT_EVDEV:
+	{
+		// Only read the devices that have something to say
+		struct epoll_event ep[MAX_DEVICES];
+		int count = epoll_wait(in->epoll_fd, ep, MAX_DEVICES, 0);
+
+		for (int n = 0; n < count; ++n)
+		{
+			int i = (int)ep[n].data.u32;
+			process_evdev_events(&in->devices[i].evdev, opts, i, streams);
+		}
+		break;
+	}
+	}
+}
+
+// Most fds besides the input that wait_for_input() can also wait on
+#define MAX_EXTRA_FDS 4
+
+/**
+ * Wait until the deadline (0 for none), until one of the extra fds is readable or, for
+ * event-driven input, until a button changes. Sets ready[i] if extra_fds[i] is readable.
+ */
+void wait_for_input(input_t* in, const int* extra_fds, int num_extra, bool* ready, uint64_t deadline_ns)
+{
+	struct pollfd pfds[1 + MAX_EXTRA_FDS];
+
+	pfds[0].fd = -1;
+	switch (in->type)
+	{
+	case INPUT_XI2:
+		pfds[0].fd = ConnectionNumber(in->display);
+
+		// Events may already be sitting in Xlib's queue, in which case the fd won't wake us
+		if (XPending(in->display))
+		{
+			deadline_ns = monotonic_ns();
+		}
+		break;
+	case INPUT_XI1:
+		// Polling has nothing to wait for but the deadline
+		break;
+	case INPUT_EVDEV:
+		pfds[0].fd = in->epoll_fd;
+		break;
+	}
+
+	for (int i = 0; i < num_extra; ++i)
+	{
+		pfds[1 + i].fd = extra_fds[i];
+	}
+
+	// With nothing to wait for at all, just sleep
+	if (pfds[0].fd < 0 && num_extra == 0)
+	{
+		sleep_until(deadline_ns);
+		return;
+	}
+
+	wait_for_fds(pfds, 1 + num_extra, deadline_ns);
+	for (int i = 0; i < num_extra; ++i)
+	{
+		ready[i] = pfds[1 + i].revents & POLLIN;
+	}
+}
+
+/**
+ * Switch the input over to the buttons bound in new_opts, which must have the same devices.
+ *
+ * Buttons that are still bound keep their grabs; newly bound ones are grabbed and ones that are
+ * no longer bound are released. Returns false, without changing anything, if a new button can't
+ * be watched.
+ */
+bool update_bound_buttons(input_t* in, const opts_t* new_opts)
+{
+	button_mask_t masks[MAX_DEVICES];
+	struct input_event ev;
+
+	for (int i = 0; i < in->num_devices; ++i)
+	{
+		bound_buttons(new_opts, i, &masks[i]);
+		for (int button = button_mask_next(&masks[i], 1); in->type == INPUT_EVDEV && button > 0;
+		     button = button_mask_next(&masks[i], button + 1))
+		{
+			if (!x_button_to_evdev(button, &ev) || ev.type != EV_KEY)
+			{
+				fprintf(stderr, "Button %d can't be used as a trigger or toggle with evdev input\n", button);
+				return false;
+			}
+		}
+	}
+
+	for (int i = 0; i < in->num_devices; ++i)
+	{
+		input_device_t* d = &in->devices[i];
+
+		if (in->type == INPUT_EVDEV)
+		{
+			d->evdev.buttons = masks[i];
+		}
+		else if (new_opts->disable_default_action && d->device_id >= 0)
+		{
+			// An unplugged device gets the new buttons grabbed when it's back
+			for (int button = 1; button < BUTTON_MASK_WORDS * 64; ++button)
+			{
+				bool was_bound = button_mask_test(&d->buttons, button);
+				bool now_bound = button_mask_test(&masks[i], button);
+
+				if (now_bound && !was_bound && !in->ops->grab_button(in, d, button))
+				{
+					fprintf(stderr, "Warning: Failed to disable default action for button %d\n", button);
+				}
+				else if (was_bound && !now_bound)
+				{
+					in->ops->ungrab_button(in, d, button);
+				}
+			}
+		}
+		d->buttons = masks[i];
+	}
+	return true;
+}
+
+/**
+ * Bring the bindings up to date with the current state of every device's buttons.
+ */
+void sync_input(input_t* in, const opts_t* opts, click_stream_t* streams)
+{
+	for (int i = 0; i < in->num_devices; ++i)
+	{
+		button_mask_t mask;
+
+		if (in->type == INPUT_EVDEV)
+		{
+			sync_evdev_buttons(&in->devices[i].evdev, opts, i, streams);
+		}
+		else if (in->devices[i].device_id >= 0 && in->ops->query_buttons(in, &in->devices[i], &mask))
+		{
+			apply_button_mask(opts, streams, i, &mask, monotonic_ns());
+		}
+	}
+}
+
+/**
+ * Stop watching the buttons, and give any grabbed buttons back to their default action.
+ */
+void close_input(input_t* in)
+{
+	for (int i = 0; i < in->num_devices; ++i)
+	{
+		input_device_t* d = &in->devices[i];
+
+		if (in->type == INPUT_EVDEV)
+		{
+			close_evdev_input(&d->evdev);
+		}
+		else if (d->device_id >= 0)
+		{
+			const button_mask_t* buttons = &d->buttons;
+			for (int button = button_mask_next(buttons, 1); in->grabbed && button > 0;
+			     button = button_mask_next(buttons, button + 1))
+			{
+				in->ops->ungrab_button(in, d, button);
+			}
+			in->ops->close_device(in, d);
+		}
+	}
+	if (in->grabbed)
+	{
+		in->ops->flush(in);
+		in->grabbed = false;
+	}
+	in->num_devices = 0;
+	device_table_clear(&in->known);
+
+	if (in->epoll_fd >= 0)
+	{
+		close(in->epoll_fd);
+		in->epoll_fd = -1;
+	}
+}
+
+/**
+ * Queue a click event. Returns false if the queue is full. Only the input thread may call this.
+ */
+bool click_ring_push(click_ring_t* ring, const click_event_t* ev)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+	if (head - tail == CLICK_RING_SIZE)
+	{
+		return false;
+	}
+	ring->events[head % CLICK_RING_SIZE] = *ev;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * Take the oldest click event off the queue. Returns false if it's empty. Only the clicking
+ * thread may call this.
+ */
+bool click_ring_pop(click_ring_t* ring, click_event_t* ev)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	if (head == tail)
+	{
+		return false;
+	}
+	*ev = ring->events[tail % CLICK_RING_SIZE];
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+/**
+ * Queue an event for every binding whose buttons have switched its clicks on or off since the
+ * last call, and wake the clicking thread if there were any. Returns false if the queue filled
+ * up first; the rest are sent on the next call.
+ */
+bool publish_click_state(input_thread_t* t)
+{
+	bool queued = false;
+	bool complete = true;
+
+	for (int i = 0; i < t->opts->num_bindings; ++i)
+	{
+		const click_state_t* state = &t->streams[i].state;
+		bool clicking = should_click(state);
+
+		// The control socket's binding lives entirely on the clicking thread
+		if (t->opts->bindings[i].device == REMOTE_DEVICE || clicking == ((t->published >> i) & 1))
+		{
+			continue;
+		}
+
+		click_event_t ev = {i, clicking, clicking ? state->start_ns : state->stop_ns, state->toggles};
+		if (!click_ring_push(&t->ring, &ev))
+		{
+			complete = false;
+			break;
+		}
+		t->published ^= 1ULL << i;
+		queued = true;
+	}
+
+	uint64_t one = 1;
+	if (queued && write(t->wake_fd, &one, sizeof(one)) < 0)
+	{
+		fprintf(stderr, "Cannot wake the clicking thread: %s\n", strerror(errno));
+	}
+	return complete;
+}
+
+/**
+ * Mirror a click event in the clicking thread's copy of the binding's state. The copy only tracks
+ * whether the binding is clicking, so it's kept in toggle_active whichever button caused it.
+ */
+void apply_click_event(click_state_t* state, const click_event_t* ev)
+{
+	state->toggle_active = ev->clicking;
+	state->toggles = ev->toggles;
+	if (ev->clicking)
+	{
+		state->start_ns = ev->time_ns;
+	}
+	else
+	{
+		state->stop_ns = ev->time_ns;
+	}
+}
+
+/**
+ * Bring the clicking thread's streams up to date with everything the input thread has queued.
+ */
+void receive_click_events(input_thread_t* t, click_stream_t* streams)
+{
+	uint64_t count;
+	click_event_t ev;
+
+	// Reset the wakeup; the queue itself says what happened
+	if (read(t->wake_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+	{
+		fprintf(stderr, "Cannot read input thread wakeups: %s\n", strerror(errno));
+	}
+
+	while (click_ring_pop(&t->ring, &ev))
+	{
+		apply_click_event(&streams[ev.binding].state, &ev);
+	}
+}
+
+/**
+ * The input thread: read the buttons whenever they change and pass the results on.
+ *
+ * Its X connection is the one the input was opened on, and all it does with it is watch the
+ * buttons; the clicks go out on the main thread's own connection, so neither can hold up the other.
+ */
+void* input_thread_main(void* arg)
+{
+	input_thread_t* t = arg;
+	bool stop = false;
+
+	while (!stop)
+	{
+		pthread_mutex_lock(&t->lock);
+		process_input(t->in, t->opts, t->streams);
+
+		uint64_t now_ns = monotonic_ns();
+		uint64_t deadline_ns = t->in->type == INPUT_XI1 ? now_ns + t->poll_ns : 0;
+
+		// If the clicking thread is so far behind that the queue is full, try again shortly
+		if (!publish_click_state(t) && (deadline_ns == 0 || now_ns + NS_PER_MS < deadline_ns))
+		{
+			deadline_ns = now_ns + NS_PER_MS;
+		}
+		pthread_mutex_unlock(&t->lock);
+
+		wait_for_input(t->in, &t->stop_fd, 1, &stop, deadline_ns);
+	}
+	return NULL;
+}
+
+uint64_t poll_interval(const opts_t* opts);
+
+/**
+ * Close the input thread's eventfds, whichever of them were opened, and drop its lock.
+ */
+void close_input_thread_fds(input_thread_t* t)
+{
+	if (t->wake_fd >= 0)
+	{
+		close(t->wake_fd);
+		t->wake_fd = -1;
+	}
+	if (t->stop_fd >= 0)
+	{
+		close(t->stop_fd);
+		t->stop_fd = -1;
+	}
+	pthread_mutex_destroy(&t->lock);
+}
+
+/**
+ * Hand the open input over to a thread of its own. Returns false if it can't be started.
+ */
+bool start_input_thread(input_thread_t* t, input_t* in, opts_t* opts)
+{
+	t->in = in;
+	t->opts = opts;
+	t->poll_ns = poll_interval(opts);
+	t->published = 0;
+	atomic_init(&t->ring.head, 0);
+	atomic_init(&t->ring.tail, 0);
+	pthread_mutex_init(&t->lock, NULL);
+
+	t->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	t->stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (t->wake_fd < 0 || t->stop_fd < 0)
+	{
+		fprintf(stderr, "Cannot create eventfd: %s\n", strerror(errno));
+		close_input_thread_fds(t);
+		return false;
+	}
+
+	// Leave the signals to the main thread, so that they interrupt its wait
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int err = pthread_create(&t->thread, NULL, input_thread_main, t);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+	if (err != 0)
+	{
+		fprintf(stderr, "Cannot start the input thread: %s\n", strerror(err));
+		close_input_thread_fds(t);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Shut the input thread down and wait for it to finish.
+ */
+void stop_input_thread(input_thread_t* t)
+{
+	uint64_t one = 1;
+
+	if (write(t->stop_fd, &one, sizeof(one)) < 0)
+	{
+		fprintf(stderr, "Cannot stop the input thread: %s\n", strerror(errno));
+		return;
+	}
+	pthread_join(t->thread, NULL);
+	close_input_thread_fds(t);
+}
+
+/**
+ * Wake the loop up with the given WAKE_* flag whenever fd is readable.
+ */
+bool watch_event_source(event_loop_t* loop, int fd, uint32_t source)
+{
+	struct epoll_event ep = {EPOLLIN, {.u32 = source}};
+
+	if (epoll_ctl(loop->epoll_fd, EPOLL_CTL_ADD, fd, &ep) < 0)
+	{
+		fprintf(stderr, "Cannot set up epoll: %s\n", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Wake the loop up for the window targets' connection as well, once the output has opened it.
+ * Returns false if it can't be watched.
+ */
+bool watch_window_connection(event_loop_t* loop, const output_t* out)
+{
+	if (out->window_display == NULL || loop->window_display == out->window_display)
+	{
+		return true;
+	}
+	loop->window_display = out->window_display;
+	return watch_event_source(loop, ConnectionNumber(out->window_display), WAKE_WINDOW);
+}
+
+/**
+ * Set up the main loop's epoll set, with the timer and the signals already in it. The signals are
+ * blocked from now on and only arrive through the loop. Returns false if any of it fails.
+ */
+bool open_event_loop(event_loop_t* loop)
+{
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGUSR1);
+	sigaddset(&signals, SIGHUP);
+
+	loop->timer_ns = 0;
+	loop->display = NULL;
+	loop->window_display = NULL;
+	loop->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	loop->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	loop->signal_fd = -1;
+	if (loop->epoll_fd < 0 || loop->timer_fd < 0 || sigprocmask(SIG_BLOCK, &signals, NULL) < 0 ||
+	    (loop->signal_fd = signalfd(-1, &signals, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+	{
+		fprintf(stderr, "Cannot set up the event loop: %s\n", strerror(errno));
+		return false;
+	}
+	return watch_event_source(loop, loop->timer_fd, WAKE_TIMER) &&
+	       watch_event_source(loop, loop->signal_fd, WAKE_SIGNAL);
+}
+
+/**
+ * Wait until something happens or the deadline (0 for none) passes. Returns the WAKE_* flags of
+ * every source that's ready.
+ *
+ * However many sources there are, this is one epoll_wait, plus a timerfd_settime when the
+ * deadline has moved.
+ */
+uint32_t wait_for_events(event_loop_t* loop, uint64_t deadline_ns)
+{
+	struct epoll_event ep[8];
+	uint32_t woken = 0;
+	int timeout_ms = -1;
+
+	if (deadline_ns != loop->timer_ns)
+	{
+		struct itimerspec its = {{0, 0}, {deadline_ns / NS_PER_SEC, deadline_ns % NS_PER_SEC}};
+
+		// A deadline that has already passed fires straight away; 0 disarms the timer
+		timerfd_settime(loop->timer_fd, TFD_TIMER_ABSTIME, &its, NULL);
+		loop->timer_ns = deadline_ns;
+	}
+
+	// Events may already be sitting in Xlib's queue, in which case the fd won't wake us
+	if (loop->display != NULL && XPending(loop->display))
+	{
+		timeout_ms = 0;
+		woken |= WAKE_INPUT;
+	}
+	if (loop->window_display != NULL && XPending(loop->window_display))
+	{
+		timeout_ms = 0;
+		woken |= WAKE_WINDOW;
+	}
+
+	int count = epoll_wait(loop->epoll_fd, ep, sizeof(ep) / sizeof(ep[0]), timeout_ms);
+	for (int i = 0; i < count; ++i)
+	{
+		woken |= ep[i].data.u32;
+	}
+
+	if (woken & WAKE_TIMER)
+	{
+		uint64_t expirations;
+
+		// The timer is one-shot, so it has to be armed again even for the same deadline
+		if (read(loop->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+		{
+			fprintf(stderr, "Cannot read the timer: %s\n", strerror(errno));
+		}
+		loop->timer_ns = 0;
+	}
+	return woken;
+}
+
+/**
+ * Read the signals that have arrived: SIGINT and SIGTERM clear running, SIGUSR1 asks for a stats
+ * dump and SIGHUP sets *reload.
+ */
+void read_signals(event_loop_t* loop, bool* reload)
+{
+	struct signalfd_siginfo si;
+
+	while (read(loop->signal_fd, &si, sizeof(si)) == sizeof(si))
+	{
+		switch (si.ssi_signo)
+		{
+		case SIGINT:
+		case SIGTERM:
+			running = 0;
+			break;
+		case SIGUSR1:
+			dump_requested = 1;
+			break;
+		case SIGHUP:
+			*reload = true;
+			break;
+		}
+	}
+}
+
+/**
+ * Tear down the event loop. The signals stay blocked.
+ */
+void close_event_loop(event_loop_t* loop)
+{
+	if (loop->signal_fd >= 0)
+	{
+		close(loop->signal_fd);
+	}
+	if (loop->timer_fd >= 0)
+	{
+		close(loop->timer_fd);
+	}
+	if (loop->epoll_fd >= 0)
+	{
+		close(loop->epoll_fd);
+	}
+}
+
+/**
+ * Tell the user which device and button they pressed.
+ */
+void report_calibrate_button(const char* name, int device_id, int button, bool continuous)
+{
+	printf("Found button: %s -> device %d button %d\n", name, device_id, button);
+	if (!continuous)
+	{
+		printf("\nTo use this button as a trigger, run one of these commands:\n");
+		printf("  ./ac -i %d -t %d\n", device_id, button);
+		printf("  ./ac -n \"%s\" -t %d\n", name, button);
+	}
+	fflush(stdout);
+}
+
+/**
+ * Calibrate by polling every pointer's button state, for servers without XI2.
+ */
+void poll_calibrate(Display* display, bool continuous)
+{
+	bool found = false;
+	int held_device = -1;
+
+	while (running && !(found && !continuous))
+	{
+		// Walk the list of mouse devices until we find a pressed button
+		XDeviceInfo* info;
+		int num_devices;
+		bool any_held = false;
+
+		// Get the list of devices each time in case it changes
+		info = XListInputDevices(display, &num_devices);
+
+		for (int i = 0; i < num_devices; ++i)
+		{
+			int num_buttons = 0;
+
+			if (info[i].use != IsXExtensionPointer)
+			{
+				continue;
+			}
+
+			XAnyClassPtr generic_info = info[i].inputclassinfo;
+			if (generic_info->class == ButtonClass)
+			{
+				XButtonInfoPtr button_info = (XButtonInfoPtr)generic_info;
+				num_buttons = button_info->num_buttons;
+			}
+			else
+			{
+				continue;
+			}
+
+			// Get an XDevice from the device info
+			XDevice* device = XOpenDevice(display, info[i].id);
+			if (device == NULL)
+			{
+				continue;
+			}
+			int button = find_pressed_button(display, device, num_buttons);
+			XCloseDevice(display, device);
+
+			if (button > 0)
+			{
+				any_held = true;
+
+				// Only report a button once per press
+				if (held_device != (int)info[i].id)
+				{
+					held_device = (int)info[i].id;
+					report_calibrate_button(info[i].name, held_device, button, continuous);
+					found = true;
+				}
+				break;
+			}
+		}
+
+		XFreeDeviceList(info);
+
+		if (!any_held)
+		{
+			held_device = -1;
+		}
+
+		// There's no event to wait for, but there's no need to spin either
+		sleep_until(monotonic_ns() + 10 * NS_PER_MS);
+	}
+}
+
+/**
+ * Help the user figure out what the desired device ID and button ID is.
+ *
+ * Waits for XI2 raw button events from every device, so nothing happens until a button is
+ * pressed. In continuous mode, every press is reported until the program is interrupted.
+ */
+void do_calibrate(Display* display, bool continuous)
+{
+	int xi_opcode, event, error;
+	int major = 2;
+	int minor = 1;
+	bool found = false;
+
+	if (continuous)
+	{
+		printf("Press the mouse buttons you want to identify, Ctrl+C to finish\n");
+	}
+	else
+	{
+		printf("Press the mouse button you want to identify\n");
+	}
+	fflush(stdout);
+
+	Window root = RootWindow(display, 0);
+	XGrabPointer(display,
+	             root,
+	             False,
+	             ButtonPressMask | ButtonReleaseMask,
+	             GrabModeAsync,
+	             GrabModeAsync,
+	             root,
+	             None,
+	             CurrentTime);
+
+	// Raw events only get past the pointer grab from XI 2.1 on
+	if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event, &error) ||
+	    XIQueryVersion(display, &major, &minor) != Success || !xi_version_at_least(major, minor, 2, 1))
+	{
+		poll_calibrate(display, continuous);
+		XUngrabPointer(display, CurrentTime);
+		return;
+	}
+
+	unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {0};
+	XIEventMask mask = {XIAllDevices, sizeof(mask_bits), mask_bits};
+	XISetMask(mask_bits, XI_RawButtonPress);
+	XISelectEvents(display, root, &mask, 1);
+
+	while (running && !(found && !continuous))
+	{
+		if (!XPending(display))
+		{
+			wait_for_fd(ConnectionNumber(display), 0);
+			continue;
+		}
+
+		XEvent ev;
+		XGenericEventCookie* cookie = &ev.xcookie;
+
+		XNextEvent(display, &ev);
+		if (cookie->type != GenericEvent || cookie->extension != xi_opcode ||
+		    !XGetEventData(display, cookie))
+		{
+			continue;
+		}
+
+		XIRawEvent* raw = cookie->data;
+
+		// Master devices report every slave's presses too; only the physical device is useful
+		if (cookie->evtype == XI_RawButtonPress && raw->deviceid == raw->sourceid)
+		{
+			int num_devices;
+			XIDeviceInfo* info = XIQueryDevice(display, raw->deviceid, &num_devices);
+
+			if (info != NULL)
+			{
+				if (continuous)
+				{
+					printf("[%lu ms] ", (unsigned long)raw->time);
+				}
+				report_calibrate_button(info->name, raw->deviceid, raw->detail, continuous);
+				XIFreeDeviceInfo(info);
+				found = true;
+			}
+		}
+
+		XFreeEventData(display, cookie);
+	}
+
+	XUngrabPointer(display, CurrentTime);
+}
+
+/**
+ * Start a recording: write the header, and measure the first record's delta from now.
+ */
+bool start_recording(recorder_t* rec, FILE* fp, uint64_t now_ns)
+{
+	record_header_t header;
+
+	memset(rec, 0, sizeof(*rec));
+	rec->fp = fp;
+	rec->last_ns = now_ns;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	header.record_size = sizeof(record_t);
+	return fwrite(&header, sizeof(header), 1, fp) == 1;
+}
+
+/**
+ * Append one event to a recording.
+ *
+ * Deltas are whole microseconds, and last_ns only advances by what was written, so rounding never
+ * builds up however long the recording runs. A gap too long for one delta is bridged with
+ * REC_WAIT records.
+ */
+bool write_record(recorder_t* rec, uint64_t time_ns, record_type type, int button, int dx, int dy)
+{
+	record_t r;
+	uint64_t delta_us = time_ns > rec->last_ns ? (time_ns - rec->last_ns) / NS_PER_US : 0;
+
+	memset(&r, 0, sizeof(r));
+	while (delta_us > UINT32_MAX)
+	{
+		r.delta_us = UINT32_MAX;
+		r.type = REC_WAIT;
+		if (fwrite(&r, sizeof(r), 1, rec->fp) != 1)
+		{
+			return false;
+		}
+		rec->records++;
+		delta_us -= UINT32_MAX;
+		rec->last_ns += UINT32_MAX * NS_PER_US;
+	}
+
+	r.delta_us = (uint32_t)delta_us;
+	r.type = type;
+	r.button = (uint8_t)button;
+	r.dx = (int16_t)dx;
+	r.dy = (int16_t)dy;
+	rec->last_ns += delta_us * NS_PER_US;
+	rec->records++;
+	return fwrite(&r, sizeof(r), 1, rec->fp) == 1;
+}
+
+/**
+ * Record an XI2 raw button or motion event.
+ *
+ * Motion is recorded in whole pixels, with the fractions carried over to the next event so that
+ * slow movements aren't lost.
+ */
+bool record_raw_event(recorder_t* rec, int evtype, const XIRawEvent* raw, uint64_t time_ns)
+{
+	if (evtype == XI_RawButtonPress || evtype == XI_RawButtonRelease)
+	{
+		if (raw->detail <= 0 || raw->detail > UINT8_MAX)
+		{
+			return true;
+		}
+		return write_record(rec, time_ns, evtype == XI_RawButtonPress ? REC_PRESS : REC_RELEASE, raw->detail, 0, 0);
+	}
+	if (evtype != XI_RawMotion)
+	{
+		return true;
+	}
+
+	// Valuators 0 and 1 are x and y; values only holds the ones set in the mask
+	const double* value = raw->valuators.values;
+	for (int axis = 0; axis < 2 && axis < raw->valuators.mask_len * 8; ++axis)
+	{
+		if (XIMaskIsSet(raw->valuators.mask, axis))
+		{
+			*(axis == 0 ? &rec->rem_x : &rec->rem_y) += *value++;
+		}
+	}
+
+	int dx = rec->rem_x > INT16_MAX ? INT16_MAX : rec->rem_x < INT16_MIN ? INT16_MIN : (int)rec->rem_x;
+	int dy = rec->rem_y > INT16_MAX ? INT16_MAX : rec->rem_y < INT16_MIN ? INT16_MIN : (int)rec->rem_y;
+	if (dx == 0 && dy == 0)
+	{
+		return true;
+	}
+	rec->rem_x -= dx;
+	rec->rem_y -= dy;
+	return write_record(rec, time_ns, REC_MOTION, 0, dx, dy);
+}
+
+/**
+ * Record the first device's buttons and motion to opts->record_filename until interrupted.
+ */
+int do_record(Display* display, const opts_t* opts)
+{
+	int xi_opcode, event, error;
+	int major = 2;
+	int minor = 1;
+	int device_id = opts->num_devices > 0 ? opts->devices[0].device_id : -1;
+	recorder_t rec;
+
+	if (device_id < 0)
+	{
+		fprintf(stderr, "Error: --record needs a device (-i or -n)\n");
+		return EINVAL;
+	}
+	if (!XQueryExtension(display, "XInputExtension", &xi_opcode, &event, &error) ||
+	    XIQueryVersion(display, &major, &minor) != Success || !xi_version_at_least(major, minor, 2, 1))
+	{
+		fprintf(stderr, "Recording needs XInput 2.1\n");
+		return 1;
+	}
+
+	FILE* fp = fopen(opts->record_filename, "wb");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error opening file %s for writing\n", opts->record_filename);
+		return 1;
+	}
+
+	unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {0};
+	XIEventMask mask = {device_id, sizeof(mask_bits), mask_bits};
+	XISetMask(mask_bits, XI_RawButtonPress);
+	XISetMask(mask_bits, XI_RawButtonRelease);
+	XISetMask(mask_bits, XI_RawMotion);
+	XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+	XFlush(display);
+
+	printf("Recording device %d to %s, Ctrl+C to stop\n", device_id, opts->record_filename);
+	fflush(stdout);
+
+	bool ok = start_recording(&rec, fp, monotonic_ns());
+	while (ok && running)
+	{
+		if (!XPending(display))
+		{
+			wait_for_fd(ConnectionNumber(display), 0);
+			continue;
+		}
+
+		XEvent ev;
+		XGenericEventCookie* cookie = &ev.xcookie;
+
+		XNextEvent(display, &ev);
+		if (cookie->type != GenericEvent || cookie->extension != xi_opcode ||
+		    !XGetEventData(display, cookie))
+		{
+			continue;
+		}
+
+		XIRawEvent* raw = cookie->data;
+		if (raw->deviceid == device_id)
+		{
+			ok = record_raw_event(&rec, cookie->evtype, raw, monotonic_ns());
+		}
+		XFreeEventData(display, cookie);
+	}
+
+	if (fclose(fp) != 0 || !ok)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", opts->record_filename, strerror(errno));
+		return 1;
+	}
+	printf("Recorded %" PRIu64 " events\n", rec.records);
+	return 0;
+}
+
+/**
+ * Map a recording into memory for replay. Returns false, having said why, if it can't be read or
+ * isn't a recording.
+ */
+bool open_recording(recording_t* rec, const char* filename)
+{
+	struct stat st;
+	const record_header_t* header;
+
+	memset(rec, 0, sizeof(*rec));
+	int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0)
+	{
+		fprintf(stderr, "Error opening file %s for reading\n", filename);
+		if (fd >= 0)
+		{
+			close(fd);
+		}
+		return false;
+	}
+
+	if ((size_t)st.st_size < sizeof(*header) ||
+	    (rec->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED)
+	{
+		rec->map = NULL;
+	}
+	close(fd);
+
+	header = rec->map;
+	if (header == NULL || memcmp(header->magic, RECORD_MAGIC, sizeof(header->magic)) != 0 ||
+	    header->record_size != sizeof(record_t) || (st.st_size - sizeof(*header)) % sizeof(record_t) != 0)
+	{
+		fprintf(stderr, "%s isn't a recording\n", filename);
+		if (rec->map != NULL)
+		{
+			munmap(rec->map, st.st_size);
+			rec->map = NULL;
+		}
+		return false;
+	}
+
+	// Replay reads straight through, once
+	madvise(rec->map, st.st_size, MADV_SEQUENTIAL);
+	rec->map_len = st.st_size;
+	rec->records = (const record_t*)(header + 1);
+	rec->num_records = (st.st_size - sizeof(*header)) / sizeof(record_t);
+	return true;
+}
+
+void close_recording(recording_t* rec)
+{
+	if (rec->map != NULL)
+	{
+		munmap(rec->map, rec->map_len);
+		rec->map = NULL;
+	}
+}
+
+// How much of a recording replay gets through before handing the pages behind it back
+#define REPLAY_RELEASE_BYTES (1024 * 1024)
+
+/**
+ * Play a recording through the output backend, speed times as fast as it was recorded, until it
+ * ends or we're interrupted. Returns the number of records played.
+ *
+ * Each record is due at the start time plus the sum of the deltas so far, so however long the
+ * recording, time spent emitting never accumulates into drift. Pages that have been played are
+ * dropped as replay moves on, so memory use stays the same for any length of recording. Buttons
+ * still held at the end are released.
+ */
+size_t replay_recording(const recording_t* rec, output_t* out, double speed)
+{
+	uint64_t start_ns = monotonic_ns();
+	uint64_t offset_ns = 0;
+	size_t released = 0;
+	button_mask_t held = {{0}};
+	size_t i;
+
+	for (i = 0; i < rec->num_records && running; ++i)
+	{
+		const record_t* r = &rec->records[i];
+
+		offset_ns += r->delta_us * NS_PER_US;
+		uint64_t due_ns = start_ns + (uint64_t)(offset_ns / speed);
+		while (running && monotonic_ns() < due_ns)
+		{
+			sleep_until(due_ns);
+		}
+		if (!running)
+		{
+			break;
+		}
+
+		switch (r->type)
+		{
+		case REC_PRESS:
+		case REC_RELEASE:
+			emit_button(out, r->button, r->type == REC_PRESS);
+			if (r->type == REC_PRESS)
+			{
+				button_mask_set(&held, r->button);
+			}
+			else
+			{
+				button_mask_clear(&held, r->button);
+			}
+			break;
+		case REC_MOTION:
+			emit_motion(out, r->dx, r->dy);
+			break;
+		}
+
+		size_t played = (const char*)(r + 1) - (const char*)rec->map;
+		if (played - released >= REPLAY_RELEASE_BYTES)
+		{
+			madvise((char*)rec->map + released, REPLAY_RELEASE_BYTES, MADV_DONTNEED);
+			released += REPLAY_RELEASE_BYTES;
+		}
+	}
+
+	for (int button = button_mask_next(&held, 0); button >= 0; button = button_mask_next(&held, button + 1))
+	{
+		emit_button(out, button, false);
+	}
+	return i;
+}
+
+/**
+ * Play opts->replay_filename back through the configured output.
+ */
+int do_replay(Display* display, const opts_t* opts)
+{
+	recording_t rec;
+	output_t output;
+
+	if (!open_recording(&rec, opts->replay_filename))
+	{
+		return 1;
+	}
+	if (!open_output(&output, opts, display))
+	{
+		close_recording(&rec);
+		return 1;
+	}
+
+	printf("Replaying %zu events from %s\n", rec.num_records, opts->replay_filename);
+	fflush(stdout);
+	size_t played = replay_recording(&rec, &output, opts->replay_speed);
+	printf("Replayed %zu of %zu events\n", played, rec.num_records);
+
+	close_output(&output);
+	close_recording(&rec);
+	return 0;
+}
+
+/**
+ * Compare a line in the config file with the name of a config parameter.
+ *
+ * Sort of like strcmp but more casual with \0 terminators.
+ */
+bool comp(const char* config_line, const char* config_parm, size_t parmsize)
+{
+	if (strlen(config_line) < parmsize)
+	{
+		return false;
+	}
+	return memcmp(config_line, config_parm, parmsize) == 0;
+}
+
+/**
+ * Compare a key in the config file with the given option type.
+ */
+#define check_config(_str, _type)          \
+	parmsize = strlen(_str);               \
+	if (pos) *pos = parmsize + 1;          \
+	if (comp(config_line, _str, parmsize)) \
+	{                                      \
+		return _type;                      \
+	}
+
+config_type get_config_type(const char* config_line, size_t line_len, size_t* pos)
+{
+	bool start = true;
+	size_t parmsize = 0;
+
+	if (line_len == 0)
+	{
+		return BLANK;
+	}
+
+	for (size_t i = 0; i < line_len; ++i)
+	{
+		// Ignore leading whitespace
+		if (start && (config_line[i] == ' ' || config_line[i] == '\t'))
+		{
+			continue;
+		}
+
+		// EOL implies blank line
+		if (start && config_line[i] == '\n')
+		{
+			return BLANK;
+		}
+
+		// Check if this is a comment line
+		if (config_line[i] == '#')
+		{
+			if (start)
+			{
+				return COMMENT;
+			}
+			// I really don't think we should get here
+			return INVALID;
+		}
+
+		start = false;
+
+		// This switch just optimizes the number of strcmps we need to do
+		switch (config_line[i])
+		{
+		case 'b':
+			check_config("bind", BIND);
+			return INVALID;
+		case 'c':
+			check_config("click_button", CLICK_BUTTON);
+			check_config("control", CONTROL);
+			return INVALID;
+		case 't':
+			check_config("trigger_button", TRIGGER_BUTTON);
+			check_config("toggle_button", TOGGLE_BUTTON);
+			return INVALID;
+		case 'd':
+			// delay_us first, since "delay" is a prefix of it
+			check_config("delay_us", DELAY_US);
+			check_config("delay", DELAY);
+			check_config("dev_id", DEV_ID);
+			check_config("dev_name", DEV_NAME);
+			check_config("display", DISPLAY);
+			return INVALID;
+		case 'i':
+			check_config("input", INPUT);
+			return INVALID;
+		case 'o':
+			check_config("overrun", OVERRUN);
+			check_config("output", OUTPUT);
+			return INVALID;
+		case 'r':
+			check_config("rate", RATE);
+			return INVALID;
+		case 's':
+			check_config("stats_interval", STATS_INTERVAL);
+			check_config("stats_file", STATS_FILE);
+			return INVALID;
+		default:
+			return INVALID;
+		}
+	}
+	return INVALID;
+}
+
+/**
+ * Read an integer from a config file line.
+ */
+#define read_int(_dest)                      \
+	value = atoi(&line[pos]);                \
+	if (value > 0)                           \
+	{                                        \
+		_dest = value;                       \
+	}                                        \
+	else                                     \
+	{                                        \
+		fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line); \
+		return false;                        \
+	}
+
+/**
+ * Check whether a config/option value is the given word, ignoring anything after it.
+ */
+bool value_is(const char* value, const char* word)
+{
+	size_t len = strlen(word);
+
+	if (strncmp(value, word, len) != 0)
+	{
+		return false;
+	}
+	return value[len] == '\0' || value[len] == ' ' || value[len] == '\t' || value[len] == '\n' ||
+	       value[len] == '#';
+}
+
+/**
+ * Parse the name of an input method.
+ */
+bool parse_input_type(const char* value, input_type* input)
+{
+	if (value_is(value, "xi2"))
+	{
+		*input = INPUT_XI2;
+	}
+	else if (value_is(value, "xi1"))
+	{
+		*input = INPUT_XI1;
+	}
+	else if (value_is(value, "evdev"))
+	{
+		*input = INPUT_EVDEV;
+	}
+	else
+	{
+		fprintf(stderr, "Unknown input method '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Parse a click interval into nanoseconds.
+ *
+ * Plain numbers are milliseconds, as they always have been. A unit suffix (s, ms, us or ns)
+ * allows other scales, so "0.25ms" and "250us" are the same interval.
+ */
+bool parse_interval(const char* value, uint64_t default_unit_ns, uint64_t* interval_ns)
+{
+	char* end;
+	double amount = strtod(value, &end);
+	uint64_t unit_ns;
+
+	if (end == value || !isfinite(amount) || amount < 0)
+	{
+		fprintf(stderr, "Invalid interval '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+
+	if (value_is(end, ""))
+	{
+		unit_ns = default_unit_ns;
+	}
+	else if (value_is(end, "s"))
+	{
+		unit_ns = NS_PER_SEC;
+	}
+	else if (value_is(end, "ms"))
+	{
+		unit_ns = NS_PER_MS;
+	}
+	else if (value_is(end, "us"))
+	{
+		unit_ns = NS_PER_US;
+	}
+	else if (value_is(end, "ns"))
+	{
+		unit_ns = 1;
+	}
+	else
+	{
+		fprintf(stderr, "Invalid interval '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+
+	// Anything that doesn't fit would be undefined to convert
+	double ns = amount * unit_ns + 0.5;
+	if (ns >= UINT64_LIMIT)
+	{
+		fprintf(stderr, "Interval '%.*s' is too long\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+
+	*interval_ns = (uint64_t)ns;
+	return true;
+}
+
+/**
+ * Parse a click rate in clicks per second into an interval in nanoseconds.
+ */
+bool parse_rate(const char* value, uint64_t* interval_ns)
+{
+	char* end;
+	double cps = strtod(value, &end);
+
+	if (end == value || !isfinite(cps) || cps <= 0 || !(value_is(end, "") || value_is(end, "cps")))
+	{
+		fprintf(stderr, "Invalid click rate '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+
+	// A rate so high it rounds to no interval at all would mean no limit, not that rate
+	double ns = NS_PER_SEC / cps + 0.5;
+	if (ns < 1 || ns >= UINT64_LIMIT)
+	{
+		fprintf(stderr, "Click rate '%.*s' is out of range\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+
+	*interval_ns = (uint64_t)ns;
+	return true;
+}
+
+/**
+ * Parse a click cadence: a rate with a "cps" suffix ("20cps"), or else an interval ("50ms", "50").
+ */
+bool parse_cadence(const char* value, uint64_t* interval_ns)
+{
+	char* end;
+
+	strtod(value, &end);
+	if (end != value && value_is(end, "cps"))
+	{
+		return parse_rate(value, interval_ns);
+	}
+	return parse_interval(value, NS_PER_MS, interval_ns);
+}
+
+/**
+ * Copy a string value from a config line, up to a comment or the end of the line.
+ * Returns NULL if the value is empty or memory runs out.
+ */
+char* copy_config_string(const char* value)
+{
+	size_t len = strcspn(value, "#\n");
+
+	while (len > 0 && (value[len - 1] == ' ' || value[len - 1] == '\t'))
+	{
+		--len;
+	}
+	if (len == 0)
+	{
+		return NULL;
+	}
+	return strndup(value, len);
+}
+
+/**
+ * Resolve a file name given in a config file against that file's directory. Names that are
+ * absolute, or that didn't come from a file (config_filename is NULL), are left alone. Returns a
+ * copy the caller frees, or NULL if memory runs out.
+ */
+char* resolve_config_path(const char* config_filename, const char* name)
+{
+	const char* slash = config_filename != NULL ? strrchr(config_filename, '/') : NULL;
+
+	if (name[0] == '/' || slash == NULL)
+	{
+		return strdup(name);
+	}
+
+	int dir_len = (int)(slash - config_filename);
+	size_t len = dir_len + strlen(name) + 2;
+	char* path = malloc(len);
+	if (path != NULL)
+	{
+		snprintf(path, len, "%.*s/%s", dir_len, config_filename, name);
+	}
+	return path;
+}
+
+/**
+ * Add a step to a sequence being compiled, growing its event array as needed.
+ */
+bool add_sequence_event(sequence_t* seq, int* capacity, const seq_event_t* ev)
+{
+	if (seq->num_events == MAX_SEQUENCE_EVENTS)
+	{
+		fprintf(stderr, "Too many clicks in a sequence (at most %d)\n", MAX_SEQUENCE_EVENTS);
+		return false;
+	}
+	if (seq->num_events == *capacity)
+	{
+		int new_capacity = *capacity > 0 ? *capacity * 2 : 64;
+		seq_event_t* events = realloc(seq->events, new_capacity * sizeof(events[0]));
+		if (events == NULL)
+		{
+			fprintf(stderr, "Memory allocation failed\n");
+			return false;
+		}
+		seq->events = events;
+		*capacity = new_capacity;
+	}
+
+	seq->events[seq->num_events++] = *ev;
+	seq->moves = seq->moves || ev->moves;
+	return true;
+}
+
+/**
+ * Add a click to a sequence being compiled. A move waiting at the same offset goes along with it,
+ * so the two are sent together.
+ */
+bool add_sequence_click(sequence_t* seq, int* capacity, uint64_t offset_ns, int button, seq_event_t* move)
+{
+	seq_event_t ev = {offset_ns, button, SEQ_CLICK, false, 0, 0};
+
+	if (move->moves)
+	{
+		ev.moves = true;
+		ev.x = move->x;
+		ev.y = move->y;
+		move->moves = false;
+	}
+	return add_sequence_event(seq, capacity, &ev);
+}
+
+/**
+ * Add a move that nothing took along to a sequence being compiled, as a step of its own.
+ */
+bool flush_sequence_move(sequence_t* seq, int* capacity, seq_event_t* move)
+{
+	if (!move->moves)
+	{
+		return true;
+	}
+	move->moves = false;
+	return add_sequence_event(seq, capacity, move);
+}
+
+/**
+ * Parse a point on the screen, "<x>,<y>". Returns how many characters it took, or 0 if it isn't
+ * one.
+ */
+int parse_point(const char* value, int* x, int* y)
+{
+	int n = 0;
+
+	if (sscanf(value, "%d,%d%n", x, y, &n) != 2 || *x < 0 || *y < 0 ||
+	    (value[n] != '\0' && strchr(" \t:#\n", value[n]) == NULL))
+	{
+		return 0;
+	}
+	return n;
+}
+
+/**
+ * Compile "drag <button> <duration> <x>,<y> <x>,<y> [<x>,<y> ...]" into a sequence: the button
+ * goes down at the first point, the pointer moves through the rest in straight lines, one step
+ * every step_ns, and the button comes up at the last point. Each segment takes an equal share of
+ * the duration. Returns false if the line is invalid.
+ */
+bool add_sequence_drag(sequence_t* seq, int* capacity, const char* p, uint64_t* at_ns, uint64_t step_ns)
+{
+	long button;
+	char duration[32];
+	uint64_t duration_ns;
+	int px[MAX_DRAG_POINTS], py[MAX_DRAG_POINTS];
+	int num_points = 0;
+	int n = 0;
+
+	if (sscanf(p, "drag %ld %31s%n", &button, duration, &n) != 2 || button <= 0 || button >= 256 ||
+	    !parse_interval(duration, NS_PER_MS, &duration_ns) || duration_ns == 0)
+	{
+		return false;
+	}
+	for (p += n; num_points < MAX_DRAG_POINTS; ++num_points)
+	{
+		p += strspn(p, " \t");
+		n = parse_point(p, &px[num_points], &py[num_points]);
+		if (n == 0)
+		{
+			break;
+		}
+		p += n;
+	}
+	p += strspn(p, " \t");
+	if (num_points < 2 || (*p != '\0' && *p != '#' && *p != '\n'))
+	{
+		return false;
+	}
+
+	seq_event_t ev = {*at_ns, (int)button, SEQ_PRESS, true, px[0], py[0]};
+	bool ok = add_sequence_event(seq, capacity, &ev);
+
+	// Whole steps, with the last one landing on the end of the path
+	uint64_t steps = duration_ns / step_ns > 0 ? duration_ns / step_ns : 1;
+	for (uint64_t i = 1; ok && i <= steps; ++i)
+	{
+		// Where along the path this step is, in 1/steps of a segment
+		uint64_t along = i * (num_points - 1);
+		int seg = (int)(along / steps);
+		uint64_t frac = along % steps;
+
+		if (seg == num_points - 1)
+		{
+			seg--;
+			frac = steps;
+		}
+		ev.offset_ns = *at_ns + (i == steps ? duration_ns : i * step_ns);
+		ev.action = i == steps ? SEQ_RELEASE : SEQ_MOVE;
+		ev.x = px[seg] + (int)(((int64_t)(px[seg + 1] - px[seg]) * (int64_t)frac) / (int64_t)steps);
+		ev.y = py[seg] + (int)(((int64_t)(py[seg + 1] - py[seg]) * (int64_t)frac) / (int64_t)steps);
+		ok = add_sequence_event(seq, capacity, &ev);
+	}
+	*at_ns += duration_ns;
+	return ok;
+}
+
+/**
+ * Count the words on a line, up to a comment.
+ */
+int count_words(const char* p)
+{
+	int words = 0;
+
+	for (p += strspn(p, " \t"); *p != '\0' && *p != '#' && *p != '\n'; p += strspn(p, " \t"))
+	{
+		p += strcspn(p, " \t#\n");
+		words++;
+	}
+	return words;
+}
+
+/**
+ * Compile a sequence file into a flat array of timed clicks. Returns NULL, having said why, if the
+ * file can't be read or has a mistake in it.
+ *
+ * Each line is "click <button>", "click <button> <count> <interval>" (count clicks, interval
+ * apart), "wait <interval>", "move <x>,<y>" (move the pointer there, along with the next click if
+ * there's no wait in between), "drag <button> <duration> <x>,<y> <x>,<y> ..." or "step <interval>"
+ * (how often later drags move the pointer), with intervals in milliseconds unless they have a
+ * unit. Playback loops back to the top after the last line.
+ */
+sequence_t* load_sequence(const char* filename)
+{
+	FILE* fp = fopen(filename, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error opening file %s for reading\n", filename);
+		return NULL;
+	}
+
+	sequence_t* seq = calloc(1, sizeof(*seq));
+	int capacity = 0;
+	uint64_t at_ns = 0;
+	uint64_t step_ns = DRAG_STEP_NS;
+	seq_event_t move = {0, 0, SEQ_MOVE, false, 0, 0};
+	char* line = NULL;
+	size_t line_size = 0;
+	int line_no = 0;
+	bool ok = seq != NULL;
+
+	while (ok && getline(&line, &line_size, fp) != -1)
+	{
+		const char* p = line + strspn(line, " \t");
+		long button, count = 1;
+		char interval[32];
+		uint64_t interval_ns = 0;
+
+		line_no++;
+		if (*p == '#' || *p == '\n' || *p == '\0')
+		{
+			continue;
+		}
+
+		// Anything after the arguments, other than a comment, is a mistake
+		int words = count_words(p);
+		if (value_is(p, "wait"))
+		{
+			const char* value = p + strlen("wait");
+			ok = words == 2 && parse_interval(value + strspn(value, " \t"), NS_PER_MS, &interval_ns) &&
+			     (interval_ns == 0 || flush_sequence_move(seq, &capacity, &move));
+			at_ns += interval_ns;
+		}
+		else if (value_is(p, "click"))
+		{
+			int fields = sscanf(p, "click %ld %ld %31s", &button, &count, interval);
+			ok = words == fields + 1 && (fields == 1 || (fields == 3 && count > 0 && parse_interval(interval, NS_PER_MS, &interval_ns))) &&
+			     button > 0 && button < 256;
+			for (long i = 0; ok && i < count; ++i)
+			{
+				ok = add_sequence_click(seq, &capacity, at_ns, (int)button, &move);
+				at_ns += interval_ns;
+			}
+		}
+		else if (value_is(p, "move"))
+		{
+			const char* value = p + strlen("move");
+			ok = words == 2 && flush_sequence_move(seq, &capacity, &move) &&
+			     parse_point(value + strspn(value, " \t"), &move.x, &move.y) > 0;
+			move.offset_ns = at_ns;
+			move.moves = ok;
+		}
+		else if (value_is(p, "drag"))
+		{
+			ok = flush_sequence_move(seq, &capacity, &move) && add_sequence_drag(seq, &capacity, p, &at_ns, step_ns);
+		}
+		else if (value_is(p, "step"))
+		{
+			const char* value = p + strlen("step");
+			ok = words == 2 && parse_interval(value + strspn(value, " \t"), NS_PER_MS, &step_ns) && step_ns > 0;
+		}
+		else
+		{
+			ok = false;
+		}
+
+		if (!ok)
+		{
+			fprintf(stderr, "Sequence error: Couldn't parse line %d of %s: '%.*s'\n", line_no, filename, (int)strcspn(p, "\n"), p);
+		}
+	}
+	free(line);
+	fclose(fp);
+	ok = ok && flush_sequence_move(seq, &capacity, &move);
+
+	if (ok && (seq->num_events == 0 || at_ns == 0))
+	{
+		fprintf(stderr, "Sequence error: %s needs at least one click and some time between passes\n", filename);
+		ok = false;
+	}
+	if (!ok)
+	{
+		if (seq != NULL)
+		{
+			free(seq->events);
+		}
+		free(seq);
+		return NULL;
+	}
+
+	// The shortest gap, including the one from the last click round to the first, sets how often
+	// XI1 polling checks the buttons while the sequence plays
+	seq->length_ns = at_ns;
+	seq->min_gap_ns = seq->length_ns;
+	for (int i = 0; i < seq->num_events; ++i)
+	{
+		uint64_t next_ns = i + 1 < seq->num_events ? seq->events[i + 1].offset_ns : seq->length_ns + seq->events[0].offset_ns;
+		uint64_t gap_ns = next_ns - seq->events[i].offset_ns;
+		if (gap_ns > 0 && gap_ns < seq->min_gap_ns)
+		{
+			seq->min_gap_ns = gap_ns;
+		}
+	}
+	return seq;
+}
+
+/**
+ * Parse where a binding's clicks go: "<x>,<y> id|class|title <value>", with the point relative to
+ * the window and the value running to the end of the line. Returns NULL if it's invalid.
+ */
+window_target_t* parse_window_target(const char* value)
+{
+	int x, y, n = 0;
+	char kind[8];
+	window_match match;
+
+	if (sscanf(value, "%d,%d%n", &x, &y, &n) != 2 || x < 0 || y < 0)
+	{
+		return NULL;
+	}
+	value += n;
+	value += strspn(value, " \t:");
+	size_t len = strcspn(value, " \t:#\n");
+	if (len == 0 || len >= sizeof(kind))
+	{
+		return NULL;
+	}
+	memcpy(kind, value, len);
+	kind[len] = '\0';
+	value += len;
+	value += strspn(value, " \t:");
+
+	if (value_is(kind, "id"))
+	{
+		char* end;
+		strtoul(value, &end, 0);
+		if (end == value || (*end != '\0' && strchr(" \t#\n", *end) == NULL))
+		{
+			return NULL;
+		}
+		match = WINDOW_BY_ID;
+	}
+	else if (value_is(kind, "class"))
+	{
+		match = WINDOW_BY_CLASS;
+	}
+	else if (value_is(kind, "title"))
+	{
+		match = WINDOW_BY_TITLE;
+	}
+	else
+	{
+		return NULL;
+	}
+
+	char* copy = copy_config_string(value);
+	window_target_t* t = copy != NULL ? calloc(1, sizeof(window_target_t)) : NULL;
+	if (t == NULL)
+	{
+		free(copy);
+		return NULL;
+	}
+	t->match = match;
+	t->value = copy;
+	t->x = x;
+	t->y = y;
+	t->window = None;
+	t->lookup_due = true;
+	return t;
+}
+
+/**
+ * Copy a window target without anything it has looked up. Returns NULL if there's no memory.
+ */
+window_target_t* copy_window_target(const window_target_t* t)
+{
+	char* value = strdup(t->value);
+	window_target_t* copy = value != NULL ? calloc(1, sizeof(window_target_t)) : NULL;
+	if (copy == NULL)
+	{
+		free(value);
+		return NULL;
+	}
+	copy->match = t->match;
+	copy->value = value;
+	copy->x = t->x;
+	copy->y = t->y;
+	copy->window = None;
+	copy->subwindow = None;
+	copy->lookup_due = true;
+	return copy;
+}
+
+/**
+ * Compile the points of "at <x>,<y> [<x>,<y> ...]" into a sequence that moves to each point in
+ * turn and clicks there, period_ns apart. Returns NULL if the list is invalid.
+ */
+sequence_t* points_sequence(const char* value, int button, uint64_t period_ns)
+{
+	sequence_t* seq = calloc(1, sizeof(*seq));
+	int capacity = 0;
+	bool ok = seq != NULL && period_ns > 0;
+
+	for (const char* p = value + strspn(value, " \t:"); ok && *p != '\0' && *p != '#' && *p != '\n'; p += strspn(p, " \t:"))
+	{
+		seq_event_t ev = {seq->num_events * period_ns, button, SEQ_CLICK, true, 0, 0};
+		int n = parse_point(p, &ev.x, &ev.y);
+
+		ok = n > 0 && add_sequence_event(seq, &capacity, &ev);
+		p += n;
+	}
+	if (!ok || seq->num_events == 0)
+	{
+		if (seq != NULL)
+		{
+			free(seq->events);
+		}
+		free(seq);
+		return NULL;
+	}
+	seq->length_ns = seq->num_events * period_ns;
+	seq->min_gap_ns = period_ns;
+	return seq;
+}
+
+/**
+ * Parse a binding: "hold|toggle <button> <click button> <cadence>", or
+ * "hold|toggle <button> sequence <file>" to play a sequence file. A click binding can end in
+ * "window <x>,<y> id|class|title <value>" to click into that window instead, or in
+ * "at <x>,<y> [<x>,<y> ...]" to move the pointer to each of those points in turn and click there.
+ *
+ * The fields can be separated by spaces or colons, so "hold 9 1 20cps" in a config file and
+ * "hold:9:1:20cps" on the command line are the same binding. The device isn't filled in. A
+ * sequence is compiled as soon as its binding is read; a relative file name is taken from the
+ * directory of config_filename, if the binding came from a config file.
+ */
+bool parse_binding(const char* value, const char* config_filename, binding_t* b)
+{
+	char fields[4][32];
+	int count = 0;
+	const char* p = value;
+
+	while (count < 4)
+	{
+		// A sequence's file name is the rest of the value, colons and all
+		if (count == 3 && value_is(fields[2], "sequence"))
+		{
+			break;
+		}
+
+		p += strspn(p, " \t:");
+		size_t len = strcspn(p, " \t:#\n");
+		if (len == 0 || len >= sizeof(fields[0]))
+		{
+			break;
+		}
+		memcpy(fields[count], p, len);
+		fields[count++][len] = '\0';
+		p += len;
+	}
+	p += strspn(p, " \t:");
+
+	bool sequence = count == 3 && value_is(fields[2], "sequence");
+	bool window = count == 4 && strncmp(p, "window", 6) == 0 && p[6] != '\0' && strchr(" \t:", p[6]) != NULL;
+	bool points = count == 4 && strncmp(p, "at", 2) == 0 && p[2] != '\0' && strchr(" \t:", p[2]) != NULL;
+	int button = count == 4 || sequence ? atoi(fields[1]) : 0;
+	int click_button = count == 4 ? atoi(fields[2]) : 0;
+	if (button <= 0 || (!sequence && click_button <= 0) ||
+	    (!sequence && !window && !points && *p != '\0' && *p != '#' && *p != '\n'))
+	{
+		fprintf(stderr, "Invalid binding '%.*s'\n", (int)strcspn(value, "#\n"), value);
+		return false;
+	}
+
+	if (value_is(fields[0], "hold"))
+	{
+		b->trigger_button = button;
+		b->toggle_button = -1;
+	}
+	else if (value_is(fields[0], "toggle"))
+	{
+		b->trigger_button = -1;
+		b->toggle_button = button;
+	}
+	else
+	{
+		fprintf(stderr, "Unknown binding mode '%s' (expected hold or toggle)\n", fields[0]);
+		return false;
+	}
+
+	b->sequence = NULL;
+	b->window = NULL;
+	if (sequence)
+	{
+		// The compiled sequence belongs to the options, and is freed along with them
+		char* name = copy_config_string(p);
+		char* filename = name != NULL ? resolve_config_path(config_filename, name) : NULL;
+		b->sequence = filename != NULL ? load_sequence(filename) : NULL;
+		free(name);
+		free(filename);
+		if (b->sequence == NULL)
+		{
+			fprintf(stderr, "Invalid binding '%.*s'\n", (int)strcspn(value, "#\n"), value);
+			return false;
+		}
+		b->click_button = b->sequence->events[0].button;
+		b->period_ns = b->sequence->min_gap_ns;
+		return true;
+	}
+
+	b->click_button = click_button;
+	if (!parse_cadence(fields[3], &b->period_ns))
+	{
+		return false;
+	}
+	if (points)
+	{
+		b->sequence = points_sequence(p + 2, click_button, b->period_ns);
+		if (b->sequence == NULL)
+		{
+			fprintf(stderr, "Invalid points in binding '%.*s' (they need a cadence)\n", (int)strcspn(value, "#\n"), value);
+			return false;
+		}
+	}
+	if (window)
+	{
+		b->window = parse_window_target(p + 7 + strspn(p + 7, " \t:"));
+		if (b->window == NULL)
+		{
+			fprintf(stderr, "Invalid window target in binding '%.*s'\n", (int)strcspn(value, "#\n"), value);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Parse the name of an overrun policy.
+ */
+bool parse_overrun_policy(const char* value, overrun_policy* policy)
+{
+	if (value_is(value, "catchup"))
+	{
+		*policy = OVERRUN_CATCHUP;
+	}
+	else if (value_is(value, "skip"))
+	{
+		*policy = OVERRUN_SKIP;
+	}
+	else
+	{
+		fprintf(stderr, "Unknown overrun policy '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Parse the name of a realtime scheduling policy.
+ */
+bool parse_rt_policy(const char* value, int* policy)
+{
+	if (value_is(value, "fifo"))
+	{
+		*policy = SCHED_FIFO;
+	}
+	else if (value_is(value, "rr"))
+	{
+		*policy = SCHED_RR;
+	}
+	else
+	{
+		fprintf(stderr, "Unknown realtime policy '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Parse the name of an output backend.
+ */
+bool parse_output_type(const char* value, output_type* output)
+{
+	if (value_is(value, "xtest"))
+	{
+		*output = OUTPUT_XTEST;
+	}
+	else if (value_is(value, "uinput"))
+	{
+		*output = OUTPUT_UINPUT;
+	}
+	else
+	{
+		fprintf(stderr, "Unknown output backend '%.*s'\n", (int)strcspn(value, " \t\n#"), value);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Return the device that trigger and toggle buttons currently apply to: the last one given.
+ */
+device_opts_t* current_device(opts_t* opts)
+{
+	if (opts->num_devices == 0)
+	{
+		opts->num_devices = 1;
+	}
+	return &opts->devices[opts->num_devices - 1];
+}
+
+/**
+ * Return the device that a device ID or name applies to.
+ *
+ * Buttons given before the first device belong to it, so the current device is used until it has
+ * an ID or name of its own; after that, each ID or name starts a new device. Returns NULL if
+ * there's no room for another device, or if by_name says this is a name for a device that only has
+ * an ID so far, or the other way around.
+ */
+device_opts_t* next_device(opts_t* opts, bool by_name)
+{
+	device_opts_t* dev = current_device(opts);
+
+	if (dev->device_id <= 0 && dev->device_name == NULL)
+	{
+		return dev;
+	}
+
+	// "-i 10 -n foo" is one device given twice, as it always was; it only takes buttons of the
+	// first one's own to make the second a device of its own
+	bool has_buttons = dev->trigger_button >= 0 || dev->toggle_button >= 0;
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		has_buttons = has_buttons || opts->bindings[i].device == opts->num_devices - 1;
+	}
+	if (!has_buttons && (by_name ? dev->device_id > 0 : dev->device_name != NULL))
+	{
+		fprintf(stderr, "Cannot specify both device ID and device name\n");
+		return NULL;
+	}
+
+	if (opts->num_devices == MAX_DEVICES)
+	{
+		fprintf(stderr, "Too many devices (at most %d)\n", MAX_DEVICES);
+		return NULL;
+	}
+
+	dev = &opts->devices[opts->num_devices++];
+	dev->device_id = -1;
+	dev->device_name = NULL;
+	dev->trigger_button = -1;
+	dev->toggle_button = -1;
+	return dev;
+}
+
+/**
+ * Free what a binding owns: its sequence and its window target.
+ */
+void free_binding(binding_t* b)
+{
+	if (b->sequence != NULL)
+	{
+		free(b->sequence->events);
+		free((sequence_t*)b->sequence);
+		b->sequence = NULL;
+	}
+	if (b->window != NULL)
+	{
+		free(b->window->value);
+		free(b->window);
+		b->window = NULL;
+	}
+}
+
+/**
+ * Free everything read_opts() allocated for a set of options: the strings from the command line
+ * and the config file, and the bindings' sequences and window targets. The file names of the
+ * alternate modes point into argv and are left alone.
+ */
+void free_opts(opts_t* opts)
+{
+	for (int d = 0; d < opts->num_devices; ++d)
+	{
+		free(opts->devices[d].device_name);
+		opts->devices[d].device_name = NULL;
+	}
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		free_binding(&opts->bindings[i]);
+	}
+	for (int i = 0; i < opts->num_displays; ++i)
+	{
+		free((char*)opts->displays[i].name);
+		free((char*)opts->displays[i].config_filename);
+	}
+	free(opts->stats_filename);
+	free(opts->control_path);
+	opts->stats_filename = NULL;
+	opts->control_path = NULL;
+	opts->num_bindings = 0;
+	opts->num_displays = 0;
+}
+
+/**
+ * Replace one of the options' strings with value, which the options then own. Returns false if
+ * value is NULL, i.e. it couldn't be read or copied.
+ */
+bool replace_opts_string(char** field, char* value)
+{
+	free(*field);
+	*field = value;
+	return value != NULL;
+}
+
+/**
+ * Parse a binding and add it to the current device. Returns false if it's invalid or there's no room.
+ */
+bool add_binding(opts_t* opts, const char* value, const char* config_filename)
+{
+	binding_t b;
+
+	if (!parse_binding(value, config_filename, &b))
+	{
+		return false;
+	}
+	if (opts->num_bindings == MAX_BINDINGS)
+	{
+		fprintf(stderr, "Too many bindings (at most %d)\n", MAX_BINDINGS);
+		free_binding(&b);
+		return false;
+	}
+
+	current_device(opts);
+	b.device = opts->num_devices - 1;
+	opts->bindings[opts->num_bindings++] = b;
+	return true;
+}
+
+/**
+ * Parse a display line, "<display> [config file]", and add it to the displays. Returns false if
+ * it's invalid or there's no room.
+ */
+bool add_display(opts_t* opts, const char* value)
+{
+	size_t start = strspn(value, " \t");
+	size_t len = strcspn(&value[start], " \t#\n");
+
+	if (len == 0)
+	{
+		return false;
+	}
+	if (opts->num_displays == MAX_DISPLAYS)
+	{
+		fprintf(stderr, "Too many displays (at most %d)\n", MAX_DISPLAYS);
+		return false;
+	}
+
+	display_opts_t* disp = &opts->displays[opts->num_displays];
+	disp->name = strndup(&value[start], len);
+	value += start + len;
+	value += strspn(value, " \t");
+	disp->config_filename = copy_config_string(value);
+	if (disp->name == NULL)
+	{
+		free((char*)disp->config_filename);
+		return false;
+	}
+	opts->num_displays++;
+	return true;
+}
+
+/**
+ * Turn each device's trigger and toggle buttons into a binding that clicks click_button every
+ * delay_ns, alongside the explicit bindings. Call once all the options have been read.
+ */
+bool finish_bindings(opts_t* opts)
+{
+	for (int d = 0; d < opts->num_devices; ++d)
+	{
+		const device_opts_t* dev = &opts->devices[d];
+
+		if (dev->trigger_button < 0 && dev->toggle_button < 0)
+		{
+			continue;
+		}
+		if (opts->num_bindings == MAX_BINDINGS)
+		{
+			fprintf(stderr, "Too many bindings (at most %d)\n", MAX_BINDINGS);
+			return false;
+		}
+
+		binding_t* b = &opts->bindings[opts->num_bindings++];
+		b->device = d;
+		b->trigger_button = dev->trigger_button;
+		b->toggle_button = dev->toggle_button;
+		b->click_button = opts->click_button;
+		b->period_ns = opts->delay_ns;
+		b->sequence = NULL;
+		b->window = NULL;
+	}
+
+	// The control socket gets a binding of its own, clicking -b every -d once started
+	if (opts->control_path != NULL)
+	{
+		if (opts->num_bindings == MAX_BINDINGS)
+		{
+			fprintf(stderr, "Too many bindings (at most %d)\n", MAX_BINDINGS);
+			return false;
+		}
+
+		binding_t* b = &opts->bindings[opts->num_bindings++];
+		b->device = REMOTE_DEVICE;
+		b->trigger_button = -1;
+		b->toggle_button = -1;
+		b->click_button = opts->click_button;
+		b->period_ns = opts->delay_ns;
+		b->sequence = NULL;
+		b->window = NULL;
+
+		// A daemon that's only driven through the socket doesn't need a device at all
+		const device_opts_t* dev = &opts->devices[0];
+		if (opts->num_devices == 1 && dev->device_id <= 0 && dev->device_name == NULL &&
+		    dev->trigger_button < 0 && dev->toggle_button < 0)
+		{
+			bool bound = false;
+			for (int i = 0; i < opts->num_bindings; ++i)
+			{
+				bound = bound || opts->bindings[i].device == 0;
+			}
+			if (!bound)
+			{
+				opts->num_devices = 0;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Gross config file parsing logic.
+ *
+ * Don't read this unless you absolutely have to.
+ */
+bool parse_config_lines(FILE* fp, const char* filename, char** line_buf, size_t* line_len, opts_t* opts)
+{
+	int value = -1;
+	int line_num = 0;
+	device_opts_t* dev;
+
+	// Read and process each line
+	while (getline(line_buf, line_len, fp) != -1)
+	{
+		char* line = *line_buf;
+		++line_num;
+		size_t pos;
+		config_type t = get_config_type(line, *line_len, &pos);
+
+		// Read the value for the parameter
+		switch (t)
+		{
+		case DELAY:
+		case DELAY_US:
+			// A config file has never been able to turn the delay off, only the command line
+			if (!parse_interval(&line[pos], t == DELAY ? NS_PER_MS : NS_PER_US, &opts->delay_ns) ||
+			    opts->delay_ns == 0)
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case RATE:
+			if (!parse_rate(&line[pos], &opts->delay_ns))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case CLICK_BUTTON:
+			read_int(opts->click_button);
+			break;
+		case DEV_ID:
+			// Each dev_id or dev_name line after the first starts a new device
+			dev = next_device(opts, false);
+			if (dev == NULL)
+			{
+				return false;
+			}
+			read_int(dev->device_id);
+			break;
+		case TRIGGER_BUTTON:
+			read_int(current_device(opts)->trigger_button);
+			break;
+		case TOGGLE_BUTTON:
+			read_int(current_device(opts)->toggle_button);
+			break;
+		case DEV_NAME:
+		{
+			int i = 0;
+
+			dev = next_device(opts, true);
+			if (dev == NULL)
+			{
+				return false;
+			}
+
+			// Allocate a buffer for the device name and copy the name from the file into it
+			// +1 for null terminator (freed along with the options)
+			dev->device_name = malloc(strlen(&line[pos]) + 1);
+			if (dev->device_name == NULL)
+			{
+				fprintf(stderr, "Memory allocation failed\n");
+				return false;
+			}
+			for (char c = line[pos++]; c != '#' && c != '\n' && c != '\0'; c = line[pos++])
+			{
+				dev->device_name[i++] = c;
+			}
+			dev->device_name[i] = '\0';
+		}
+			break;
+		case INPUT:
+			if (!parse_input_type(&line[pos], &opts->input))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case OVERRUN:
+			if (!parse_overrun_policy(&line[pos], &opts->overrun))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case OUTPUT:
+			if (!parse_output_type(&line[pos], &opts->output))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case BIND:
+			if (!add_binding(opts, &line[pos], filename))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case DISPLAY:
+			if (!add_display(opts, &line[pos]))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case CONTROL:
+			if (!replace_opts_string(&opts->control_path, copy_config_string(&line[pos])))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			break;
+		case STATS_INTERVAL:
+			if (!parse_interval(&line[pos], NS_PER_SEC, &opts->stats_interval_ns))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			opts->loop_stats = true;
+			break;
+		case STATS_FILE:
+			if (!replace_opts_string(&opts->stats_filename, copy_config_string(&line[pos])))
+			{
+				fprintf(stderr, "Config error: Couldn't parse line '%s'\n", line);
+				return false;
+			}
+			opts->loop_stats = true;
+			break;
+		case COMMENT:
+		case BLANK:
+			continue;
+		case INVALID:
+			fprintf(stderr, "Error reading config file on line %d\n", line_num);
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Read the options in a config file on top of the ones already in opts. Returns false, having said
+ * why, if the file can't be read or has a mistake in it.
+ */
+bool parse_config_file(const char* filename, opts_t* opts)
+{
+	FILE* fp = fopen(filename, "r");
+	if (fp == NULL)
+	{
+		fprintf(stderr, "Error opening file %s for reading\n", filename);
+		return false;
+	}
+
+	char* line = NULL;
+	size_t line_len = 0;
+	bool ok = parse_config_lines(fp, filename, &line, &line_len, opts);
+
+	free(line);
+	fclose(fp);
+	return ok;
+}
+
+bool read_opts(int argc, char** argv, opts_t* opts)
+{
+	// Set defaults
+	opts->click_button = 1;
+	opts->delay_ns = 50 * NS_PER_MS;
+	opts->num_devices = 1;
+	opts->devices[0].device_id = -1;
+	opts->devices[0].device_name = NULL;
+	opts->devices[0].trigger_button = -1;
+	opts->devices[0].toggle_button = -1;
+	opts->num_bindings = 0;
+	opts->calibrate_mode = false;
+	opts->calibrate_continuous = false;
+	opts->list_mode = false;
+	opts->latency_stats = false;
+	opts->threads = false;
+	opts->xcb = false;
+	opts->realtime = false;
+	opts->rt_policy = SCHED_FIFO;
+	opts->rt_priority = 10;
+	opts->rt_cpu = -1;
+	opts->loop_stats = false;
+	opts->stats_interval_ns = 0;
+	opts->stats_filename = NULL;
+	opts->control_path = NULL;
+	opts->disable_default_action = true;
+	opts->input = INPUT_XI2;
+	opts->overrun = OVERRUN_CATCHUP;
+	opts->output = OUTPUT_XTEST;
+	opts->record_filename = NULL;
+	opts->replay_filename = NULL;
+	opts->replay_speed = 1.0;
+	opts->num_displays = 0;
+	opts->mock = NULL;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (argv[i][0] == '-')
+		{
+			// Ensure no reading off the end of the array
+			switch (argv[i][1])
+			{
+			case 'd':
+			case 'r':
+			case 'b':
 			case 't':
 			case 'g':
 			case 'i':
@@ -478,144 +6059,1873 @@ bool read_opts(int argc, char** argv, opts_t* opts)
 			case 'f':
 				if (i == argc - 1)
 				{
-					fprintf(stderr, "Parameter for %s missing\n", argv[i]);
-					return false;
+					fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+					return false;
+				}
+				break;
+			}
+			// Parse flag
+			switch (argv[i][1])
+			{
+			case 'd':  // Delay
+				if (!parse_interval(argv[++i], NS_PER_MS, &opts->delay_ns))
+				{
+					return false;
+				}
+				break;
+			case 'r':  // Rate
+				if (!parse_rate(argv[++i], &opts->delay_ns))
+				{
+					return false;
+				}
+				break;
+			case 'b':  // Button
+				opts->click_button = strtol(argv[++i], NULL, 10);
+				break;
+			case 't':  // Trigger
+				current_device(opts)->trigger_button = strtol(argv[++i], NULL, 10);
+				break;
+			case 'g':  // Toggle
+				current_device(opts)->toggle_button = strtol(argv[++i], NULL, 10);
+				break;
+			case 'i':  // Device ID; each one after the first starts a new device
+			{
+				device_opts_t* dev = next_device(opts, false);
+				if (dev == NULL)
+				{
+					return false;
+				}
+				dev->device_id = strtol(argv[++i], NULL, 10);
+				break;
+			}
+			case 'n':  // Device name
+			{
+				device_opts_t* dev = next_device(opts, true);
+				if (dev == NULL)
+				{
+					return false;
+				}
+				dev->device_name = strdup(argv[++i]);
+				if (dev->device_name == NULL)
+				{
+					return false;
+				}
+				break;
+			}
+			case 'f':  // Config file name
+				opts->config_filename = argv[++i];
+				return parse_config_file(opts->config_filename, opts);
+			case '-':
+				if (strcmp(argv[i], "--calibrate") == 0)
+				{
+					opts->calibrate_mode = true;
+					// Calibrate mode overrides other options
+					return true;
+				}
+				else if (strcmp(argv[i], "--calibrate-continuous") == 0)
+				{
+					opts->calibrate_mode = true;
+					opts->calibrate_continuous = true;
+					return true;
+				}
+				else if (strcmp(argv[i], "--list") == 0)
+				{
+					opts->list_mode = true;
+					// List mode overrides other options
+					return true;
+				}
+				else if (strcmp(argv[i], "--no-disable-default") == 0)
+				{
+					opts->disable_default_action = false;
+					break;
+				}
+				else if (strcmp(argv[i], "--threads") == 0)
+				{
+					opts->threads = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--realtime") == 0)
+				{
+					opts->realtime = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--rt-policy") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!parse_rt_policy(argv[++i], &opts->rt_policy))
+					{
+						return false;
+					}
+					opts->realtime = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--rt-priority") == 0 || strcmp(argv[i], "--cpu") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+
+					bool priority = strcmp(argv[i], "--rt-priority") == 0;
+					char* end;
+					long value = strtol(argv[++i], &end, 10);
+					if (end == argv[i] || *end != '\0' || (priority && (value < 1 || value > 99)) ||
+					    (!priority && (value < 0 || value >= CPU_SETSIZE)))
+					{
+						fprintf(stderr, "Invalid %s '%s'\n", priority ? "realtime priority" : "CPU", argv[i]);
+						return false;
+					}
+					*(priority ? &opts->rt_priority : &opts->rt_cpu) = (int)value;
+					opts->realtime = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--latency") == 0)
+				{
+					opts->latency_stats = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--stats") == 0)
+				{
+					opts->loop_stats = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--stats-interval") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!parse_interval(argv[++i], NS_PER_SEC, &opts->stats_interval_ns))
+					{
+						return false;
+					}
+					opts->loop_stats = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--stats-file") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!replace_opts_string(&opts->stats_filename, strdup(argv[++i])))
+					{
+						return false;
+					}
+					opts->loop_stats = true;
+					break;
+				}
+				else if (strcmp(argv[i], "--input") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!parse_input_type(argv[++i], &opts->input))
+					{
+						return false;
+					}
+					break;
+				}
+				else if (strcmp(argv[i], "--overrun") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!parse_overrun_policy(argv[++i], &opts->overrun))
+					{
+						return false;
+					}
+					break;
+				}
+				else if (strcmp(argv[i], "--control") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!replace_opts_string(&opts->control_path, strdup(argv[++i])))
+					{
+						return false;
+					}
+					break;
+				}
+				else if (strcmp(argv[i], "--bind") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!add_binding(opts, argv[++i], NULL))
+					{
+						return false;
+					}
+					break;
+				}
+				else if (strcmp(argv[i], "--record") == 0 || strcmp(argv[i], "--replay") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					*(strcmp(argv[i], "--record") == 0 ? &opts->record_filename : &opts->replay_filename) = argv[i + 1];
+					++i;
+					break;
+				}
+				else if (strcmp(argv[i], "--xcb") == 0)
+				{
+#ifdef HAVE_XCB
+					opts->xcb = true;
+					break;
+#else
+					fprintf(stderr, "This build doesn't include XCB support (build with make XCB=1)\n");
+					return false;
+#endif
+				}
+				else if (strcmp(argv[i], "--speed") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					char* end;
+					opts->replay_speed = strtod(argv[++i], &end);
+					if (end == argv[i] || *end != '\0' || !(opts->replay_speed > 0) || isinf(opts->replay_speed))
+					{
+						fprintf(stderr, "Invalid replay speed '%s'\n", argv[i]);
+						return false;
+					}
+					break;
+				}
+				else if (strcmp(argv[i], "--display") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!add_display(opts, argv[++i]))
+					{
+						fprintf(stderr, "Invalid display '%s'\n", argv[i]);
+						return false;
+					}
+					break;
+				}
+				else if (strcmp(argv[i], "--output") == 0)
+				{
+					if (i == argc - 1)
+					{
+						fprintf(stderr, "Parameter for %s missing\n", argv[i]);
+						return false;
+					}
+					if (!parse_output_type(argv[++i], &opts->output))
+					{
+						return false;
+					}
+					break;
+				}
+				fprintf(stderr, "Unknown option %s\n", argv[i]);
+				return false;
+			default:
+				fprintf(stderr, "Unknown option %s\n", argv[i]);
+				return false;
+			}
+		}
+		else
+		{
+			fprintf(stderr, "Unknown option %s\n", argv[i]);
+			return false;
+		}
+	}
+	return true;
+}
+
+void usage(const char* prog_name)
+{
+	printf(
+	    "Usage: %s [-d delay | -r rate] [-b click_button] [--no-disable-default] [--input xi2|xi1|evdev] [--overrun catchup|skip] [--output xtest|uinput] [--latency] [--stats] [--stats-interval s] [--stats-file path] [--control path] [--threads] [--xcb] [--realtime [--rt-policy fifo|rr] [--rt-priority n] [--cpu n]] <-t trigger_button | -g toggle_button | --bind binding> <-i device_id | -n device_name> [<-i device_id | -n device_name> <-t trigger_button | -g toggle_button | --bind binding> ...]\n"
+	    "       or\n"
+	    "       %s <-f path_to_config_file>\n"
+	    "       or\n"
+	    "       %s --calibrate | --calibrate-continuous\n"
+	    "       or\n"
+	    "       %s --list\n"
+	    "       or\n"
+	    "       %s --record file <-i device_id | -n device_name>\n"
+	    "       or\n"
+	    "       %s --replay file [--speed factor] [--output xtest|uinput]\n"
+	    "       or\n"
+	    "       %s --display display [--display display ...] [options as above]\n"
+	    "\n"
+	    "Options:\n"
+	    "  -d delay                 Delay between clicks in ms, or with a unit: 0.25ms, 250us (default: 50)\n"
+	    "  -r rate                  Clicks per second (alternative to -d)\n"
+	    "  -b click_button          Button ID to click (default: 1)\n"
+	    "  -t trigger_button        Button ID that triggers clicks while held\n"
+	    "  -g toggle_button         Button ID that toggles clicking on/off\n"
+	    "  -i device_id             Device ID for the pointing device\n"
+	    "  -n device_name           Device name for the pointing device\n"
+	    "  -f config_file           Path to configuration file\n"
+	    "  --bind mode:button:click_button:cadence\n"
+	    "                           Bind a button on the current device to its own clicks, e.g.\n"
+	    "                           hold:9:1:20cps or toggle:8:3:200ms, or play a sequence file\n"
+	    "                           with mode:button:sequence:file; add :at:x,y:x,y... to click\n"
+	    "                           at each point in turn\n"
+	    "  --no-disable-default     Don't disable button's default action\n"
+	    "  --input xi2|xi1|evdev    How to watch the buttons: XI2 events (default), XI1 polling,\n"
+	    "                           or /dev/input directly (needs -n)\n"
+	    "  --overrun catchup|skip   Burst missed clicks (default) or drop them when running late\n"
+	    "  --output xtest|uinput    Click through XTest (default) or a /dev/uinput virtual mouse\n"
+	    "  --latency                Print click latency histograms on exit and on SIGUSR1\n"
+	    "  --stats                  Print loop statistics on exit and on SIGUSR1\n"
+	    "  --stats-interval seconds Also print the statistics periodically (implies --stats)\n"
+	    "  --stats-file path        Append the statistics to a file instead of stderr (implies --stats)\n"
+	    "  --threads                Watch the buttons on a separate thread from the clicks\n"
+	    "  --xcb                    Query buttons and send XTest clicks through XCB, pipelined (needs make XCB=1)\n"
+	    "  --realtime               Realtime priority and minimal timer slack for the clicks, and locked memory\n"
+	    "                           (mlockall, which covers the whole process)\n"
+	    "  --rt-policy fifo|rr      Realtime scheduling policy (default fifo, implies --realtime)\n"
+	    "  --rt-priority n          Realtime priority, 1-99 (default 10, implies --realtime)\n"
+	    "  --cpu n                  Pin the clicking thread to a CPU (implies --realtime)\n"
+	    "  --control path           Accept start/stop/rate/interval/button/status commands on a Unix socket\n"
+	    "  --calibrate              Interactive mode to identify button IDs\n"
+	    "  --calibrate-continuous   Keep identifying buttons until interrupted\n"
+	    "  --list                   List all pointing devices\n"
+	    "  --record file            Record the device's buttons and motion until interrupted\n"
+	    "  --replay file            Play a recording back through the output\n"
+	    "  --speed factor           Replay this many times as fast as recorded (default: 1)\n"
+	    "  --display \"display [config_file]\"\n"
+	    "                           Click on this X display, with the options from config_file or\n"
+	    "                           else the main ones; repeat for more displays in one process\n"
+	    "\n"
+	    "Notes:\n"
+	    "  - At least one of -t, -g or --bind is required\n"
+	    "  - Both -t and -g can be used together (must be different buttons)\n"
+	    "  - Trigger button (-t): Clicks while the button is held down\n"
+	    "  - Toggle button (-g): First press starts clicking, second press stops\n"
+	    "  - Repeat -i/-n to watch more devices; the -t/-g/--bind after each one apply to that device\n",
+	    prog_name,
+	    prog_name,
+	    prog_name,
+	    prog_name,
+	    prog_name,
+	    prog_name,
+	    prog_name);
+}
+
+/**
+ * Look up each device's ID from its name or, for evdev input, its name from its ID.
+ */
+bool resolve_devices(Display* display, opts_t* opts)
+{
+	for (int d = 0; d < opts->num_devices; ++d)
+	{
+		device_opts_t* dev = &opts->devices[d];
+
+		// If device name is specified, convert to device ID
+		if (dev->device_name != NULL)
+		{
+			if (opts->input != INPUT_EVDEV)
+			{
+				dev->device_id = get_device_id_from_name(display, dev->device_name);
+				if (dev->device_id < 0)
+				{
+					fprintf(stderr, "Device '%s' not found. Use --list to see available devices.\n", dev->device_name);
+					return false;
+				}
+			}
+		}
+		else if (opts->input == INPUT_EVDEV && dev->device_id >= 0)
+		{
+			// evdev devices are found by name
+			dev->device_name = get_device_name_from_id(display, dev->device_id);
+			if (dev->device_name == NULL)
+			{
+				fprintf(stderr, "Device %d not found. Use --list to see available devices.\n", dev->device_id);
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**
+ * Check that every device is identified and has something bound to it.
+ */
+bool validate_opts(const opts_t* opts)
+{
+	for (int d = 0; d < opts->num_devices; ++d)
+	{
+		const device_opts_t* dev = &opts->devices[d];
+
+		if (dev->device_id < 0 && dev->device_name == NULL)
+		{
+			fprintf(stderr, "Error: Device ID or device name is required\n");
+			return false;
+		}
+
+		bool bound = false;
+		for (int i = 0; i < opts->num_bindings; ++i)
+		{
+			bound = bound || opts->bindings[i].device == d;
+		}
+		if (!bound)
+		{
+			fprintf(stderr, "Error: At least one of -t (trigger), -g (toggle) or --bind is required for each device\n");
+			return false;
+		}
+
+		// Validate that trigger and toggle buttons are different if both specified
+		if (dev->trigger_button >= 0 && dev->toggle_button >= 0 &&
+		    dev->trigger_button == dev->toggle_button)
+		{
+			fprintf(stderr, "Error: Trigger button (-t) and toggle button (-g) must be different\n");
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * How often XI1 polling checks the buttons: as often as the fastest binding clicks.
+ */
+uint64_t poll_interval(const opts_t* opts)
+{
+	uint64_t poll_ns = UINT64_MAX;
+
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		if (opts->bindings[i].period_ns < poll_ns)
+		{
+			poll_ns = opts->bindings[i].period_ns;
+		}
+	}
+	return poll_ns;
+}
+
+/**
+ * Whether two device options refer to the same device, by name if both have one, else by ID.
+ */
+bool same_device(const device_opts_t* a, const device_opts_t* b)
+{
+	if (a->device_name != NULL && b->device_name != NULL)
+	{
+		return strcmp(a->device_name, b->device_name) == 0;
+	}
+	return a->device_id == b->device_id;
+}
+
+/**
+ * Check whether the running daemon can switch from old_opts to new_opts without reopening
+ * anything. Devices, the input and output backends, the default action grabs, the stats file and
+ * the control socket are fixed for the life of the process.
+ */
+bool reload_compatible(const opts_t* old_opts, const opts_t* new_opts)
+{
+	bool same_devices = old_opts->num_devices == new_opts->num_devices;
+
+	for (int d = 0; same_devices && d < new_opts->num_devices; ++d)
+	{
+		same_devices = same_device(&old_opts->devices[d], &new_opts->devices[d]);
+	}
+
+	const char* changed = NULL;
+	if (!same_devices)
+	{
+		changed = "devices";
+	}
+	else if (old_opts->input != new_opts->input)
+	{
+		changed = "input method";
+	}
+	else if (old_opts->output != new_opts->output)
+	{
+		changed = "output backend";
+	}
+	else if (old_opts->disable_default_action != new_opts->disable_default_action)
+	{
+		changed = "default action setting";
+	}
+	else if (old_opts->realtime != new_opts->realtime ||
+	         (new_opts->realtime && (old_opts->rt_policy != new_opts->rt_policy ||
+	                                 old_opts->rt_priority != new_opts->rt_priority || old_opts->rt_cpu != new_opts->rt_cpu)))
+	{
+		// They're applied to the clicking thread once, at startup
+		changed = "realtime settings";
+	}
+	else if ((old_opts->stats_filename == NULL) != (new_opts->stats_filename == NULL) ||
+	         (old_opts->stats_filename != NULL && strcmp(old_opts->stats_filename, new_opts->stats_filename) != 0))
+	{
+		changed = "stats file";
+	}
+	else if ((old_opts->control_path == NULL) != (new_opts->control_path == NULL) ||
+	         (old_opts->control_path != NULL && strcmp(old_opts->control_path, new_opts->control_path) != 0))
+	{
+		changed = "control socket";
+	}
+
+	if (changed != NULL)
+	{
+		fprintf(stderr, "Changing the %s needs a restart\n", changed);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Return whether two compiled sequences play back exactly the same.
+ */
+bool sequences_equal(const sequence_t* a, const sequence_t* b)
+{
+	if (a->num_events != b->num_events || a->length_ns != b->length_ns || a->min_gap_ns != b->min_gap_ns ||
+	    a->moves != b->moves)
+	{
+		return false;
+	}
+	for (int i = 0; i < a->num_events; ++i)
+	{
+		const seq_event_t* x = &a->events[i];
+		const seq_event_t* y = &b->events[i];
+
+		if (x->offset_ns != y->offset_ns || x->button != y->button || x->action != y->action ||
+		    x->moves != y->moves || x->x != y->x || x->y != y->y)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Hand each of new_opts' sequences that's the same as the one its binding already plays over to
+ * the old sequence, so carry_over_streams() lets it carry on where it is instead of starting from
+ * the top. The old options get the new copy in exchange, and free it along with themselves.
+ */
+void keep_unchanged_sequences(opts_t* old_opts, opts_t* new_opts)
+{
+	bool taken[MAX_BINDINGS] = {false};
+
+	for (int i = 0; i < new_opts->num_bindings; ++i)
+	{
+		binding_t* b = &new_opts->bindings[i];
+
+		for (int j = 0; j < old_opts->num_bindings; ++j)
+		{
+			binding_t* old = &old_opts->bindings[j];
+
+			// Matched the same way as in carry_over_streams()
+			if (!taken[j] && old->device == b->device && old->trigger_button == b->trigger_button &&
+			    old->toggle_button == b->toggle_button)
+			{
+				taken[j] = true;
+				if (b->sequence != NULL && old->sequence != NULL && sequences_equal(old->sequence, b->sequence))
+				{
+					const sequence_t* seq = b->sequence;
+					b->sequence = old->sequence;
+					old->sequence = seq;
 				}
 				break;
 			}
-			// Parse flag
-			switch (argv[i][1])
+		}
+	}
+}
+
+/**
+ * Set up the click streams for new_opts, carrying each one over from the old binding with the
+ * same device, trigger and toggle buttons, if there is one. Held triggers, active toggles and
+ * running streams survive the switch; only the click button and cadence change.
+ *
+ * A drag that doesn't carry on into the new streams, because its binding is gone or plays another
+ * sequence now, has its button let go through out.
+ */
+void carry_over_streams(const opts_t* old_opts,
+                        const click_stream_t* old_streams,
+                        const opts_t* new_opts,
+                        click_stream_t* new_streams,
+                        output_t* out)
+{
+	bool taken[MAX_BINDINGS] = {false};
+	bool continued[MAX_BINDINGS] = {false};
+
+	for (int i = 0; i < new_opts->num_bindings; ++i)
+	{
+		const binding_t* b = &new_opts->bindings[i];
+
+		memset(&new_streams[i], 0, sizeof(new_streams[i]));
+		for (int j = 0; j < old_opts->num_bindings; ++j)
+		{
+			const binding_t* old = &old_opts->bindings[j];
+
+			if (!taken[j] && old->device == b->device && old->trigger_button == b->trigger_button &&
+			    old->toggle_button == b->toggle_button)
+			{
+				new_streams[i] = old_streams[j];
+				taken[j] = true;
+				continued[j] = b->sequence == old_streams[j].sched.seq;
+				break;
+			}
+		}
+		new_streams[i].sched.period_ns = b->period_ns;
+		new_streams[i].sched.policy = new_opts->overrun;
+
+		// A new sequence starts from the top at the next deadline
+		if (new_streams[i].sched.seq != b->sequence)
+		{
+			new_streams[i].pressed_button = 0;
+			new_streams[i].sched.seq = b->sequence;
+			new_streams[i].sched.seq_pos = 0;
+			new_streams[i].sched.pass_ns = new_streams[i].sched.next_ns;
+			if (b->sequence != NULL)
+			{
+				new_streams[i].sched.next_ns += b->sequence->events[0].offset_ns;
+			}
+		}
+	}
+
+	for (int j = 0; j < old_opts->num_bindings; ++j)
+	{
+		if (!continued[j] && old_streams[j].pressed_button != 0)
+		{
+			emit_button(out, old_streams[j].pressed_button, false);
+		}
+	}
+}
+
+/**
+ * Watch the config file for changes. Returns false if it can't be watched.
+ *
+ * Editors often save by writing a new file and renaming it over the old one, which a watch on
+ * the file itself would miss, so this watches the directory and picks out the file's name.
+ */
+bool watch_config_file(config_watch_t* watch, const char* filename)
+{
+	char* path = strdup(filename);
+	char* dir_path = strdup(filename);
+
+	watch->fd = -1;
+	if (path == NULL || dir_path == NULL)
+	{
+		fprintf(stderr, "Memory allocation failed\n");
+		free(path);
+		free(dir_path);
+		return false;
+	}
+
+	snprintf(watch->name, sizeof(watch->name), "%s", basename(path));
+	watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->fd < 0 || inotify_add_watch(watch->fd, dirname(dir_path), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		fprintf(stderr, "Cannot watch %s for changes: %s\n", filename, strerror(errno));
+		if (watch->fd >= 0)
+		{
+			close(watch->fd);
+			watch->fd = -1;
+		}
+	}
+
+	free(path);
+	free(dir_path);
+	return watch->fd >= 0;
+}
+
+/**
+ * Read all the pending inotify events. Returns true if any of them were for the config file.
+ */
+bool config_file_changed(config_watch_t* watch)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	bool changed = false;
+	ssize_t len;
+
+	while ((len = read(watch->fd, buf, sizeof(buf))) > 0)
+	{
+		for (char* p = buf; p < buf + len;)
+		{
+			const struct inotify_event* ev = (const struct inotify_event*)p;
+
+			if (ev->len > 0 && strcmp(ev->name, watch->name) == 0)
+			{
+				changed = true;
+			}
+			p += sizeof(*ev) + ev->len;
+		}
+	}
+	return changed;
+}
+
+/**
+ * Index of the binding that the control socket drives, or -1 if there isn't one.
+ */
+int remote_binding(const opts_t* opts)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		if (opts->bindings[i].device == REMOTE_DEVICE)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * Switch a binding's clicking on or off from outside, as if its toggle button had been pressed.
+ */
+void set_remote_clicking(click_state_t* state, bool on, uint64_t time_ns)
+{
+	if (state->toggle_active == on)
+	{
+		return;
+	}
+
+	state->toggle_active = on;
+	state->toggles++;
+	if (on)
+	{
+		state->start_ns = time_ns;
+	}
+	else
+	{
+		state->stop_ns = time_ns;
+	}
+}
+
+/**
+ * Carry out one command line from the control socket, and write the reply into reply.
+ *
+ * Commands are "start", "stop", "rate <cps>", "interval <interval>", "button <button>" and
+ * "status". Replies are "ok", "error <reason>" or, for status, a line of key=value pairs.
+ */
+void handle_control_command(const char* line,
+                            opts_t* opts,
+                            click_stream_t* streams,
+                            uint64_t time_ns,
+                            char* reply,
+                            size_t reply_len)
+{
+	int r = remote_binding(opts);
+	size_t cmd_len = strcspn(line, " \t");
+	const char* arg = line + cmd_len + strspn(line + cmd_len, " \t");
+	uint64_t period_ns;
+
+	if (r < 0)
+	{
+		snprintf(reply, reply_len, "error no remote binding");
+		return;
+	}
+
+	binding_t* b = &opts->bindings[r];
+	click_stream_t* stream = &streams[r];
+
+	if (value_is(line, "start"))
+	{
+		set_remote_clicking(&stream->state, true, time_ns);
+	}
+	else if (value_is(line, "stop"))
+	{
+		set_remote_clicking(&stream->state, false, time_ns);
+	}
+	else if (value_is(line, "rate"))
+	{
+		if (!parse_rate(arg, &period_ns))
+		{
+			snprintf(reply, reply_len, "error invalid rate");
+			return;
+		}
+		b->period_ns = stream->sched.period_ns = period_ns;
+	}
+	else if (value_is(line, "interval"))
+	{
+		if (!parse_interval(arg, NS_PER_MS, &period_ns))
+		{
+			snprintf(reply, reply_len, "error invalid interval");
+			return;
+		}
+		b->period_ns = stream->sched.period_ns = period_ns;
+	}
+	else if (value_is(line, "button"))
+	{
+		struct input_event ev;
+		char* end;
+		long button = strtol(arg, &end, 10);
+
+		if (end == arg || !value_is(end, "") || button < 1 || button > 255 ||
+		    (opts->output == OUTPUT_UINPUT && !x_button_to_evdev((int)button, &ev)))
+		{
+			snprintf(reply, reply_len, "error invalid button");
+			return;
+		}
+		b->click_button = (int)button;
+	}
+	else if (value_is(line, "status"))
+	{
+		snprintf(reply,
+		         reply_len,
+		         "clicking=%d button=%d interval_ns=%" PRIu64 " clicks=%" PRIu64,
+		         should_click(&stream->state),
+		         b->click_button,
+		         b->period_ns,
+		         stream->clicks);
+		return;
+	}
+	else
+	{
+		snprintf(reply, reply_len, "error unknown command");
+		return;
+	}
+	snprintf(reply, reply_len, "ok");
+}
+
+void close_control(control_t* ctl);
+
+/**
+ * Listen for commands on a Unix socket at path. Returns false if the socket can't be set up.
+ *
+ * A stale socket left behind by an earlier run is replaced, but any other kind of file at path
+ * is left alone. Only our own user can connect.
+ */
+bool open_control(control_t* ctl, const char* path)
+{
+	struct sockaddr_un addr;
+	struct stat st;
+
+	ctl->listen_fd = -1;
+	ctl->epoll_fd = -1;
+	ctl->path = path;
+	for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i)
+	{
+		ctl->clients[i].fd = -1;
+		ctl->clients[i].len = 0;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		fprintf(stderr, "Control socket path %s is too long\n", path);
+		return false;
+	}
+	strcpy(addr.sun_path, path);
+
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+	{
+		unlink(path);
+	}
+
+	ctl->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (ctl->listen_fd < 0)
+	{
+		fprintf(stderr, "Cannot create control socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Create the socket file without group or other access, rather than chmod after the fact
+	mode_t old_umask = umask(0177);
+	int bound = bind(ctl->listen_fd, (struct sockaddr*)&addr, sizeof(addr));
+	umask(old_umask);
+
+	if (bound < 0 || listen(ctl->listen_fd, MAX_CONTROL_CLIENTS) < 0)
+	{
+		fprintf(stderr, "Cannot listen on %s: %s\n", path, strerror(errno));
+		close(ctl->listen_fd);
+		ctl->listen_fd = -1;
+		return false;
+	}
+
+	struct epoll_event ep = {EPOLLIN, {.fd = ctl->listen_fd}};
+	ctl->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (ctl->epoll_fd < 0 || epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, ctl->listen_fd, &ep) < 0)
+	{
+		fprintf(stderr, "Cannot set up epoll: %s\n", strerror(errno));
+		close_control(ctl);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Disconnect a control client.
+ */
+void close_control_client(control_client_t* client)
+{
+	close(client->fd);
+	client->fd = -1;
+	client->len = 0;
+}
+
+/**
+ * Accept new control connections and carry out every complete command line that has arrived.
+ *
+ * All the sockets are non-blocking, so this only ever handles what's already there and never
+ * holds up the clicks. Replies go out with MSG_NOSIGNAL so a client that hung up early can't
+ * kill the daemon with SIGPIPE.
+ */
+void process_control(control_t* ctl, opts_t* opts, click_stream_t* streams, uint64_t time_ns)
+{
+	int fd;
+
+	while ((fd = accept4(ctl->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
+	{
+		int slot = -1;
+		for (int i = 0; i < MAX_CONTROL_CLIENTS && slot < 0; ++i)
+		{
+			if (ctl->clients[i].fd < 0)
+			{
+				slot = i;
+			}
+		}
+
+		if (slot < 0)
+		{
+			static const char busy[] = "error too many clients\n";
+			send(fd, busy, sizeof(busy) - 1, MSG_NOSIGNAL);
+			close(fd);
+			continue;
+		}
+
+		// Closing the client's fd takes it out of the epoll set again
+		struct epoll_event ep = {EPOLLIN, {.fd = fd}};
+		if (epoll_ctl(ctl->epoll_fd, EPOLL_CTL_ADD, fd, &ep) < 0)
+		{
+			fprintf(stderr, "Cannot set up epoll: %s\n", strerror(errno));
+			close(fd);
+			continue;
+		}
+		ctl->clients[slot].fd = fd;
+		ctl->clients[slot].len = 0;
+	}
+
+	for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i)
+	{
+		control_client_t* client = &ctl->clients[i];
+
+		while (client->fd >= 0)
+		{
+			ssize_t len = recv(client->fd, client->buf + client->len, sizeof(client->buf) - 1 - client->len, 0);
+
+			if (len < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+			{
+				break;
+			}
+			if (len <= 0)
+			{
+				close_control_client(client);
+				break;
+			}
+			client->len += len;
+			client->buf[client->len] = '\0';
+
+			// Carry out each complete line and keep the rest for later
+			char* line = client->buf;
+			char* newline;
+			while ((newline = strchr(line, '\n')) != NULL)
+			{
+				char reply[128];
+
+				// Scripts talking through socat or nc may send CRLF
+				*newline = '\0';
+				if (newline > line && newline[-1] == '\r')
+				{
+					newline[-1] = '\0';
+				}
+				handle_control_command(line, opts, streams, time_ns, reply, sizeof(reply) - 1);
+				strcat(reply, "\n");
+				send(client->fd, reply, strlen(reply), MSG_NOSIGNAL);
+				line = newline + 1;
+			}
+			client->len -= line - client->buf;
+			memmove(client->buf, line, client->len + 1);
+
+			if (client->len == sizeof(client->buf) - 1)
+			{
+				static const char too_long[] = "error line too long\n";
+				send(client->fd, too_long, sizeof(too_long) - 1, MSG_NOSIGNAL);
+				close_control_client(client);
+			}
+		}
+	}
+}
+
+/**
+ * Disconnect every client, stop listening and remove the socket file.
+ */
+void close_control(control_t* ctl)
+{
+	if (ctl->listen_fd < 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < MAX_CONTROL_CLIENTS; ++i)
+	{
+		if (ctl->clients[i].fd >= 0)
+		{
+			close_control_client(&ctl->clients[i]);
+		}
+	}
+
+	close(ctl->listen_fd);
+	ctl->listen_fd = -1;
+	unlink(ctl->path);
+
+	if (ctl->epoll_fd >= 0)
+	{
+		close(ctl->epoll_fd);
+		ctl->epoll_fd = -1;
+	}
+}
+
+/**
+ * Re-read the options after the config file changed, and switch the running loop over to them.
+ *
+ * The new options are read into a separate snapshot and only replace the running ones once
+ * everything about them has been checked, so an invalid file leaves the daemon as it was. out
+ * lets go of any drags the switch cuts short.
+ *
+ * The replaced options are freed, unless old_opts isn't NULL, in which case they're moved there
+ * for the caller to finish with and free_opts().
+ */
+bool reload_opts(int argc, char** argv, opts_t* opts, input_t* in, output_t* out, click_stream_t* streams, opts_t* old_opts)
+{
+	opts_t next;
+	click_stream_t next_streams[MAX_BINDINGS];
+
+	memset(&next, 0, sizeof(next));
+	bool ok = read_opts(argc, argv, &next) && finish_bindings(&next) && validate_opts(&next) &&
+	          reload_compatible(opts, &next);
+	for (int i = 0; ok && next.output == OUTPUT_UINPUT && i < next.num_bindings; ++i)
+	{
+		ok = check_uinput_buttons(&next.bindings[i]);
+	}
+
+	// The devices are the same ones, so keep the IDs they were resolved to
+	for (int d = 0; ok && d < next.num_devices; ++d)
+	{
+		next.devices[d].device_id = opts->devices[d].device_id;
+	}
+	if (!ok || !update_bound_buttons(in, &next))
+	{
+		free_opts(&next);
+		return false;
+	}
+
+	// ...and the names, which the old options hand over in exchange for the new ones' copies
+	for (int d = 0; d < next.num_devices; ++d)
+	{
+		char* name = next.devices[d].device_name;
+		next.devices[d].device_name = opts->devices[d].device_name;
+		opts->devices[d].device_name = name;
+	}
+
+	keep_unchanged_sequences(opts, &next);
+	carry_over_streams(opts, streams, &next, next_streams, out);
+	if (old_opts != NULL)
+	{
+		*old_opts = *opts;
+	}
+	else
+	{
+		free_opts(opts);
+	}
+	*opts = next;
+	memcpy(streams, next_streams, sizeof(next_streams[0]) * next.num_bindings);
+
+	// Pick up buttons that were already held when they were bound
+	sync_input(in, opts, streams);
+	return true;
+}
+
+/**
+ * Put the calling thread into realtime mode as far as our privileges allow.
+ *
+ * Each setting that can't be applied is reported and skipped, and the rest still take effect, so
+ * an unprivileged user gets whatever they're allowed (typically just the timer slack).
+ */
+void apply_realtime(const opts_t* opts, realtime_status_t* status)
+{
+	struct sched_param param = {.sched_priority = opts->rt_priority};
+	int err = pthread_setschedparam(pthread_self(), opts->rt_policy, &param);
+
+	status->sched = err == 0;
+	if (err != 0)
+	{
+		fprintf(stderr, "Cannot set realtime scheduling: %s\n", strerror(err));
+	}
+
+	// Fault everything in now, so page faults don't turn up as click jitter later. Unlike the
+	// rest, this is for the whole process, input thread included
+	status->mlock = mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+	if (!status->mlock)
+	{
+		fprintf(stderr, "Cannot lock memory: %s\n", strerror(errno));
+	}
+
+	status->affinity = false;
+	if (opts->rt_cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(opts->rt_cpu, &cpus);
+		err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		status->affinity = err == 0;
+		if (err != 0)
+		{
+			fprintf(stderr, "Cannot pin to CPU %d: %s\n", opts->rt_cpu, strerror(err));
+		}
+	}
+
+	// Timers may fire up to the slack late so the kernel can batch wakeups (50 us by default)
+	status->slack = prctl(PR_SET_TIMERSLACK, 1UL, 0UL, 0UL, 0UL) == 0;
+	if (!status->slack)
+	{
+		fprintf(stderr, "Cannot set timer slack: %s\n", strerror(errno));
+	}
+}
+
+/**
+ * Reload the options while the buttons are watched on an input thread.
+ *
+ * The input thread is held off for the duration. Its button state is carried over to the new
+ * bindings by reload_opts(), and the clicking thread's streams the same way, so the two stay in
+ * step; any buttons that changed meanwhile are queued as usual.
+ */
+bool reload_threaded_opts(input_thread_t* t, int argc, char** argv, opts_t* opts, output_t* out, click_stream_t* streams)
+{
+	opts_t old_opts;
+	click_stream_t next_streams[MAX_BINDINGS];
+
+	pthread_mutex_lock(&t->lock);
+
+	// Catch up on everything that was queued under the old bindings first
+	receive_click_events(t, streams);
+	// The input thread's streams never hold a drag's button, only the clicking thread's do
+	bool reloaded = reload_opts(argc, argv, opts, t->in, out, t->streams, &old_opts);
+	if (reloaded)
+	{
+		carry_over_streams(&old_opts, streams, opts, next_streams, out);
+		free_opts(&old_opts);
+		memcpy(streams, next_streams, sizeof(next_streams[0]) * opts->num_bindings);
+
+		t->poll_ns = poll_interval(opts);
+		t->published = 0;
+		for (int i = 0; i < opts->num_bindings; ++i)
+		{
+			if (should_click(&streams[i].state))
+			{
+				t->published |= 1ULL << i;
+			}
+		}
+		publish_click_state(t);
+	}
+
+	pthread_mutex_unlock(&t->lock);
+	return reloaded;
+}
+
+/**
+ * Send one step of a stream's due clicks, and count it.
+ */
+void emit_due_step(output_t* out, const binding_t* b, click_stream_t* stream, const seq_event_t* step, loop_stats_t* stats, latency_t* latency)
+{
+	uint64_t stage_ns = monotonic_ns();
+	if (b->window != NULL)
+	{
+		emit_window_click(out, b->window, step->button);
+	}
+	else
+	{
+		emit_step(out, step);
+	}
+	uint64_t click_ns = stage_end(&stats->emit, stage_ns);
+	if (step->action == SEQ_PRESS || step->action == SEQ_RELEASE)
+	{
+		stream->pressed_button = step->action == SEQ_PRESS ? step->button : 0;
+	}
+	if (step->action == SEQ_MOVE)
+	{
+		return;
+	}
+	stats->clicks++;
+	stream->clicks++;
+	if (latency != NULL)
+	{
+		latency_click(latency, stream, click_ns);
+	}
+}
+
+/**
+ * One turn of the click loop, once the input is up to date: start and stop each binding's clicks
+ * as its buttons ask, and send whatever is due at now_ns, earliest deadline first. Returns the
+ * next deadline of any running stream, or 0 if none are running.
+ *
+ * latency is NULL unless --latency was given.
+ */
+uint64_t run_clicks(const opts_t* opts, click_stream_t* streams, output_t* out, uint64_t now_ns, loop_stats_t* stats, latency_t* latency)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		click_stream_t* stream = &streams[i];
+
+		if (should_click(&stream->state) && !stream->clicking)
+		{
+			sched_start(&stream->sched, now_ns);
+			stream->first_click_pending = true;
+			stream->clicking = true;
+		}
+		else if (!should_click(&stream->state) && stream->clicking)
+		{
+			if (latency != NULL)
+			{
+				latency_stop(latency, stream);
+			}
+			stream->clicking = false;
+
+			// Stopping part way through a drag lets go of its button
+			if (stream->pressed_button != 0)
+			{
+				emit_button(out, stream->pressed_button, false);
+				stream->pressed_button = 0;
+			}
+		}
+	}
+
+	// Find out what changed about the windows before clicking into them
+	if (out->window_display != NULL)
+	{
+		process_window_events(out, opts);
+	}
+
+	// Catch-up bursts of different streams are merged by deadline, so one stream's missed clicks
+	// don't all go out ahead of another's earlier ones
+	int order[MAX_BINDINGS];
+	int num_due = due_streams(streams, opts->num_bindings, now_ns, order);
+	seq_event_t steps[MAX_BINDINGS][MAX_CATCHUP_CLICKS];
+	int num_steps[MAX_BINDINGS];
+	int next_step[MAX_BINDINGS];
+	for (int k = 0; k < num_due; ++k)
+	{
+		num_steps[k] = due_clicks(&streams[order[k]].sched, opts->bindings[order[k]].click_button, now_ns, steps[k]);
+		next_step[k] = 0;
+	}
+
+	for (;;)
+	{
+		// Ties go to the stream that came first in due order
+		int first = -1;
+		for (int k = 0; k < num_due; ++k)
+		{
+			if (next_step[k] < num_steps[k] &&
+				(first < 0 || steps[k][next_step[k]].offset_ns < steps[first][next_step[first]].offset_ns))
+			{
+				first = k;
+			}
+		}
+		if (first < 0)
+		{
+			break;
+		}
+		emit_due_step(out, &opts->bindings[order[first]], &streams[order[first]], &steps[first][next_step[first]++], stats, latency);
+	}
+
+	uint64_t deadline_ns = 0;
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		if (streams[i].clicking && (deadline_ns == 0 || streams[i].sched.next_ns < deadline_ns))
+		{
+			deadline_ns = streams[i].sched.next_ns;
+		}
+	}
+	return deadline_ns;
+}
+
+/**
+ * Set up each binding's schedule, ready for its first click.
+ */
+void init_streams(const opts_t* opts, click_stream_t* streams)
+{
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		streams[i].sched.period_ns = opts->bindings[i].period_ns;
+		streams[i].sched.policy = opts->overrun;
+		streams[i].sched.seq = opts->bindings[i].sequence;
+	}
+}
+
+//
+// Multi-display mode
+//
+
+// One X display in multi-display mode: everything the single-display main loop has, per display
+typedef struct
+{
+	const char* name;
+	Display* display;
+	opts_t opts;
+	input_t input;
+	output_t output;
+	control_t control;
+	click_stream_t streams[MAX_BINDINGS];
+	loop_stats_t stats;      // Only the input and emit stages and the clicks are per display
+	uint64_t poll_ns;
+	uint64_t next_poll_ns;   // XI1: when the buttons are due to be queried again
+	uint64_t next_click_ns;  // 0 while nothing is clicking
+	bool input_ready;        // The X connection has events waiting
+	bool control_ready;      // The control socket has a connection or a command waiting
+	bool window_ready;       // The window targets' connection has events waiting
+	bool window_watched;     // Whether that connection is in the shared epoll set yet
+	bool lost;               // The X connection broke, and the display is to be dropped
+} display_session_t;
+
+// What woke a display up, as the low part of its epoll data in the shared set
+enum
+{
+	SESSION_INPUT,
+	SESSION_CONTROL,
+	SESSION_WINDOW,
+	SESSION_SOURCES
+};
+
+/**
+ * Work out one display's options: those from its own config file, or else a copy of the main ones
+ * with window targets of its own.
+ */
+bool read_display_opts(const opts_t* main_opts, const display_opts_t* disp, char* prog_name, opts_t* opts)
+{
+	if (disp->config_filename == NULL)
+	{
+		*opts = *main_opts;
+		opts->num_displays = 0;
+
+		// A window target caches what it found on one connection, so each display gets its own
+		bool ok = true;
+		for (int i = 0; i < opts->num_bindings; ++i)
+		{
+			binding_t* b = &opts->bindings[i];
+			if (b->window != NULL)
+			{
+				b->window = ok ? copy_window_target(b->window) : NULL;
+				ok = b->window != NULL;
+			}
+		}
+		if (!ok)
+		{
+			fprintf(stderr, "Display %s: Cannot copy the window targets\n", disp->name);
+		}
+		return ok;
+	}
+
+	char* argv[] = {prog_name, "-f", (char*)disp->config_filename};
+	memset(opts, 0, sizeof(*opts));
+	return read_opts(3, argv, opts) && finish_bindings(opts);
+}
+
+/**
+ * Free a display's options. A copy of the main options only owns its window targets.
+ */
+void free_display_opts(const display_opts_t* disp, opts_t* opts)
+{
+	if (disp->config_filename != NULL)
+	{
+		free_opts(opts);
+		return;
+	}
+	for (int i = 0; i < opts->num_bindings; ++i)
+	{
+		window_target_t* t = opts->bindings[i].window;
+		if (t != NULL)
+		{
+			free(t->value);
+			free(t);
+			opts->bindings[i].window = NULL;
+		}
+	}
+}
+
+/**
+ * Check that a display's options are complete and make sense on one display among many.
+ */
+bool validate_display_opts(const display_opts_t* disp, const opts_t* opts)
+{
+	if (!validate_opts(opts))
+	{
+		return false;
+	}
+	if (opts->num_displays > 0)
+	{
+		fprintf(stderr, "Display %s: A display's config file can't list displays of its own\n", disp->name);
+		return false;
+	}
+	if (opts->input == INPUT_EVDEV || opts->output == OUTPUT_UINPUT)
+	{
+		fprintf(stderr, "Display %s: evdev input and uinput output don't belong to a display\n", disp->name);
+		return false;
+	}
+	if (opts->threads || opts->latency_stats)
+	{
+		fprintf(stderr, "Display %s: --threads and --latency only work with a single display\n", disp->name);
+		return false;
+	}
+	return true;
+}
+
+#ifdef HAVE_X11_IO_ERROR_EXIT
+/**
+ * Xlib's last word on a display's connection breaking. Returning, rather than exiting as Xlib
+ * would by default, leaves the other displays running; the loop drops this one on its next pass.
+ */
+void handle_session_io_error(Display* display, void* user_data)
+{
+	display_session_t* s = user_data;
+
+	(void)display;
+	s->lost = true;
+}
+#endif
+
+/**
+ * Connect to one display and start watching its devices and control socket. On failure, whatever
+ * was opened is left for close_display_session().
+ */
+bool open_display_session(display_session_t* s, const opts_t* main_opts, const display_opts_t* disp, char* prog_name)
+{
+	s->name = disp->name;
+	s->input.num_devices = 0;
+	s->input.epoll_fd = -1;
+	s->output.uinput_fd = -1;
+	s->control.listen_fd = s->control.epoll_fd = -1;
+	if (!read_display_opts(main_opts, disp, prog_name, &s->opts) || !validate_display_opts(disp, &s->opts))
+	{
+		return false;
+	}
+
+	// Each display with the shared options would try to listen on the same socket
+	if (disp->config_filename == NULL && s->opts.control_path != NULL && main_opts->num_displays > 1)
+	{
+		fprintf(stderr, "Display %s: Displays with a control socket need a config file each\n", disp->name);
+		return false;
+	}
+
+	s->display = XOpenDisplay(disp->name);
+	if (s->display == NULL)
+	{
+		fprintf(stderr, "Cannot open X display %s\n", disp->name);
+		return false;
+	}
+#ifdef HAVE_X11_IO_ERROR_EXIT
+	XSetIOErrorExitHandler(s->display, handle_session_io_error, s);
+#endif
+	if (!resolve_devices(s->display, &s->opts))
+	{
+		return false;
+	}
+
+	init_streams(&s->opts, s->streams);
+	s->poll_ns = poll_interval(&s->opts);
+	s->next_poll_ns = 0;
+	s->next_click_ns = 0;
+	s->input_ready = s->control_ready = s->window_ready = s->window_watched = false;
+	return open_input(&s->input, &s->opts, s->display, s->streams) &&
+	       open_output(&s->output, &s->opts, s->display) &&
+	       (s->opts.control_path == NULL || open_control(&s->control, s->opts.control_path));
+}
+
+void close_display_session(display_session_t* s)
+{
+	close_control(&s->control);
+	close_output(&s->output);
+	close_input(&s->input);
+	if (s->display != NULL)
+	{
+		forget_x_errors(s->display);
+		XCloseDisplay(s->display);
+		s->display = NULL;
+	}
+}
+
+/**
+ * Do whatever one display has due: read its buttons if they've changed or are due a poll, take
+ * its control commands, and send its due clicks. Returns the display's next deadline, or 0 if it
+ * has nothing to do until a button or a command comes in.
+ */
+uint64_t service_display(display_session_t* s, uint64_t now_ns)
+{
+	bool polling = s->input.type == INPUT_XI1 && s->input.num_devices > 0;
+	bool changed = false;
+
+	if (s->input_ready || (polling && now_ns >= s->next_poll_ns))
+	{
+		uint64_t stage_ns = monotonic_ns();
+		process_input(&s->input, &s->opts, s->streams);
+		now_ns = stage_end(&s->stats.input, stage_ns);
+		s->next_poll_ns = now_ns + s->poll_ns;
+		s->input_ready = false;
+		changed = true;
+	}
+	if (s->control_ready)
+	{
+		process_control(&s->control, &s->opts, s->streams, now_ns);
+		s->control_ready = false;
+		changed = true;
+	}
+
+	// run_clicks() reads the window events
+	if (s->window_ready)
+	{
+		s->window_ready = false;
+		changed = true;
+	}
+
+	// Displays that have nothing due and nothing new are left alone
+	if (changed || (s->next_click_ns != 0 && now_ns >= s->next_click_ns))
+	{
+		s->next_click_ns = run_clicks(&s->opts, s->streams, &s->output, now_ns, &s->stats, NULL);
+	}
+
+	uint64_t deadline_ns = s->next_click_ns;
+	if (polling && (deadline_ns == 0 || s->next_poll_ns < deadline_ns))
+	{
+		deadline_ns = s->next_poll_ns;
+	}
+
+	// Replies to queries can leave events in Xlib's queue, where the fd won't wake us for them
+	if (s->display != NULL && XEventsQueued(s->display, QueuedAlready) > 0)
+	{
+		s->input_ready = true;
+		deadline_ns = now_ns;
+	}
+	if (s->output.window_display != NULL && XEventsQueued(s->output.window_display, QueuedAlready) > 0)
+	{
+		s->window_ready = true;
+		deadline_ns = now_ns;
+	}
+	return deadline_ns;
+}
+
+/**
+ * Print the shared loop's statistics, then each display's.
+ */
+void display_stats_print(FILE* fp, const loop_stats_t* stats, const display_session_t* sessions, int count)
+{
+	uint64_t wall_ns = monotonic_ns() - stats->start_ns;
+
+	fprintf(fp, "Stats after %.3f s on %d displays:\n", wall_ns / (double)NS_PER_SEC, count);
+	fprintf(fp, "  loops=%" PRIu64 "\n", stats->loops);
+	stage_print(fp, "wait", &stats->wait, wall_ns);
+	hist_print(fp, "wakeup lateness", &stats->wake_late);
+
+	for (int d = 0; d < count; ++d)
+	{
+		const display_session_t* s = &sessions[d];
+		uint64_t toggles = 0;
+		uint64_t overruns = 0;
+
+		for (int i = 0; i < s->opts.num_bindings; ++i)
+		{
+			toggles += s->streams[i].state.toggles;
+			overruns += s->streams[i].sched.overruns;
+		}
+		fprintf(fp,
+		        "  display %s: clicks=%" PRIu64 " toggles=%" PRIu64 " overruns=%" PRIu64 "\n",
+		        s->name,
+		        s->stats.clicks,
+		        toggles,
+		        overruns);
+		stage_print(fp, "input", &s->stats.input, wall_ns);
+		stage_print(fp, "emit", &s->stats.emit, wall_ns);
+	}
+	fflush(fp);
+}
+
+/**
+ * Click on every display listed in the options from one event loop, each with its own
+ * connection, devices, bindings and schedule. Returns the exit status.
+ *
+ * Every display's X connection and control socket go in one epoll set, which the loop watches as
+ * its input, so a wakeup only touches the displays that have something to say or something due.
+ */
+int run_displays(const opts_t* opts, char* prog_name)
+{
+	display_session_t* sessions = calloc(opts->num_displays, sizeof(display_session_t));
+	int pool_fd = epoll_create1(EPOLL_CLOEXEC);
+	int num_sessions = 0;
+	int num_active = 0;  // Sessions that are open; the others have display set to NULL
+	bool ok = sessions != NULL && pool_fd >= 0;
+
+	if (!ok)
+	{
+		fprintf(stderr, "Cannot set up %d displays: %s\n", opts->num_displays, strerror(errno));
+	}
+
+	// The epoll data is the display's index times SESSION_SOURCES, plus which of its fds it is.
+	// A display that can't be set up is left out, and the others go ahead without it.
+	while (ok && num_sessions < opts->num_displays)
+	{
+		display_session_t* s = &sessions[num_sessions];
+		uint32_t id = (uint32_t)num_sessions++ * SESSION_SOURCES;
+
+		bool opened = open_display_session(s, opts, &opts->displays[id / SESSION_SOURCES], prog_name);
+		if (opened)
+		{
+			struct epoll_event ep = {EPOLLIN, {.u32 = id + SESSION_INPUT}};
+			opened = epoll_ctl(pool_fd, EPOLL_CTL_ADD, ConnectionNumber(s->display), &ep) == 0;
+		}
+		if (opened && s->control.epoll_fd >= 0)
+		{
+			struct epoll_event ep = {EPOLLIN, {.u32 = id + SESSION_CONTROL}};
+			opened = epoll_ctl(pool_fd, EPOLL_CTL_ADD, s->control.epoll_fd, &ep) == 0;
+		}
+		if (opened)
+		{
+			num_active++;
+		}
+		else
+		{
+			fprintf(stderr, "Cannot set up display %s, leaving it out\n", s->name);
+			close_display_session(s);
+		}
+	}
+	if (ok && num_active == 0)
+	{
+		fprintf(stderr, "None of the displays could be set up\n");
+		ok = false;
+	}
+
+	static loop_stats_t stats;
+	FILE* stats_fp = stderr;
+	if (ok && opts->stats_filename != NULL)
+	{
+		stats_fp = fopen(opts->stats_filename, "a");
+		if (stats_fp == NULL)
+		{
+			fprintf(stderr, "Error opening file %s for writing\n", opts->stats_filename);
+			stats_fp = stderr;
+			ok = false;
+		}
+	}
+
+	if (ok && opts->realtime)
+	{
+		char desc[160];
+		apply_realtime(opts, &stats.realtime);
+		realtime_describe(opts, &stats.realtime, desc, sizeof(desc));
+		fprintf(stderr, "Realtime: %s\n", desc);
+	}
+
+	event_loop_t loop = {.epoll_fd = -1, .timer_fd = -1, .signal_fd = -1};
+	ok = ok && open_event_loop(&loop) && watch_event_source(&loop, pool_fd, WAKE_INPUT);
+	if (ok)
+	{
+		fprintf(stderr, "Clicking on %d displays\n", num_active);
+	}
+
+	stats.start_ns = monotonic_ns();
+	uint64_t next_dump_ns = opts->stats_interval_ns > 0 ? stats.start_ns + opts->stats_interval_ns : 0;
+	uint32_t woken = 0;
+
+	while (ok && running)
+	{
+		stats.loops++;
+		if (woken & WAKE_INPUT)
+		{
+			struct epoll_event ep[64];
+			int count = epoll_wait(pool_fd, ep, sizeof(ep) / sizeof(ep[0]), 0);
+
+			for (int n = 0; n < count; ++n)
 			{
-			case 'd':  // Delay
-				opts->delay_ms = strtoul(argv[++i], NULL, 10);
-				break;
-			case 'b':  // Button
-				opts->click_button = strtol(argv[++i], NULL, 10);
-				break;
-			case 't':  // Trigger
-				opts->trigger_button = strtol(argv[++i], NULL, 10);
-				break;
-			case 'g':  // Toggle
-				opts->toggle_button = strtol(argv[++i], NULL, 10);
-				break;
-			case 'i':  // Device ID
-				opts->device_id = strtol(argv[++i], NULL, 10);
-				break;
-			case 'n':  // Device name
-				opts->device_name = argv[++i];
-				break;
-			case 'f':  // Config file name
-				opts->config_filename = argv[++i];
-				return parse_config_file(opts->config_filename, opts);
-			case '-':
-				if (strcmp(argv[i], "--calibrate") == 0)
-				{
-					opts->calibrate_mode = true;
-					// Calibrate mode overrides other options
-					return true;
-				}
-				else if (strcmp(argv[i], "--list") == 0)
-				{
-					opts->list_mode = true;
-					// List mode overrides other options
-					return true;
-				}
-				else if (strcmp(argv[i], "--no-disable-default") == 0)
+				display_session_t* s = &sessions[ep[n].data.u32 / SESSION_SOURCES];
+				switch (ep[n].data.u32 % SESSION_SOURCES)
 				{
-					opts->disable_default_action = false;
+				case SESSION_INPUT:
+					s->input_ready = true;
+					break;
+				case SESSION_CONTROL:
+					s->control_ready = true;
+					break;
+				case SESSION_WINDOW:
+					s->window_ready = true;
 					break;
 				}
-				fprintf(stderr, "Unknown option %s\n", argv[i]);
-				return false;
-			default:
-				fprintf(stderr, "Unknown option %s\n", argv[i]);
-				return false;
 			}
 		}
-		else
+
+		// A display whose connection broke is closed, and the others carry on without it
+		for (int d = 0; d < num_sessions; ++d)
 		{
-			fprintf(stderr, "Unknown option %s\n", argv[i]);
-			return false;
+			if (sessions[d].lost && sessions[d].display != NULL)
+			{
+				fprintf(stderr, "Lost display %s, carrying on with the others\n", sessions[d].name);
+				close_display_session(&sessions[d]);
+				ok = --num_active > 0;
+			}
+		}
+
+		uint64_t now_ns = monotonic_ns();
+		uint64_t deadline_ns = next_dump_ns;
+		uint64_t click_deadline_ns = 0;
+		for (int d = 0; ok && d < num_sessions; ++d)
+		{
+			display_session_t* s = &sessions[d];
+			if (s->display == NULL)
+			{
+				continue;
+			}
+
+			uint64_t display_deadline_ns = service_display(s, now_ns);
+			uint64_t next_click_ns = s->next_click_ns;
+
+			// The first click into a window opens its connection
+			if (s->output.window_display != NULL && !s->window_watched)
+			{
+				struct epoll_event ep = {EPOLLIN, {.u32 = d * SESSION_SOURCES + SESSION_WINDOW}};
+				epoll_ctl(pool_fd, EPOLL_CTL_ADD, ConnectionNumber(s->output.window_display), &ep);
+				s->window_watched = true;
+			}
+
+			if (display_deadline_ns != 0 && (deadline_ns == 0 || display_deadline_ns < deadline_ns))
+			{
+				deadline_ns = display_deadline_ns;
+			}
+			if (next_click_ns != 0 && (click_deadline_ns == 0 || next_click_ns < click_deadline_ns))
+			{
+				click_deadline_ns = next_click_ns;
+			}
 		}
+
+		uint64_t stage_ns = monotonic_ns();
+		woken = wait_for_events(&loop, deadline_ns);
+		stage_ns = stage_end(&stats.wait, stage_ns);
+		if (click_deadline_ns != 0 && stage_ns >= click_deadline_ns)
+		{
+			hist_record(&stats.wake_late, stage_ns - click_deadline_ns);
+		}
+
+		bool reload = false;
+		if (woken & WAKE_SIGNAL)
+		{
+			read_signals(&loop, &reload);
+		}
+		if (reload)
+		{
+			fprintf(stderr, "Reloading isn't supported with several displays, keeping the current settings\n");
+		}
+
+		if (next_dump_ns != 0 && stage_ns >= next_dump_ns)
+		{
+			dump_requested = 1;
+			while (next_dump_ns <= stage_ns)
+			{
+				next_dump_ns += opts->stats_interval_ns;
+			}
+		}
+		if (dump_requested && opts->loop_stats)
+		{
+			display_stats_print(stats_fp, &stats, sessions, num_sessions);
+		}
+		dump_requested = 0;
 	}
-	return true;
-}
 
-void usage(const char* prog_name)
-{
-	printf(
-	    "Usage: %s [-d delay_ms] [-b click_button] [--no-disable-default] <-t trigger_button | -g toggle_button> <-i device_id | -n device_name>\n"
-	    "       or\n"
-	    "       %s <-f path_to_config_file>\n"
-	    "       or\n"
-	    "       %s --calibrate\n"
-	    "       or\n"
-	    "       %s --list\n"
-	    "\n"
-	    "Options:\n"
-	    "  -d delay_ms              Delay between clicks in milliseconds (default: 50)\n"
-	    "  -b click_button          Button ID to click (default: 1)\n"
-	    "  -t trigger_button        Button ID that triggers clicks while held\n"
-	    "  -g toggle_button         Button ID that toggles clicking on/off\n"
-	    "  -i device_id             Device ID for the pointing device\n"
-	    "  -n device_name           Device name for the pointing device\n"
-	    "  -f config_file           Path to configuration file\n"
-	    "  --no-disable-default     Don't disable button's default action\n"
-	    "  --calibrate              Interactive mode to identify button IDs\n"
-	    "  --list                   List all pointing devices\n"
-	    "\n"
-	    "Notes:\n"
-	    "  - At least one of -t or -g is required\n"
-	    "  - Both -t and -g can be used together (must be different buttons)\n"
-	    "  - Trigger button (-t): Clicks while the button is held down\n"
-	    "  - Toggle button (-g): First press starts clicking, second press stops\n",
-	    prog_name,
-	    prog_name,
-	    prog_name,
-	    prog_name);
+	if (ok && opts->loop_stats)
+	{
+		display_stats_print(stats_fp, &stats, sessions, num_sessions);
+	}
+	if (stats_fp != stderr)
+	{
+		fclose(stats_fp);
+	}
+	close_event_loop(&loop);
+	for (int d = 0; d < num_sessions; ++d)
+	{
+		close_display_session(&sessions[d]);
+		free_display_opts(&opts->displays[d], &sessions[d].opts);
+	}
+	if (pool_fd >= 0)
+	{
+		close(pool_fd);
+	}
+	free(sessions);
+	return ok ? 0 : 1;
 }
 
 #ifndef TEST_BUILD
 int main(int argc, char** argv)
 {
-	Display* display = XOpenDisplay(NULL);
 	opts_t opts;
 
-	if (display == NULL)
+	if (!read_opts(argc, argv, &opts) || !finish_bindings(&opts))
+	{
+		usage(argv[0]);
+		return EINVAL;
+	}
+
+	// Several displays are served from a loop of their own, with a connection each
+	if (opts.num_displays > 0 && !opts.calibrate_mode && !opts.list_mode)
+	{
+		return run_displays(&opts, argv[0]);
+	}
+
+	// Reloading the config touches the input thread's connection from the main thread
+	if (opts.threads)
+	{
+		XInitThreads();
+	}
+	Display* display = XOpenDisplay(NULL);
+
+	// evdev input with uinput output never talks to X, so it can run without a display
+	bool needs_display = opts.calibrate_mode || opts.list_mode || opts.input != INPUT_EVDEV ||
+	                     opts.output != OUTPUT_UINPUT;
+	for (int d = 0; d < opts.num_devices; ++d)
+	{
+		needs_display = needs_display || opts.devices[d].device_name == NULL;
+	}
+	if (opts.replay_filename != NULL && !opts.calibrate_mode && !opts.list_mode)
+	{
+		// Neither does replaying through uinput
+		needs_display = opts.output != OUTPUT_UINPUT;
+	}
+
+	// Clicks into windows always go through X, and recording reads XI2 raw events
+	needs_display = needs_display || has_window_targets(&opts) || opts.record_filename != NULL;
+	if (display == NULL && needs_display)
 	{
 		fprintf(stderr, "Cannot open X display\n");
 		return 1;
 	}
 
-	if (!read_opts(argc, argv, &opts))
+	if (!opts.calibrate_mode && !opts.list_mode && !resolve_devices(display, &opts))
 	{
-		usage(argv[0]);
+		XCloseDisplay(display);
 		return EINVAL;
 	}
 
-	// If device name is specified, convert to device ID
-	if (opts.device_name != NULL)
-	{
-		if (opts.device_id > 0)
-		{
-			fprintf(stderr, "Cannot specify both device ID and device name\n");
-			usage(argv[0]);
-			XCloseDisplay(display);
-			return EINVAL;
-		}
-		opts.device_id = get_device_id_from_name(display, opts.device_name);
-		if (opts.device_id < 0)
-		{
-			fprintf(stderr, "Device '%s' not found. Use --list to see available devices.\n", opts.device_name);
-			XCloseDisplay(display);
-			return EINVAL;
-		}
-	}
+	// Stop cleanly on Ctrl+C/kill so we can report on the run
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_exit_signal;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	sa.sa_handler = handle_dump_signal;
+	sigaction(SIGUSR1, &sa, NULL);
+	defer_signals();
 
 	// Calibrate mode
 	if (opts.calibrate_mode)
 	{
-		do_calibrate(display);
+		do_calibrate(display, opts.calibrate_continuous);
+		XCloseDisplay(display);
 		return 0;
 	}
 
@@ -626,111 +7936,297 @@ int main(int argc, char** argv)
 		return 0;
 	}
 
-	// Normal operation - validate required options
-	if (opts.device_id < 0)
+	// Record mode
+	if (opts.record_filename != NULL)
 	{
-		fprintf(stderr, "Error: Device ID or device name is required\n");
-		usage(argv[0]);
-		return EINVAL;
+		int status = do_record(display, &opts);
+		XCloseDisplay(display);
+		return status;
 	}
 
-	if (opts.trigger_button < 0 && opts.toggle_button < 0)
+	// Replay mode
+	if (opts.replay_filename != NULL)
 	{
-		fprintf(stderr, "Error: At least one of -t (trigger) or -g (toggle) is required\n");
-		usage(argv[0]);
-		return EINVAL;
+		int status = do_replay(display, &opts);
+		if (display != NULL)
+		{
+			XCloseDisplay(display);
+		}
+		return status;
 	}
 
-	// Validate that trigger and toggle buttons are different if both specified
-	if (opts.trigger_button >= 0 && opts.toggle_button >= 0 &&
-	    opts.trigger_button == opts.toggle_button)
+	// Normal operation - validate required options
+	if (!validate_opts(&opts))
 	{
-		fprintf(stderr, "Error: Trigger button (-t) and toggle button (-g) must be different\n");
+		usage(argv[0]);
 		return EINVAL;
 	}
 
 	//
 	// Main program logic
 	//
-	XDevice* device = XOpenDevice(display, opts.device_id);
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	uint64_t poll_ns = poll_interval(&opts);
 
-	if (device == NULL)
+	init_streams(&opts, streams);
+
+	// Large enough that it's better off the stack
+	static latency_t latency;
+	static loop_stats_t stats;
+	static input_thread_t input_thread;
+
+	FILE* stats_fp = stderr;
+	if (opts.stats_filename != NULL)
 	{
-		fprintf(stderr, "Cannot open device with ID %d\n", opts.device_id);
-		XCloseDisplay(display);
+		stats_fp = fopen(opts.stats_filename, "a");
+		if (stats_fp == NULL)
+		{
+			fprintf(stderr, "Error opening file %s for writing\n", opts.stats_filename);
+			if (display != NULL)
+			{
+				XCloseDisplay(display);
+			}
+			return 1;
+		}
+	}
+
+	// With an input thread, the button state lives on that thread and reaches ours as click events
+	input_t input;
+	if (!open_input(&input, &opts, display, opts.threads ? input_thread.streams : streams))
+	{
+		close_input(&input);
+		if (display != NULL)
+		{
+			XCloseDisplay(display);
+		}
 		return 1;
 	}
 
-	// Disable the default action of buttons if requested
-	if (opts.disable_default_action)
+	// ...and the clicks get an X connection of their own
+	Display* output_display = display;
+	if (opts.threads && opts.output == OUTPUT_XTEST)
 	{
-		if (opts.trigger_button >= 0)
+		output_display = XOpenDisplay(NULL);
+		if (output_display == NULL)
 		{
-			if (!disable_button_default_action(display, device, opts.trigger_button))
-			{
-				fprintf(stderr, "Warning: Failed to disable default action for trigger button %d\n", opts.trigger_button);
-				fprintf(stderr, "The button will still trigger its normal action.\n");
-				fprintf(stderr, "You can suppress this with --no-disable-default\n");
-			}
+			fprintf(stderr, "Cannot open X display\n");
+			close_input(&input);
+			XCloseDisplay(display);
+			return 1;
 		}
-		if (opts.toggle_button >= 0)
+	}
+
+	output_t output;
+	if (!open_output(&output, &opts, output_display))
+	{
+		close_input(&input);
+		if (output_display != display)
 		{
-			if (!disable_button_default_action(display, device, opts.toggle_button))
-			{
-				fprintf(stderr, "Warning: Failed to disable default action for toggle button %d\n", opts.toggle_button);
-				fprintf(stderr, "The button will still trigger its normal action.\n");
-				fprintf(stderr, "You can suppress this with --no-disable-default\n");
-			}
+			XCloseDisplay(output_display);
+		}
+		if (display != NULL)
+		{
+			XCloseDisplay(display);
+		}
+		return 1;
+	}
+
+	// Pick up changes to the config file while we run
+	config_watch_t watch = {-1, ""};
+	if (opts.config_filename != NULL)
+	{
+		watch_config_file(&watch, opts.config_filename);
+	}
+
+	// Take start/stop/rate commands from scripts
+	control_t control = {.listen_fd = -1, .epoll_fd = -1};
+	if ((opts.control_path != NULL && !open_control(&control, opts.control_path)) ||
+	    (opts.threads && !start_input_thread(&input_thread, &input, &opts)))
+	{
+		close_control(&control);
+		close_output(&output);
+		close_input(&input);
+		if (output_display != display)
+		{
+			XCloseDisplay(output_display);
+		}
+		if (display != NULL)
+		{
+			XCloseDisplay(display);
 		}
+		return 1;
+	}
+
+	// Only the clicking thread goes realtime; the input thread was started without it
+	if (opts.realtime)
+	{
+		char desc[160];
+		apply_realtime(&opts, &stats.realtime);
+		realtime_describe(&opts, &stats.realtime, desc, sizeof(desc));
+		fprintf(stderr, "Realtime: %s\n", desc);
+	}
+
+	// Everything the loop reacts to goes in one epoll set: the input, the click timer, signals,
+	// the config file and the control socket
+	event_loop_t loop;
+	bool loop_ok = open_event_loop(&loop);
+	if (loop_ok && opts.threads)
+	{
+		loop_ok = watch_event_source(&loop, input_thread.wake_fd, WAKE_INPUT);
+	}
+	else if (loop_ok && input.type == INPUT_XI2)
+	{
+		loop.display = display;
+		loop_ok = watch_event_source(&loop, ConnectionNumber(display), WAKE_INPUT);
+	}
+	else if (loop_ok && input.type == INPUT_EVDEV)
+	{
+		loop_ok = watch_event_source(&loop, input.epoll_fd, WAKE_INPUT);
+	}
+	if (loop_ok && watch.fd >= 0)
+	{
+		loop_ok = watch_event_source(&loop, watch.fd, WAKE_CONFIG);
+	}
+	if (loop_ok && control.epoll_fd >= 0)
+	{
+		loop_ok = watch_event_source(&loop, control.epoll_fd, WAKE_CONTROL);
+	}
+	if (!loop_ok)
+	{
+		running = 0;
 	}
 
-	// State tracking for toggle button
-	bool toggle_active = false;
-	bool toggle_prev_pressed = false;
+	stats.start_ns = monotonic_ns();
+	uint64_t next_dump_ns = opts.stats_interval_ns > 0 ? stats.start_ns + opts.stats_interval_ns : 0;
+	uint64_t stage_ns = stats.start_ns;
 
-	while (true)
+	while (running)
 	{
-		bool should_click = false;
+		stats.loops++;
+		if (opts.threads)
+		{
+			receive_click_events(&input_thread, streams);
+		}
+		else
+		{
+			process_input(&input, &opts, streams);
+		}
 
-		// Check trigger button if specified
-		if (opts.trigger_button >= 0)
+		// Sleep until the next click of any stream; event-driven input also wakes up if a button changes
+		uint64_t now_ns = stage_end(&stats.input, stage_ns);
+		uint64_t click_deadline_ns = run_clicks(&opts, streams, &output, now_ns, &stats, opts.latency_stats ? &latency : NULL);
+		uint64_t deadline_ns = click_deadline_ns;
+
+		// The first click into a window opens its connection, whose events run_clicks() handles
+		if (!watch_window_connection(&loop, &output))
 		{
-			if (check_button_state(display, device, opts.trigger_button))
-			{
-				should_click = true;
-			}
+			loop_ok = false;
+			running = 0;
 		}
 
-		// Check toggle button if specified
-		if (opts.toggle_button >= 0)
+		// Event-driven input has nothing to do until a button changes state, but polling
+		// has to check the buttons again soon
+		if (input.type == INPUT_XI1 && !opts.threads && (deadline_ns == 0 || now_ns + poll_ns < deadline_ns))
 		{
-			bool toggle_pressed = check_button_state(display, device, opts.toggle_button);
+			deadline_ns = now_ns + poll_ns;
+		}
 
-			// Detect transition from not-pressed to pressed (button press event)
-			if (toggle_pressed && !toggle_prev_pressed)
-			{
-				toggle_active = !toggle_active;
-			}
+		// Wake up for the periodic stats dump too
+		if (next_dump_ns != 0 && (deadline_ns == 0 || next_dump_ns < deadline_ns))
+		{
+			deadline_ns = next_dump_ns;
+		}
+
+		stage_ns = monotonic_ns();
+		uint32_t woken = wait_for_events(&loop, deadline_ns);
+		stage_ns = stage_end(&stats.wait, stage_ns);
+
+		// How late the wakeup for a click came is the jitter that scheduling and timer slack add
+		if (click_deadline_ns != 0 && stage_ns >= click_deadline_ns)
+		{
+			hist_record(&stats.wake_late, stage_ns - click_deadline_ns);
+		}
 
-			toggle_prev_pressed = toggle_pressed;
+		bool reload = false;
+		if (woken & WAKE_SIGNAL)
+		{
+			read_signals(&loop, &reload);
+		}
+		if (woken & WAKE_CONTROL)
+		{
+			process_control(&control, &opts, streams, stage_ns);
+		}
+		if (woken & WAKE_CONFIG)
+		{
+			reload = config_file_changed(&watch) || reload;
+		}
 
-			// If toggle is active, we should click
-			if (toggle_active)
+		// SIGHUP re-reads the config file too, e.g. where inotify doesn't see changes
+		if (reload && opts.config_filename != NULL)
+		{
+			if (opts.threads ? reload_threaded_opts(&input_thread, argc, argv, &opts, &output, streams)
+			                 : reload_opts(argc, argv, &opts, &input, &output, streams, NULL))
+			{
+				fprintf(stderr, "Reloaded %s\n", opts.config_filename);
+				poll_ns = poll_interval(&opts);
+				next_dump_ns = opts.stats_interval_ns > 0 ? stage_ns + opts.stats_interval_ns : 0;
+			}
+			else
 			{
-				should_click = true;
+				fprintf(stderr, "Not reloading %s, keeping the current settings\n", opts.config_filename);
 			}
 		}
 
-		// Perform click if any condition is met
-		if (should_click)
+		if (next_dump_ns != 0 && stage_ns >= next_dump_ns)
+		{
+			dump_requested = 1;
+			while (next_dump_ns <= stage_ns)
+			{
+				next_dump_ns += opts.stats_interval_ns;
+			}
+		}
+		if (dump_requested)
 		{
-			do_click(display, opts.click_button);
+			dump_requested = 0;
+			dump_stats(stats_fp, &opts, &stats, streams, &latency);
 		}
+	}
 
-		msleep(opts.delay_ms);
+	uint64_t overruns = 0;
+	for (int i = 0; i < opts.num_bindings; ++i)
+	{
+		overruns += streams[i].sched.overruns;
+	}
+	fprintf(stderr, "Deadline overruns: %" PRIu64 "\n", overruns);
+	dump_stats(stats_fp, &opts, &stats, streams, &latency);
+	if (stats_fp != stderr)
+	{
+		fclose(stats_fp);
 	}
 
-	XCloseDisplay(display);
-	return 0;
+	if (watch.fd >= 0)
+	{
+		close(watch.fd);
+	}
+	close_event_loop(&loop);
+	close_control(&control);
+	if (opts.threads)
+	{
+		stop_input_thread(&input_thread);
+	}
+	close_output(&output);
+	close_input(&input);
+
+	if (output_display != display)
+	{
+		XCloseDisplay(output_display);
+	}
+	if (display != NULL)
+	{
+		XCloseDisplay(display);
+	}
+
+	// The loop couldn't be set up, or couldn't watch the window targets' connection
+	return loop_ok ? 0 : 1;
 }
 #endif  // TEST_BUILD
@@ -0,0 +1,452 @@
+#include <X11/extensions/XInput2.h>
+#include <X11/extensions/XTest.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+/*
+ * Throughput and jitter benchmark for autoclickd.
+ *
+ * For each requested delay, this starts the daemon with the XTEST pointer as its device, holds
+ * the trigger button down through XTest for a fixed time and timestamps every click the
+ * daemon delivers, as seen by a separate X client. It's meant to run against a private Xvfb
+ * server (see run_bench.sh), but works on any X display.
+ */
+
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+#define TRIGGER_BUTTON 9
+#define CLICK_BUTTON 1
+
+typedef struct
+{
+	const char* ac_path;
+	double duration_s;
+	const char* output_filename;
+	char** extra_args;  // Passed through to the daemon, e.g. --overrun skip
+	int num_extra_args;
+} bench_opts_t;
+
+typedef struct
+{
+	double delay_ms;
+	uint64_t clicks;
+	double achieved_cps;
+	double p50_us;
+	double p99_us;
+	double max_us;
+	double cpu_us_per_click;
+	long overruns;
+} bench_result_t;
+
+uint64_t monotonic_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+/**
+ * Open the display, giving a freshly started X server a few seconds to come up.
+ */
+Display* open_display(void)
+{
+	for (int i = 0; i < 50; ++i)
+	{
+		Display* display = XOpenDisplay(NULL);
+		if (display != NULL)
+		{
+			return display;
+		}
+		usleep(100000);
+	}
+	return NULL;
+}
+
+/**
+ * Return the device ID of the XTEST slave pointer, or -1 if there isn't one.
+ */
+int find_xtest_pointer(Display* display)
+{
+	int num_devices;
+	int ret = -1;
+	XIDeviceInfo* info = XIQueryDevice(display, XIAllDevices, &num_devices);
+
+	for (int i = 0; i < num_devices; ++i)
+	{
+		if (info[i].use == XISlavePointer && strstr(info[i].name, "XTEST") != NULL)
+		{
+			ret = info[i].deviceid;
+			break;
+		}
+	}
+
+	XIFreeDeviceInfo(info);
+	return ret;
+}
+
+/**
+ * Listen for raw button presses from the given device.
+ */
+bool select_clicks(Display* display, int device_id, int* xi_opcode)
+{
+	int event, error;
+	int major = 2;
+	int minor = 1;
+
+	if (!XQueryExtension(display, "XInputExtension", xi_opcode, &event, &error) ||
+	    XIQueryVersion(display, &major, &minor) != Success)
+	{
+		return false;
+	}
+
+	unsigned char mask_bits[XIMaskLen(XI_LASTEVENT)] = {0};
+	XIEventMask mask = {device_id, sizeof(mask_bits), mask_bits};
+	XISetMask(mask_bits, XI_RawButtonPress);
+	XISelectEvents(display, DefaultRootWindow(display), &mask, 1);
+	XSync(display, False);
+	return true;
+}
+
+/**
+ * Start the daemon clicking every delay_ms while the trigger is held. Its stderr goes to err_fd.
+ */
+pid_t start_daemon(const bench_opts_t* opts, int device_id, double delay_ms, int err_fd)
+{
+	char id[16];
+	char delay[32];
+	char trigger[16];
+	char button[16];
+	char* argv[16 + opts->num_extra_args];
+	int argc = 0;
+
+	snprintf(id, sizeof(id), "%d", device_id);
+	snprintf(delay, sizeof(delay), "%gms", delay_ms);
+	snprintf(trigger, sizeof(trigger), "%d", TRIGGER_BUTTON);
+	snprintf(button, sizeof(button), "%d", CLICK_BUTTON);
+
+	argv[argc++] = (char*)opts->ac_path;
+	argv[argc++] = "-i";
+	argv[argc++] = id;
+	argv[argc++] = "-t";
+	argv[argc++] = trigger;
+	argv[argc++] = "-b";
+	argv[argc++] = button;
+	argv[argc++] = "-d";
+	argv[argc++] = delay;
+	argv[argc++] = "--no-disable-default";
+	for (int i = 0; i < opts->num_extra_args; ++i)
+	{
+		argv[argc++] = opts->extra_args[i];
+	}
+	argv[argc] = NULL;
+
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		dup2(err_fd, STDERR_FILENO);
+		execv(opts->ac_path, argv);
+		fprintf(stderr, "Cannot run %s: %s\n", opts->ac_path, strerror(errno));
+		_exit(127);
+	}
+	return pid;
+}
+
+/**
+ * Collect click timestamps until the given time. Returns the number of clicks seen.
+ */
+size_t collect_clicks(Display* display, int xi_opcode, uint64_t until_ns, uint64_t* stamps, size_t max)
+{
+	struct pollfd pfd = {ConnectionNumber(display), POLLIN, 0};
+	size_t count = 0;
+
+	while (true)
+	{
+		while (XPending(display))
+		{
+			XEvent ev;
+			XGenericEventCookie* cookie = &ev.xcookie;
+
+			XNextEvent(display, &ev);
+			if (cookie->type != GenericEvent || cookie->extension != xi_opcode ||
+			    !XGetEventData(display, cookie))
+			{
+				continue;
+			}
+			if (cookie->evtype == XI_RawButtonPress &&
+			    ((XIRawEvent*)cookie->data)->detail == CLICK_BUTTON && count < max)
+			{
+				stamps[count++] = monotonic_ns();
+			}
+			XFreeEventData(display, cookie);
+		}
+
+		uint64_t now_ns = monotonic_ns();
+		if (now_ns >= until_ns)
+		{
+			return count;
+		}
+		poll(&pfd, 1, (int)((until_ns - now_ns) / NS_PER_MS) + 1);
+	}
+}
+
+int compare_u64(const void* a, const void* b)
+{
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * Return the given percentile of a sorted array.
+ */
+uint64_t percentile(const uint64_t* sorted, size_t count, double pct)
+{
+	size_t i = (size_t)(pct / 100 * (count - 1) + 0.5);
+	return sorted[i];
+}
+
+/**
+ * Pull the overrun count out of the daemon's exit report, or -1 if it didn't print one.
+ */
+long read_overruns(FILE* fp)
+{
+	char line[256];
+	long overruns = -1;
+
+	rewind(fp);
+	while (fgets(line, sizeof(line), fp) != NULL)
+	{
+		sscanf(line, "Deadline overruns: %ld", &overruns);
+	}
+	return overruns;
+}
+
+bool run_one(Display* display,
+             int xi_opcode,
+             int device_id,
+             const bench_opts_t* opts,
+             double delay_ms,
+             bench_result_t* res)
+{
+	size_t max = (size_t)(opts->duration_s * NS_PER_SEC / (delay_ms * NS_PER_MS) * 2) + 1024;
+	uint64_t* stamps = malloc(max * sizeof(uint64_t));
+	FILE* err = tmpfile();
+	struct rusage usage;
+	int status;
+
+	if (stamps == NULL || err == NULL)
+	{
+		fprintf(stderr, "Out of resources\n");
+		return false;
+	}
+
+	pid_t pid = start_daemon(opts, device_id, delay_ms, fileno(err));
+
+	// Give the daemon time to connect and select its events
+	collect_clicks(display, xi_opcode, monotonic_ns() + 500 * NS_PER_MS, stamps, 0);
+
+	XTestFakeButtonEvent(display, TRIGGER_BUTTON, True, CurrentTime);
+	XFlush(display);
+	uint64_t end_ns = monotonic_ns() + (uint64_t)(opts->duration_s * NS_PER_SEC);
+	size_t count = collect_clicks(display, xi_opcode, end_ns, stamps, max);
+	XTestFakeButtonEvent(display, TRIGGER_BUTTON, False, CurrentTime);
+	XFlush(display);
+
+	// Let stragglers drain so they don't leak into the next run
+	collect_clicks(display, xi_opcode, monotonic_ns() + 200 * NS_PER_MS, stamps, 0);
+
+	kill(pid, SIGTERM);
+	if (wait4(pid, &status, 0, &usage) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	{
+		fprintf(stderr, "Daemon for delay %gms didn't exit cleanly\n", delay_ms);
+	}
+
+	memset(res, 0, sizeof(*res));
+	res->delay_ms = delay_ms;
+	res->clicks = count;
+	res->overruns = read_overruns(err);
+
+	uint64_t cpu_us = (uint64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000 +
+	                  usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+	if (count > 0)
+	{
+		res->cpu_us_per_click = (double)cpu_us / count;
+	}
+
+	if (count > 1)
+	{
+		res->achieved_cps = (double)(count - 1) * NS_PER_SEC / (stamps[count - 1] - stamps[0]);
+
+		// Turn the timestamps into inter-click intervals, in place
+		for (size_t i = 0; i < count - 1; ++i)
+		{
+			stamps[i] = stamps[i + 1] - stamps[i];
+		}
+		qsort(stamps, count - 1, sizeof(uint64_t), compare_u64);
+		res->p50_us = percentile(stamps, count - 1, 50) / (double)NS_PER_US;
+		res->p99_us = percentile(stamps, count - 1, 99) / (double)NS_PER_US;
+		res->max_us = stamps[count - 2] / (double)NS_PER_US;
+	}
+
+	fclose(err);
+	free(stamps);
+	return true;
+}
+
+void usage(const char* prog_name)
+{
+	printf(
+	    "Usage: %s [-a path_to_ac] [-D seconds] [-o output_file] [delay_ms...] [-- daemon options]\n"
+	    "\n"
+	    "Options:\n"
+	    "  -a path_to_ac            Daemon binary to benchmark (default: ./ac)\n"
+	    "  -D seconds               How long to hold the trigger at each delay (default: 5)\n"
+	    "  -o output_file           Also write the results as tab-separated values\n"
+	    "  delay_ms...              Delays to test (default: 1 2 5 10 50 100)\n"
+	    "  -- daemon options        Extra options for the daemon, e.g. -- --overrun skip\n",
+	    prog_name);
+}
+
+int main(int argc, char** argv)
+{
+	static char* default_delays[] = {"1", "2", "5", "10", "50", "100"};
+	bench_opts_t opts = {"./ac", 5, NULL, NULL, 0};
+	char* delays[argc];
+	int num_delays = 0;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (strcmp(argv[i], "--") == 0)
+		{
+			opts.extra_args = &argv[i + 1];
+			opts.num_extra_args = argc - i - 1;
+			break;
+		}
+		else if (argv[i][0] == '-' && i < argc - 1 && argv[i][1] == 'a')
+		{
+			opts.ac_path = argv[++i];
+		}
+		else if (argv[i][0] == '-' && i < argc - 1 && argv[i][1] == 'D')
+		{
+			opts.duration_s = strtod(argv[++i], NULL);
+		}
+		else if (argv[i][0] == '-' && i < argc - 1 && argv[i][1] == 'o')
+		{
+			opts.output_filename = argv[++i];
+		}
+		else if (argv[i][0] != '-' && strtod(argv[i], NULL) > 0)
+		{
+			delays[num_delays++] = argv[i];
+		}
+		else
+		{
+			usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	if (num_delays == 0)
+	{
+		memcpy(delays, default_delays, sizeof(default_delays));
+		num_delays = sizeof(default_delays) / sizeof(default_delays[0]);
+	}
+
+	Display* display = open_display();
+	if (display == NULL)
+	{
+		fprintf(stderr, "Cannot open X display\n");
+		return 1;
+	}
+
+	int device_id = find_xtest_pointer(display);
+	int xi_opcode;
+	if (device_id < 0 || !select_clicks(display, device_id, &xi_opcode))
+	{
+		fprintf(stderr, "The X server needs XInput 2.1 and XTest\n");
+		return 1;
+	}
+
+	FILE* out = NULL;
+	if (opts.output_filename != NULL)
+	{
+		out = fopen(opts.output_filename, "w");
+		if (out == NULL)
+		{
+			fprintf(stderr, "Error opening file %s for writing\n", opts.output_filename);
+			return 1;
+		}
+		fprintf(out,
+		        "delay_ms\trequested_cps\tachieved_cps\tclicks\tp50_us\tp99_us\tmax_us\tcpu_us_per_click\t"
+		        "overruns\n");
+	}
+
+	printf("%10s %10s %10s %8s %10s %10s %10s %10s %9s\n",
+	       "delay_ms",
+	       "req_cps",
+	       "cps",
+	       "clicks",
+	       "p50_us",
+	       "p99_us",
+	       "max_us",
+	       "cpu_us/clk",
+	       "overruns");
+
+	for (int i = 0; i < num_delays; ++i)
+	{
+		bench_result_t res;
+		double delay_ms = strtod(delays[i], NULL);
+
+		if (!run_one(display, xi_opcode, device_id, &opts, delay_ms, &res))
+		{
+			return 1;
+		}
+
+		printf("%10g %10.1f %10.1f %8" PRIu64 " %10.1f %10.1f %10.1f %10.2f %9ld\n",
+		       res.delay_ms,
+		       1000 / res.delay_ms,
+		       res.achieved_cps,
+		       res.clicks,
+		       res.p50_us,
+		       res.p99_us,
+		       res.max_us,
+		       res.cpu_us_per_click,
+		       res.overruns);
+		fflush(stdout);
+
+		if (out != NULL)
+		{
+			fprintf(out,
+			        "%g\t%.3f\t%.3f\t%" PRIu64 "\t%.1f\t%.1f\t%.1f\t%.3f\t%ld\n",
+			        res.delay_ms,
+			        1000 / res.delay_ms,
+			        res.achieved_cps,
+			        res.clicks,
+			        res.p50_us,
+			        res.p99_us,
+			        res.max_us,
+			        res.cpu_us_per_click,
+			        res.overruns);
+		}
+	}
+
+	if (out != NULL)
+	{
+		fclose(out);
+	}
+	XCloseDisplay(display);
+	return 0;
+}
@@ -0,0 +1,128 @@
+// Leave out autoclickd's main(); the benchmark drives its click loop directly
+#define TEST_BUILD
+#include "../autoclick.c"
+
+/*
+ * Per-iteration overhead benchmark for autoclickd's click loop.
+ *
+ * This runs the input polling and click scheduling steps of the main loop against the mock
+ * backend, so there's no X server, no round trips and no sleeping: what's left is the cost of the
+ * daemon's own bookkeeping. Each scenario runs a fixed number of iterations and reports the
+ * average time per iteration.
+ */
+
+typedef struct
+{
+	const char* name;
+	bool held;           // Whether the trigger is held for the whole run
+	bool points;         // Whether each click moves the pointer to the next point first
+	uint64_t iterations;
+	uint64_t clicks;
+	uint64_t queries;
+	double ns_per_iteration;
+} loop_result_t;
+
+/**
+ * Run one scenario: -t 9 on device 10, clicking button 1 as fast as it can while held, or moving
+ * round three points and clicking at each one every microsecond.
+ */
+bool run_scenario(loop_result_t* res)
+{
+	char* plain_argv[] = {"ac", "-i", "10", "-t", "9", "-d", "0"};
+	char* points_argv[] = {"ac", "-i", "10", "--bind", "hold:9:1:1us:at:10,10:200,10:200,200"};
+	char** argv = res->points ? points_argv : plain_argv;
+	int argc = res->points ? sizeof(points_argv) / sizeof(points_argv[0]) : sizeof(plain_argv) / sizeof(plain_argv[0]);
+	opts_t opts;
+	static mock_backend_t mock;
+	static loop_stats_t stats;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+	output_t out;
+
+	memset(&mock, 0, sizeof(mock));
+	memset(&stats, 0, sizeof(stats));
+	memset(&opts, 0, sizeof(opts));
+	if (!read_opts(argc, argv, &opts) || !finish_bindings(&opts))
+	{
+		return false;
+	}
+	opts.mock = &mock;
+	init_streams(&opts, streams);
+
+	if (!open_input(&in, &opts, NULL, streams) || !open_output(&out, &opts, NULL))
+	{
+		return false;
+	}
+	mock_set_button(&mock, 10, 9, res->held);
+
+	uint64_t start_ns = monotonic_ns();
+	for (uint64_t i = 0; i < res->iterations; ++i)
+	{
+		process_input(&in, &opts, streams);
+		run_clicks(&opts, streams, &out, monotonic_ns(), &stats, NULL);
+	}
+	uint64_t elapsed_ns = monotonic_ns() - start_ns;
+
+	res->clicks = stats.clicks;
+	res->queries = mock.queries;
+	res->ns_per_iteration = (double)elapsed_ns / res->iterations;
+
+	close_output(&out);
+	close_input(&in);
+	return true;
+}
+
+void bench_usage(const char* prog_name)
+{
+	printf(
+	    "Usage: %s [-n iterations]\n"
+	    "\n"
+	    "Options:\n"
+	    "  -n iterations            Loop iterations per scenario (default: 1000000)\n",
+	    prog_name);
+}
+
+int main(int argc, char** argv)
+{
+	loop_result_t results[] = {
+	    {"idle", false, false, 1000000, 0, 0, 0},
+	    {"clicking", true, false, 1000000, 0, 0, 0},
+	    {"points", true, true, 1000000, 0, 0, 0},
+	};
+
+	for (int i = 1; i < argc; ++i)
+	{
+		if (argv[i][0] == '-' && i < argc - 1 && argv[i][1] == 'n' && strtoull(argv[i + 1], NULL, 10) > 0)
+		{
+			uint64_t iterations = strtoull(argv[++i], NULL, 10);
+			for (size_t r = 0; r < sizeof(results) / sizeof(results[0]); ++r)
+			{
+				results[r].iterations = iterations;
+			}
+		}
+		else
+		{
+			bench_usage(argv[0]);
+			return EINVAL;
+		}
+	}
+
+	printf("%10s %12s %12s %12s %10s\n", "scenario", "iterations", "clicks", "queries", "ns/iter");
+	for (size_t r = 0; r < sizeof(results) / sizeof(results[0]); ++r)
+	{
+		loop_result_t* res = &results[r];
+
+		if (!run_scenario(res))
+		{
+			fprintf(stderr, "Cannot set up the %s scenario\n", res->name);
+			return 1;
+		}
+		printf("%10s %12" PRIu64 " %12" PRIu64 " %12" PRIu64 " %10.1f\n",
+		       res->name,
+		       res->iterations,
+		       res->clicks,
+		       res->queries,
+		       res->ns_per_iteration);
+	}
+	return 0;
+}
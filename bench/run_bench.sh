@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# Run the autoclickd benchmark against a private, headless Xvfb server.
+#
+# Environment:
+#   BENCH_DISPLAY   X display to start Xvfb on (default: :99)
+#   BENCH_DURATION  Seconds to click at each delay (default: 5)
+#   BENCH_OUTPUT    Where to write the tab-separated results (default: bench_output.txt)
+#
+# Any arguments are passed to ac_bench, e.g. a list of delays or "-- --overrun skip".
+
+set -e
+
+BENCH_DIR=$(dirname "$0")
+BENCH_DISPLAY=${BENCH_DISPLAY:-:99}
+BENCH_DURATION=${BENCH_DURATION:-5}
+BENCH_OUTPUT=${BENCH_OUTPUT:-bench_output.txt}
+
+if ! command -v Xvfb >/dev/null 2>&1; then
+	echo "Xvfb is required to run the benchmark" >&2
+	exit 1
+fi
+
+Xvfb "$BENCH_DISPLAY" -nolisten tcp >/dev/null 2>&1 &
+XVFB_PID=$!
+trap 'kill $XVFB_PID 2>/dev/null' EXIT INT TERM
+
+DISPLAY=$BENCH_DISPLAY "$BENCH_DIR/ac_bench" -a ./ac -D "$BENCH_DURATION" -o "$BENCH_OUTPUT" "$@"
@@ -53,6 +53,30 @@ static void test_get_config_type_delay(void** state)
 	assert_int_equal(pos, 6);  // Length of "delay " (skip past "delay" and space)
 }
 
+static void test_get_config_type_delay_us(void** state)
+{
+	(void)state;
+
+	const char* line = "delay_us 250\n";
+	size_t pos = 0;
+	config_type type = get_config_type(line, strlen(line), &pos);
+
+	assert_int_equal(type, DELAY_US);
+	assert_int_equal(pos, 9);  // Length of "delay_us "
+}
+
+static void test_get_config_type_rate(void** state)
+{
+	(void)state;
+
+	const char* line = "rate 4000\n";
+	size_t pos = 0;
+	config_type type = get_config_type(line, strlen(line), &pos);
+
+	assert_int_equal(type, RATE);
+	assert_int_equal(pos, 5);  // Length of "rate "
+}
+
 static void test_get_config_type_click_button(void** state)
 {
 	(void)state;
@@ -113,6 +137,18 @@ static void test_get_config_type_dev_name(void** state)
 	assert_int_equal(pos, 9);  // Length of "dev_name "
 }
 
+static void test_get_config_type_input(void** state)
+{
+	(void)state;
+
+	const char* line = "input xi1\n";
+	size_t pos = 0;
+	config_type type = get_config_type(line, strlen(line), &pos);
+
+	assert_int_equal(type, INPUT);
+	assert_int_equal(pos, 6);  // Length of "input "
+}
+
 static void test_get_config_type_comment(void** state)
 {
 	(void)state;
@@ -174,10 +210,10 @@ static void test_parse_config_file_valid(void** state)
 	bool result = parse_config_file(filename, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 100);
+	assert_int_equal(opts.delay_ns, 100 * NS_PER_MS);
 	assert_int_equal(opts.click_button, 2);
-	assert_int_equal(opts.trigger_button, 9);
-	assert_int_equal(opts.device_id, 10);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+	assert_int_equal(opts.devices[0].device_id, 10);
 
 	cleanup_temp_config(filename);
 }
@@ -201,9 +237,9 @@ static void test_parse_config_file_with_comments(void** state)
 	bool result = parse_config_file(filename, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 50);
+	assert_int_equal(opts.delay_ns, 50 * NS_PER_MS);
 	assert_int_equal(opts.click_button, 1);
-	assert_int_equal(opts.trigger_button, 8);
+	assert_int_equal(opts.devices[0].trigger_button, 8);
 
 	cleanup_temp_config(filename);
 }
@@ -224,12 +260,69 @@ static void test_parse_config_file_with_device_name(void** state)
 	bool result = parse_config_file(filename, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 50);
-	assert_int_equal(opts.trigger_button, 9);
-	assert_non_null(opts.device_name);
-	assert_string_equal(opts.device_name, "Logitech M570");
+	assert_int_equal(opts.delay_ns, 50 * NS_PER_MS);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+	assert_non_null(opts.devices[0].device_name);
+	assert_string_equal(opts.devices[0].device_name, "Logitech M570");
+
+	free(opts.devices[0].device_name);  // Clean up the allocated memory
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_multiple_devices(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"dev_name Logitech M570\n"
+		"trigger_button 9\n"
+		"\n"
+		"dev_id 14\n"
+		"toggle_button 1\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.num_devices, 2);
+	assert_string_equal(opts.devices[0].device_name, "Logitech M570");
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+	assert_int_equal(opts.devices[1].device_id, 14);
+	assert_int_equal(opts.devices[1].trigger_button, -1);
+	assert_int_equal(opts.devices[1].toggle_button, 1);
+
+	free(opts.devices[0].device_name);
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_bind(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"dev_id 10\n"
+		"bind hold 9 1 20cps\n"
+		"bind toggle 8 3 200ms  # right-click 5 times a second\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.num_bindings, 2);
+	assert_int_equal(opts.bindings[0].device, 0);
+	assert_int_equal(opts.bindings[0].trigger_button, 9);
+	assert_int_equal(opts.bindings[0].click_button, 1);
+	assert_int_equal(opts.bindings[0].period_ns, 50 * NS_PER_MS);
+	assert_int_equal(opts.bindings[1].toggle_button, 8);
+	assert_int_equal(opts.bindings[1].click_button, 3);
+	assert_int_equal(opts.bindings[1].period_ns, 200 * NS_PER_MS);
 
-	free(opts.device_name);  // Clean up the allocated memory
 	cleanup_temp_config(filename);
 }
 
@@ -259,9 +352,9 @@ static void test_parse_config_file_with_toggle_button(void** state)
 	bool result = parse_config_file(filename, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 75);
-	assert_int_equal(opts.toggle_button, 8);
-	assert_int_equal(opts.device_id, 12);
+	assert_int_equal(opts.delay_ns, 75 * NS_PER_MS);
+	assert_int_equal(opts.devices[0].toggle_button, 8);
+	assert_int_equal(opts.devices[0].device_id, 12);
 	// trigger_button not set in config, so remains 0 from initialization
 
 	cleanup_temp_config(filename);
@@ -285,12 +378,167 @@ static void test_parse_config_file_with_trigger_and_toggle(void** state)
 	bool result = parse_config_file(filename, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 100);
+	assert_int_equal(opts.delay_ns, 100 * NS_PER_MS);
 	assert_int_equal(opts.click_button, 2);
-	assert_int_equal(opts.trigger_button, 9);
-	assert_int_equal(opts.toggle_button, 8);
-	assert_int_equal(opts.device_id, 10);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+	assert_int_equal(opts.devices[0].toggle_button, 8);
+	assert_int_equal(opts.devices[0].device_id, 10);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_delay_us(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"delay_us 250 # 4000 clicks/sec\n"
+		"trigger_button 9\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.delay_ns, 250 * NS_PER_US);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_rate(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"rate 333\n"
+		"trigger_button 9\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.delay_ns, 3003003);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_delay_unit(void** state)
+{
+	(void)state;
+
+	const char* config_content = "delay 0.5ms\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.delay_ns, 500 * NS_PER_US);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_zero_delay(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config("delay 0\n");
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	assert_false(parse_config_file(filename, &opts));
+	cleanup_temp_config(filename);
+
+	// The command line can still turn it off
+	char* argv[] = {"ac", "-d", "0"};
+	assert_true(read_opts(3, argv, &opts));
+	assert_int_equal(opts.delay_ns, 0);
+}
+
+static void test_parse_config_file_invalid_rate(void** state)
+{
+	(void)state;
+
+	const char* config_content = "rate fast\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_false(result);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_output(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"output uinput\n"
+		"click_button 3\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.output, OUTPUT_UINPUT);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_input(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"input xi1 # poll\n"
+		"trigger_button 9\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
 
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.input, INPUT_XI1);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_parse_config_file_with_stats(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"stats_interval 0.5\n"
+		"stats_file /tmp/autoclick stats.log  # appended to\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	opts_t opts = {0};
+	bool result = parse_config_file(filename, &opts);
+
+	assert_true(result);
+	assert_true(opts.loop_stats);
+	assert_int_equal(opts.stats_interval_ns, 500 * NS_PER_MS);
+	assert_string_equal(opts.stats_filename, "/tmp/autoclick stats.log");
+
+	free(opts.stats_filename);
 	cleanup_temp_config(filename);
 }
 
@@ -344,10 +592,10 @@ static void test_read_opts_defaults(void** state)
 
 	assert_true(result);
 	assert_int_equal(opts.click_button, 1);
-	assert_int_equal(opts.delay_ms, 50);
-	assert_int_equal(opts.trigger_button, -1);
-	assert_int_equal(opts.device_id, -1);
-	assert_null(opts.device_name);
+	assert_int_equal(opts.delay_ns, 50 * NS_PER_MS);
+	assert_int_equal(opts.devices[0].trigger_button, -1);
+	assert_int_equal(opts.devices[0].device_id, -1);
+	assert_null(opts.devices[0].device_name);
 	assert_false(opts.calibrate_mode);
 	assert_false(opts.list_mode);
 }
@@ -363,162 +611,382 @@ static void test_read_opts_delay(void** state)
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 100);
+	assert_int_equal(opts.delay_ns, 100 * NS_PER_MS);
 }
 
-static void test_read_opts_button(void** state)
+static void test_read_opts_delay_units(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-b", "2"};
+	char* argv[] = {"ac", "-d", "0.25ms"};
 	int argc = 3;
 	opts_t opts = {0};
 
-	bool result = read_opts(argc, argv, &opts);
+	assert_true(read_opts(argc, argv, &opts));
+	assert_int_equal(opts.delay_ns, 250 * NS_PER_US);
 
-	assert_true(result);
-	assert_int_equal(opts.click_button, 2);
+	argv[2] = "250us";
+	assert_true(read_opts(argc, argv, &opts));
+	assert_int_equal(opts.delay_ns, 250 * NS_PER_US);
+
+	argv[2] = "2s";
+	assert_true(read_opts(argc, argv, &opts));
+	assert_int_equal(opts.delay_ns, 2 * NS_PER_SEC);
 }
 
-static void test_read_opts_trigger(void** state)
+static void test_read_opts_delay_invalid(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-t", "9"};
+	char* argv[] = {"ac", "-d", "5min"};
 	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
-	assert_true(result);
-	assert_int_equal(opts.trigger_button, 9);
+	assert_false(result);
 }
 
-static void test_read_opts_device_id(void** state)
+static void test_read_opts_out_of_range(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-i", "10"};
-	int argc = 3;
+	const char* bad[][2] = {
+		{"-d", "inf"}, {"-d", "nan"}, {"-d", "1e30"}, {"-d", "-nan"},
+		{"-r", "inf"}, {"-r", "nan"}, {"-r", "1e30"}, {"-r", "1e-30"},
+	};
 	opts_t opts = {0};
 
-	bool result = read_opts(argc, argv, &opts);
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+	{
+		char* argv[] = {"ac", (char*)bad[i][0], (char*)bad[i][1]};
+		assert_false(read_opts(3, argv, &opts));
+	}
 
-	assert_true(result);
-	assert_int_equal(opts.device_id, 10);
+	// The largest interval that fits still works
+	char* argv[] = {"ac", "-d", "18446744073ms"};
+	assert_true(read_opts(3, argv, &opts));
+	assert_int_equal(opts.delay_ns, 18446744073 * NS_PER_MS);
 }
 
-static void test_read_opts_device_name(void** state)
+static void test_read_opts_rate(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-n", "Logitech M570"};
+	char* argv[] = {"ac", "-r", "4000"};
 	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_string_equal(opts.device_name, "Logitech M570");
+	assert_int_equal(opts.delay_ns, 250 * NS_PER_US);
 }
 
-static void test_read_opts_multiple_options(void** state)
+static void test_read_opts_rate_zero(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-d", "200", "-b", "3", "-t", "8", "-i", "12"};
-	int argc = 9;
+	char* argv[] = {"ac", "-r", "0"};
+	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
-	assert_true(result);
-	assert_int_equal(opts.delay_ms, 200);
-	assert_int_equal(opts.click_button, 3);
-	assert_int_equal(opts.trigger_button, 8);
-	assert_int_equal(opts.device_id, 12);
+	assert_false(result);
 }
 
-static void test_read_opts_calibrate_mode(void** state)
+static void test_read_opts_button(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "--calibrate"};
-	int argc = 2;
+	char* argv[] = {"ac", "-b", "2"};
+	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_true(opts.calibrate_mode);
+	assert_int_equal(opts.click_button, 2);
 }
 
-static void test_read_opts_list_mode(void** state)
+static void test_read_opts_trigger(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "--list"};
-	int argc = 2;
+	char* argv[] = {"ac", "-t", "9"};
+	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_true(opts.list_mode);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
 }
 
-static void test_read_opts_config_file(void** state)
+static void test_read_opts_device_id(void** state)
 {
 	(void)state;
 
-	const char* config_content =
-		"delay 75\n"
-		"click_button 3\n"
-		"trigger_button 7\n"
-		"dev_id 11\n";
-
-	char* filename = create_temp_config(config_content);
-	assert_non_null(filename);
-
-	char* argv[] = {"ac", "-f", filename};
+	char* argv[] = {"ac", "-i", "10"};
 	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.delay_ms, 75);
-	assert_int_equal(opts.click_button, 3);
-	assert_int_equal(opts.trigger_button, 7);
-	assert_int_equal(opts.device_id, 11);
-
-	cleanup_temp_config(filename);
+	assert_int_equal(opts.devices[0].device_id, 10);
 }
 
-static void test_read_opts_invalid_option(void** state)
+static void test_read_opts_device_name(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-x"};
-	int argc = 2;
+	char* argv[] = {"ac", "-n", "Logitech M570"};
+	int argc = 3;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
-	assert_false(result);
+	assert_true(result);
+	assert_string_equal(opts.devices[0].device_name, "Logitech M570");
 }
 
-static void test_read_opts_missing_parameter(void** state)
+static void test_read_opts_multiple_options(void** state)
 {
 	(void)state;
 
-	char* argv[] = {"ac", "-d"};
-	int argc = 2;
+	char* argv[] = {"ac", "-d", "200", "-b", "3", "-t", "8", "-i", "12"};
+	int argc = 9;
 	opts_t opts = {0};
 
 	bool result = read_opts(argc, argv, &opts);
 
-	assert_false(result);
+	assert_true(result);
+	assert_int_equal(opts.delay_ns, 200 * NS_PER_MS);
+	assert_int_equal(opts.click_button, 3);
+	assert_int_equal(opts.devices[0].trigger_button, 8);
+	assert_int_equal(opts.devices[0].device_id, 12);
+}
+
+static void test_read_opts_multiple_devices(void** state)
+{
+	(void)state;
+
+	// Buttons before the first device belong to it; the rest follow their device
+	char* argv[] = {"ac", "-t", "9", "-i", "10", "-g", "8", "-n", "Foot Pedal", "-t", "1"};
+	int argc = 11;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.num_devices, 2);
+	assert_int_equal(opts.devices[0].device_id, 10);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+	assert_int_equal(opts.devices[0].toggle_button, 8);
+	assert_string_equal(opts.devices[1].device_name, "Foot Pedal");
+	assert_int_equal(opts.devices[1].device_id, -1);
+	assert_int_equal(opts.devices[1].trigger_button, 1);
+	assert_int_equal(opts.devices[1].toggle_button, -1);
+}
+
+static void test_read_opts_device_id_and_name(void** state)
+{
+	(void)state;
+
+	opts_t opts = {0};
+
+	// An ID and a name with nothing in between are the same device twice
+	char* both[] = {"ac", "-i", "10", "-n", "Foot Pedal", "-t", "9"};
+	assert_false(read_opts(7, both, &opts));
+	char* name_first[] = {"ac", "-n", "Foot Pedal", "-i", "10", "-t", "9"};
+	assert_false(read_opts(7, name_first, &opts));
+
+	char* filename = create_temp_config("dev_id 10\ndev_name Foot Pedal\ntrigger_button 9\n");
+	assert_non_null(filename);
+	char* config[] = {"ac", "-f", filename};
+	assert_false(read_opts(3, config, &opts));
+	assert_int_equal(opts.devices[0].device_id, 10);
+	cleanup_temp_config(filename);
+
+	// With buttons of its own, the first is a device of its own
+	char* two[] = {"ac", "-i", "10", "-t", "9", "-n", "Foot Pedal", "-t", "8"};
+	assert_true(read_opts(9, two, &opts));
+	assert_int_equal(opts.num_devices, 2);
+}
+
+static void test_read_opts_bind(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-i", "10", "-t", "9", "-n", "Foot Pedal", "--bind", "toggle:1:3:5cps"};
+	int argc = 9;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts) && finish_bindings(&opts);
+
+	assert_true(result);
+	assert_int_equal(opts.num_bindings, 2);
+
+	// The explicit binding belongs to the pedal
+	assert_int_equal(opts.bindings[0].device, 1);
+	assert_int_equal(opts.bindings[0].toggle_button, 1);
+	assert_int_equal(opts.bindings[0].click_button, 3);
+	assert_int_equal(opts.bindings[0].period_ns, 200 * NS_PER_MS);
+
+	// -t becomes a binding that clicks -b every -d
+	assert_int_equal(opts.bindings[1].device, 0);
+	assert_int_equal(opts.bindings[1].trigger_button, 9);
+	assert_int_equal(opts.bindings[1].toggle_button, -1);
+	assert_int_equal(opts.bindings[1].click_button, 1);
+	assert_int_equal(opts.bindings[1].period_ns, 50 * NS_PER_MS);
+}
+
+static void test_parse_binding(void** state)
+{
+	(void)state;
+
+	binding_t b;
+
+	assert_true(parse_binding("hold 9 1 20cps\n", NULL, &b));
+	assert_int_equal(b.trigger_button, 9);
+	assert_int_equal(b.toggle_button, -1);
+	assert_int_equal(b.click_button, 1);
+	assert_int_equal(b.period_ns, 50 * NS_PER_MS);
+
+	assert_true(parse_binding("toggle:8:3:250us", NULL, &b));
+	assert_int_equal(b.trigger_button, -1);
+	assert_int_equal(b.toggle_button, 8);
+	assert_int_equal(b.click_button, 3);
+	assert_int_equal(b.period_ns, 250 * NS_PER_US);
+
+	// Plain numbers are milliseconds, like -d
+	assert_true(parse_binding("hold 9 1 10", NULL, &b));
+	assert_int_equal(b.period_ns, 10 * NS_PER_MS);
+
+	assert_false(parse_binding("press 9 1 20cps", NULL, &b));
+	assert_false(parse_binding("hold 9 1", NULL, &b));
+	assert_false(parse_binding("hold 9 1 20cps extra", NULL, &b));
+	assert_false(parse_binding("hold x 1 20cps", NULL, &b));
+	assert_false(parse_binding("hold 9 1 fast", NULL, &b));
+}
+
+static void test_read_opts_too_many_devices(void** state)
+{
+	(void)state;
+
+	char* argv[2 * MAX_DEVICES + 3] = {"ac"};
+	int argc = 1;
+	opts_t opts = {0};
+
+	for (int i = 0; i <= MAX_DEVICES; ++i)
+	{
+		argv[argc++] = "-i";
+		argv[argc++] = "10";
+	}
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_false(result);
+}
+
+static void test_read_opts_calibrate_mode(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--calibrate"};
+	int argc = 2;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_true(opts.calibrate_mode);
+	assert_false(opts.calibrate_continuous);
+}
+
+static void test_read_opts_calibrate_continuous(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--calibrate-continuous"};
+	int argc = 2;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_true(opts.calibrate_mode);
+	assert_true(opts.calibrate_continuous);
+}
+
+static void test_read_opts_list_mode(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--list"};
+	int argc = 2;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_true(opts.list_mode);
+}
+
+static void test_read_opts_config_file(void** state)
+{
+	(void)state;
+
+	const char* config_content =
+		"delay 75\n"
+		"click_button 3\n"
+		"trigger_button 7\n"
+		"dev_id 11\n";
+
+	char* filename = create_temp_config(config_content);
+	assert_non_null(filename);
+
+	char* argv[] = {"ac", "-f", filename};
+	int argc = 3;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.delay_ns, 75 * NS_PER_MS);
+	assert_int_equal(opts.click_button, 3);
+	assert_int_equal(opts.devices[0].trigger_button, 7);
+	assert_int_equal(opts.devices[0].device_id, 11);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_read_opts_invalid_option(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-x"};
+	int argc = 2;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_false(result);
+}
+
+static void test_read_opts_missing_parameter(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-d"};
+	int argc = 2;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_false(result);
 }
 
 static void test_read_opts_unknown_long_option(void** state)
@@ -573,8 +1041,8 @@ static void test_read_opts_toggle_button(void** state)
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.toggle_button, 8);
-	assert_int_equal(opts.trigger_button, -1);
+	assert_int_equal(opts.devices[0].toggle_button, 8);
+	assert_int_equal(opts.devices[0].trigger_button, -1);
 }
 
 static void test_read_opts_trigger_and_toggle(void** state)
@@ -588,8 +1056,8 @@ static void test_read_opts_trigger_and_toggle(void** state)
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.trigger_button, 9);
-	assert_int_equal(opts.toggle_button, 8);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+	assert_int_equal(opts.devices[0].toggle_button, 8);
 }
 
 static void test_read_opts_toggle_default(void** state)
@@ -603,7 +1071,2554 @@ static void test_read_opts_toggle_default(void** state)
 	bool result = read_opts(argc, argv, &opts);
 
 	assert_true(result);
-	assert_int_equal(opts.toggle_button, -1);
+	assert_int_equal(opts.devices[0].toggle_button, -1);
+}
+
+static void test_read_opts_input_default(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-t", "9", "-i", "10"};
+	int argc = 5;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.input, INPUT_XI2);
+}
+
+static void test_read_opts_input_xi1(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--input", "xi1", "-t", "9"};
+	int argc = 5;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.input, INPUT_XI1);
+	assert_int_equal(opts.devices[0].trigger_button, 9);
+}
+
+static void test_read_opts_input_evdev(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--input", "evdev", "-n", "Logitech M570", "-t", "9"};
+	int argc = 7;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.input, INPUT_EVDEV);
+	assert_string_equal(opts.devices[0].device_name, "Logitech M570");
+}
+
+static void test_read_opts_input_invalid(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--input", "xi3"};
+	int argc = 3;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_false(result);
+}
+
+//
+// Tests for update_click_state()
+//
+
+static void test_update_click_state_trigger(void** state)
+{
+	(void)state;
+
+	binding_t b = {.trigger_button = 9, .toggle_button = -1};
+	click_state_t cs = {0};
+
+	update_click_state(&b, &cs, 9, true, 0);
+	assert_true(should_click(&cs));
+
+	update_click_state(&b, &cs, 9, false, 0);
+	assert_false(should_click(&cs));
+}
+
+static void test_update_click_state_toggle(void** state)
+{
+	(void)state;
+
+	binding_t b = {.trigger_button = -1, .toggle_button = 8};
+	click_state_t cs = {0};
+
+	// Press starts clicking, release leaves it running
+	update_click_state(&b, &cs, 8, true, 0);
+	assert_true(should_click(&cs));
+	update_click_state(&b, &cs, 8, false, 0);
+	assert_true(should_click(&cs));
+
+	// A repeated press report without a release in between isn't a new press
+	update_click_state(&b, &cs, 8, true, 0);
+	update_click_state(&b, &cs, 8, true, 0);
+	assert_false(should_click(&cs));
+}
+
+static void test_update_click_state_other_button(void** state)
+{
+	(void)state;
+
+	binding_t b = {.trigger_button = 9, .toggle_button = 8};
+	click_state_t cs = {0};
+
+	update_click_state(&b, &cs, 1, true, 0);
+	assert_false(should_click(&cs));
+}
+
+static void test_read_opts_overrun(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--overrun", "skip"};
+	int argc = 3;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.overrun, OVERRUN_SKIP);
+}
+
+static void test_read_opts_overrun_default(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac"};
+	int argc = 1;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.overrun, OVERRUN_CATCHUP);
+}
+
+//
+// Tests for the click scheduler
+//
+
+static void test_sched_due_on_time(void** state)
+{
+	(void)state;
+
+	click_sched_t sched = {0, 5000000, OVERRUN_CATCHUP, 0};
+	sched_start(&sched, 1000);
+
+	// First click is due immediately, the next one a period later
+	assert_int_equal(sched_due(&sched, 1000), 1);
+	assert_int_equal(sched.next_ns, 1000 + 5000000);
+	assert_int_equal(sched_due(&sched, 1000 + 4999999), 0);
+
+	// Waking up a little late doesn't shift the following deadline
+	assert_int_equal(sched_due(&sched, 1000 + 5200000), 1);
+	assert_int_equal(sched.next_ns, 1000 + 10000000);
+	assert_int_equal(sched.overruns, 0);
+}
+
+static void test_sched_due_catchup(void** state)
+{
+	(void)state;
+
+	click_sched_t sched = {0, 1000, OVERRUN_CATCHUP, 0};
+	sched_start(&sched, 0);
+
+	// Three whole periods late: the due click plus three missed ones
+	assert_int_equal(sched_due(&sched, 3500), 4);
+	assert_int_equal(sched.overruns, 3);
+	assert_int_equal(sched.next_ns, 4000);
+}
+
+static void test_sched_due_catchup_limit(void** state)
+{
+	(void)state;
+
+	click_sched_t sched = {0, 1000, OVERRUN_CATCHUP, 0};
+	sched_start(&sched, 0);
+
+	assert_int_equal(sched_due(&sched, 1000000), MAX_CATCHUP_CLICKS);
+	assert_int_equal(sched.overruns, 1000);
+	assert_int_equal(sched.next_ns, 1001000);
+}
+
+static void test_sched_due_skip(void** state)
+{
+	(void)state;
+
+	click_sched_t sched = {0, 1000, OVERRUN_SKIP, 0};
+	sched_start(&sched, 0);
+
+	// Missed slots are dropped, but the cadence stays on the original grid
+	assert_int_equal(sched_due(&sched, 3500), 1);
+	assert_int_equal(sched.overruns, 3);
+	assert_int_equal(sched.next_ns, 4000);
+}
+
+//
+// Tests for click sequences
+//
+
+static void test_load_sequence(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config(
+		"# Double click, then a right-click burst\n"
+		"click 1\n"
+		"wait 20\n"
+		"click 1\n"
+		"\n"
+		"wait 100ms\n"
+		"click 3 3 5ms\n"
+		"wait 1s\n");
+	assert_non_null(filename);
+
+	sequence_t* seq = load_sequence(filename);
+	cleanup_temp_config(filename);
+
+	assert_non_null(seq);
+	assert_int_equal(seq->num_events, 5);
+	assert_int_equal(seq->events[0].offset_ns, 0);
+	assert_int_equal(seq->events[0].button, 1);
+	assert_int_equal(seq->events[1].offset_ns, 20 * NS_PER_MS);
+	assert_int_equal(seq->events[2].offset_ns, 120 * NS_PER_MS);
+	assert_int_equal(seq->events[2].button, 3);
+	assert_int_equal(seq->events[4].offset_ns, 130 * NS_PER_MS);
+
+	// The burst leaves the cursor a whole interval after its last click
+	assert_int_equal(seq->length_ns, 1135 * NS_PER_MS);
+	assert_int_equal(seq->min_gap_ns, 5 * NS_PER_MS);
+
+	free(seq->events);
+	free(seq);
+}
+
+static void test_load_sequence_errors(void** state)
+{
+	(void)state;
+
+	const char* bad[] = {
+		"click 1\nwait soon\n",
+		"click 1\njump 5\n",
+		"click 0\nwait 10\n",
+		"click 1 0 5ms\nwait 10\n",
+		"click 1 2\nwait 10\n",
+		"wait 10\n",          // Nothing to click
+		"click 1\nclick 3\n", // No time for a pass to take
+		"click 1 foo bar\nwait 10\n",
+		"click 1 2 5ms 7\nwait 10\n",
+		"click 1\nwait 10 junk\n",
+		"move 1,2 3,4\nclick 1\nwait 10\n",
+		"step 5 6\nclick 1\nwait 10\n",
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+	{
+		char* filename = create_temp_config(bad[i]);
+		assert_non_null(filename);
+		assert_null(load_sequence(filename));
+		cleanup_temp_config(filename);
+	}
+
+	assert_null(load_sequence("/nonexistent/sequence"));
+}
+
+static void test_parse_binding_sequence(void** state)
+{
+	(void)state;
+
+	binding_t b;
+	char* filename = create_temp_config("wait 10\nclick 3\nwait 40\nclick 2\nwait 50\n");
+	char value[300];
+	assert_non_null(filename);
+
+	snprintf(value, sizeof(value), "toggle:8:sequence:%s  # comment\n", filename);
+	assert_true(parse_binding(value, NULL, &b));
+	assert_int_equal(b.toggle_button, 8);
+	assert_non_null(b.sequence);
+	assert_int_equal(b.sequence->num_events, 2);
+	assert_int_equal(b.click_button, 3);
+	assert_int_equal(b.period_ns, 40 * NS_PER_MS);
+	cleanup_temp_config(filename);
+
+	assert_true(parse_binding("hold 9 1 20cps", NULL, &b));
+	assert_null(b.sequence);
+
+	assert_false(parse_binding("hold 9 sequence", NULL, &b));
+	assert_false(parse_binding("hold 9 sequence /nonexistent/sequence", NULL, &b));
+
+	// A relative file name is found next to the config file it's in, not in the working directory
+	filename = create_temp_config("click 2  # comment\nwait 10 # comment\n");
+	assert_non_null(filename);
+	snprintf(value, sizeof(value), "hold 9 sequence %s", filename + strlen("/tmp/"));
+	assert_true(parse_binding(value, "/tmp/autoclick.conf", &b));
+	assert_int_equal(b.click_button, 2);
+	free_binding(&b);
+	assert_false(parse_binding(value, "/nonexistent/autoclick.conf", &b));
+	cleanup_temp_config(filename);
+}
+
+static void test_load_sequence_moves(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config(
+		"move 100,200\n"
+		"click 1\n"
+		"wait 10\n"
+		"move 300,400\n"
+		"wait 10\n"
+		"click 3\n"
+		"wait 10\n");
+	assert_non_null(filename);
+
+	sequence_t* seq = load_sequence(filename);
+	cleanup_temp_config(filename);
+
+	// A move goes along with the click after it, unless there's a wait in between
+	assert_non_null(seq);
+	assert_true(seq->moves);
+	assert_int_equal(seq->num_events, 3);
+	assert_int_equal(seq->events[0].action, SEQ_CLICK);
+	assert_true(seq->events[0].moves);
+	assert_int_equal(seq->events[0].x, 100);
+	assert_int_equal(seq->events[0].y, 200);
+	assert_int_equal(seq->events[1].action, SEQ_MOVE);
+	assert_int_equal(seq->events[1].offset_ns, 10 * NS_PER_MS);
+	assert_int_equal(seq->events[1].x, 300);
+	assert_int_equal(seq->events[2].action, SEQ_CLICK);
+	assert_false(seq->events[2].moves);
+
+	free(seq->events);
+	free(seq);
+}
+
+static void test_load_sequence_drag(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config(
+		"drag 1 4ms 0,0 40,0 80,40\n"
+		"wait 10\n"
+		"step 5ms\n"
+		"drag 2 10ms 0,0 10,10  # two steps\n"
+		"wait 10\n");
+	assert_non_null(filename);
+
+	sequence_t* seq = load_sequence(filename);
+	cleanup_temp_config(filename);
+
+	// Pressed at the start, a move every millisecond along each segment in turn, released at the end
+	assert_non_null(seq);
+	assert_int_equal(seq->num_events, 8);
+	assert_int_equal(seq->events[0].action, SEQ_PRESS);
+	assert_int_equal(seq->events[0].button, 1);
+	assert_int_equal(seq->events[0].x, 0);
+	assert_int_equal(seq->events[1].action, SEQ_MOVE);
+	assert_int_equal(seq->events[1].offset_ns, 1 * NS_PER_MS);
+	assert_int_equal(seq->events[1].x, 20);
+	assert_int_equal(seq->events[2].x, 40);
+	assert_int_equal(seq->events[2].y, 0);
+	assert_int_equal(seq->events[3].x, 60);
+	assert_int_equal(seq->events[3].y, 20);
+	assert_int_equal(seq->events[4].action, SEQ_RELEASE);
+	assert_int_equal(seq->events[4].offset_ns, 4 * NS_PER_MS);
+	assert_int_equal(seq->events[4].x, 80);
+	assert_int_equal(seq->events[4].y, 40);
+
+	// The second drag moves every 5ms
+	assert_int_equal(seq->events[5].offset_ns, 14 * NS_PER_MS);
+	assert_int_equal(seq->events[6].offset_ns, 19 * NS_PER_MS);
+	assert_int_equal(seq->events[6].x, 5);
+	assert_int_equal(seq->events[7].action, SEQ_RELEASE);
+	assert_int_equal(seq->events[7].offset_ns, 24 * NS_PER_MS);
+	assert_int_equal(seq->length_ns, 34 * NS_PER_MS);
+	assert_int_equal(seq->min_gap_ns, 1 * NS_PER_MS);
+
+	free(seq->events);
+	free(seq);
+
+	const char* bad[] = {
+		"move 5\nclick 1\nwait 10\n",
+		"move -5,5\nclick 1\nwait 10\n",
+		"drag 1 10ms 5,5\nwait 10\n",       // Nowhere to drag to
+		"drag 0 10ms 5,5 6,6\nwait 10\n",
+		"drag 1 0 5,5 6,6\nwait 10\n",
+		"drag 1 10ms 5,5 6,6 extra\nwait 10\n",
+		"step 0\nclick 1\nwait 10\n",
+	};
+
+	for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); ++i)
+	{
+		filename = create_temp_config(bad[i]);
+		assert_non_null(filename);
+		assert_null(load_sequence(filename));
+		cleanup_temp_config(filename);
+	}
+}
+
+static void test_parse_binding_points(void** state)
+{
+	(void)state;
+
+	binding_t b;
+
+	assert_true(parse_binding("hold:9:3:20cps:at:100,200:300,400", NULL, &b));
+	assert_int_equal(b.trigger_button, 9);
+	assert_int_equal(b.click_button, 3);
+	assert_non_null(b.sequence);
+	assert_int_equal(b.sequence->num_events, 2);
+	assert_int_equal(b.sequence->events[1].offset_ns, 50 * NS_PER_MS);
+	assert_int_equal(b.sequence->events[1].button, 3);
+	assert_true(b.sequence->events[1].moves);
+	assert_int_equal(b.sequence->events[1].x, 300);
+	assert_int_equal(b.sequence->events[1].y, 400);
+	assert_int_equal(b.sequence->length_ns, 100 * NS_PER_MS);
+
+	// uinput can't put the pointer anywhere in particular
+	assert_false(check_uinput_buttons(&b));
+
+	assert_true(parse_binding("toggle 8 1 10 at 5,5  # one point\n", NULL, &b));
+	assert_int_equal(b.sequence->num_events, 1);
+
+	assert_false(parse_binding("hold 9 1 0 at 5,5", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 at", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 at 5", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 at 5,5 six", NULL, &b));
+}
+
+static void test_seq_due(void** state)
+{
+	(void)state;
+
+	seq_event_t events[] = {{0, 1}, {10, 1}, {10, 3}, {40, 2}};
+	sequence_t seq = {events, 4, 100, 10};
+	click_sched_t sched = {.policy = OVERRUN_CATCHUP, .seq = &seq};
+	seq_event_t steps[MAX_CATCHUP_CLICKS];
+
+	sched_start(&sched, 1000);
+	assert_int_equal(seq_due(&sched, 1000, steps, MAX_CATCHUP_CLICKS), 1);
+	assert_int_equal(steps[0].button, 1);
+	assert_int_equal(sched.next_ns, 1010);
+	assert_int_equal(seq_due(&sched, 1009, steps, MAX_CATCHUP_CLICKS), 0);
+
+	// Clicks at the same offset go out together without counting as overruns
+	assert_int_equal(seq_due(&sched, 1012, steps, MAX_CATCHUP_CLICKS), 2);
+	assert_int_equal(steps[0].button, 1);
+	assert_int_equal(steps[1].button, 3);
+	assert_int_equal(sched.overruns, 0);
+
+	// The last click wraps round to the start of the next pass
+	assert_int_equal(seq_due(&sched, 1040, steps, MAX_CATCHUP_CLICKS), 1);
+	assert_int_equal(steps[0].button, 2);
+	assert_int_equal(sched.seq_pos, 0);
+	assert_int_equal(sched.next_ns, 1100);
+	assert_int_equal(sched.pass_ns, 1100);
+
+	// Catching up plays the clicks we slept through in order
+	assert_int_equal(seq_due(&sched, 1145, steps, MAX_CATCHUP_CLICKS), 4);
+	assert_int_equal(steps[0].button, 1);
+	assert_int_equal(steps[3].button, 2);
+	assert_int_equal(sched.overruns, 3);
+	assert_int_equal(sched.next_ns, 1200);
+}
+
+static void test_seq_due_skip(void** state)
+{
+	(void)state;
+
+	seq_event_t events[] = {{0, 1}, {10, 1}, {10, 3}, {40, 2}};
+	sequence_t seq = {events, 4, 100, 10};
+	click_sched_t sched = {.policy = OVERRUN_SKIP, .seq = &seq};
+	seq_event_t steps[MAX_CATCHUP_CLICKS];
+
+	sched_start(&sched, 0);
+
+	// Only the latest slot is played, both of its clicks
+	assert_int_equal(seq_due(&sched, 15, steps, MAX_CATCHUP_CLICKS), 2);
+	assert_int_equal(steps[0].button, 1);
+	assert_int_equal(steps[1].button, 3);
+	assert_int_equal(sched.overruns, 1);
+
+	// Whole passes slept through are skipped without walking them, staying on the original grid
+	assert_int_equal(seq_due(&sched, 10000 + 45, steps, MAX_CATCHUP_CLICKS), 1);
+	assert_int_equal(steps[0].button, 2);
+	assert_int_equal(sched.next_ns, 10100);
+	assert_true(sched.overruns > 400);
+}
+
+static void test_seq_due_drag(void** state)
+{
+	(void)state;
+
+	// A drag with a press at 0, a move every ns up to 99 and the release at 100
+	seq_event_t events[101];
+	sequence_t seq = {events, 101, 150, 1, true};
+	seq_event_t steps[MAX_CATCHUP_CLICKS];
+
+	for (int i = 0; i <= 100; ++i)
+	{
+		seq_event_t ev = {i, 1, i == 0 ? SEQ_PRESS : i == 100 ? SEQ_RELEASE : SEQ_MOVE, true, i, 0};
+		events[i] = ev;
+	}
+
+	// Waking up late across the end of the drag still lets go, whichever the policy
+	click_sched_t sched = {.policy = OVERRUN_CATCHUP, .seq = &seq};
+	sched_start(&sched, 0);
+	assert_int_equal(seq_due(&sched, 0, steps, MAX_CATCHUP_CLICKS), 1);
+	assert_int_equal(steps[0].action, SEQ_PRESS);
+	int count = seq_due(&sched, 120, steps, MAX_CATCHUP_CLICKS);
+	assert_true(count > 0 && count <= MAX_CATCHUP_CLICKS);
+	assert_int_equal(steps[count - 1].action, SEQ_RELEASE);
+	assert_int_equal(steps[count - 1].x, 100);
+
+	sched.policy = OVERRUN_SKIP;
+	sched_start(&sched, 0);
+	assert_int_equal(seq_due(&sched, 0, steps, MAX_CATCHUP_CLICKS), 1);
+	assert_int_equal(seq_due(&sched, 120, steps, MAX_CATCHUP_CLICKS), 1);
+	assert_int_equal(steps[0].action, SEQ_RELEASE);
+
+	// So does a burst with several whole drags in it, with the press and release of each kept
+	// together
+	sched.policy = OVERRUN_CATCHUP;
+	sched_start(&sched, 0);
+	assert_int_equal(seq_due(&sched, 0, steps, MAX_CATCHUP_CLICKS), 1);
+	count = seq_due(&sched, 280, steps, MAX_CATCHUP_CLICKS);
+	int presses = 0;
+	int releases = 0;
+	for (int i = 0; i < count; ++i)
+	{
+		presses += steps[i].action == SEQ_PRESS;
+		releases += steps[i].action == SEQ_RELEASE;
+	}
+	assert_int_equal(releases, presses + 1);
+
+	// Skipping whole passes leaves the button as it was: a drag part way through still ends
+	sched_start(&sched, 0);
+	assert_int_equal(seq_due(&sched, 50, steps, MAX_CATCHUP_CLICKS) > 0, 1);
+	count = seq_due(&sched, 10 * 150 + 120, steps, MAX_CATCHUP_CLICKS);
+	assert_int_equal(steps[count - 1].action, SEQ_RELEASE);
+}
+
+static void test_read_opts_output_uinput(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--output", "uinput", "-b", "3"};
+	int argc = 5;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.output, OUTPUT_UINPUT);
+	assert_int_equal(opts.click_button, 3);
+}
+
+static void test_read_opts_output_default(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac"};
+	int argc = 1;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_int_equal(opts.output, OUTPUT_XTEST);
+}
+
+//
+// Tests for the uinput click events
+//
+
+static void test_build_click_events_left(void** state)
+{
+	(void)state;
+
+	struct input_event ev[4];
+	int count = build_click_events(1, ev);
+
+	assert_int_equal(count, 4);
+	assert_int_equal(ev[0].type, EV_KEY);
+	assert_int_equal(ev[0].code, BTN_LEFT);
+	assert_int_equal(ev[0].value, 1);
+	assert_int_equal(ev[1].type, EV_SYN);
+	assert_int_equal(ev[1].code, SYN_REPORT);
+	assert_int_equal(ev[2].type, EV_KEY);
+	assert_int_equal(ev[2].code, BTN_LEFT);
+	assert_int_equal(ev[2].value, 0);
+	assert_int_equal(ev[3].type, EV_SYN);
+}
+
+static void test_build_click_events_side_buttons(void** state)
+{
+	(void)state;
+
+	struct input_event ev[4];
+
+	assert_int_equal(build_click_events(3, ev), 4);
+	assert_int_equal(ev[0].code, BTN_RIGHT);
+	assert_int_equal(build_click_events(8, ev), 4);
+	assert_int_equal(ev[0].code, BTN_SIDE);
+	assert_int_equal(build_click_events(9, ev), 4);
+	assert_int_equal(ev[0].code, BTN_EXTRA);
+}
+
+static void test_build_click_events_wheel(void** state)
+{
+	(void)state;
+
+	struct input_event ev[4];
+	int count = build_click_events(5, ev);
+
+	assert_int_equal(count, 2);
+	assert_int_equal(ev[0].type, EV_REL);
+	assert_int_equal(ev[0].code, REL_WHEEL);
+	assert_int_equal(ev[0].value, -1);
+	assert_int_equal(ev[1].type, EV_SYN);
+}
+
+static void test_build_click_events_unmapped(void** state)
+{
+	(void)state;
+
+	struct input_event ev[4];
+
+	assert_int_equal(build_click_events(0, ev), 0);
+	assert_int_equal(build_click_events(13, ev), 0);
+}
+
+static void test_evdev_to_x_button(void** state)
+{
+	(void)state;
+
+	assert_int_equal(evdev_to_x_button(BTN_LEFT), 1);
+	assert_int_equal(evdev_to_x_button(BTN_RIGHT), 3);
+	assert_int_equal(evdev_to_x_button(BTN_SIDE), 8);
+	assert_int_equal(evdev_to_x_button(BTN_EXTRA), 9);
+	assert_int_equal(evdev_to_x_button(KEY_A), -1);
+}
+
+static void test_process_evdev_events_dropped(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-t", "9"};
+	opts_t opts = {0};
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	evdev_input_t in = {0};
+	int device_fds[2], passthrough_fds[2];
+	struct input_event ev[] = {
+		{.type = EV_REL, .code = REL_X, .value = 5},
+		{.type = EV_SYN, .code = SYN_REPORT},
+		{.type = EV_SYN, .code = SYN_DROPPED},
+		{.type = EV_REL, .code = REL_X, .value = 7},
+		{.type = EV_KEY, .code = BTN_EXTRA, .value = 1},
+		{.type = EV_SYN, .code = SYN_REPORT},
+		{.type = EV_REL, .code = REL_Y, .value = 3},
+		{.type = EV_SYN, .code = SYN_REPORT},
+	};
+	struct input_event out[16];
+
+	assert_true(read_opts(3, argv, &opts) && finish_bindings(&opts));
+	assert_int_equal(pipe2(device_fds, O_NONBLOCK), 0);
+	assert_int_equal(pipe2(passthrough_fds, O_NONBLOCK), 0);
+	in.fd = device_fds[0];
+	in.passthrough_fd = passthrough_fds[1];
+	button_mask_set(&in.buttons, 9);
+
+	// The rest of the packet after SYN_DROPPED is skipped, bound button and all, and isn't passed
+	// on; a pipe has no state to resync from, so only the SYN_REPORT that ends the resync is
+	assert_int_equal(write(device_fds[1], ev, sizeof(ev)), sizeof(ev));
+	process_evdev_events(&in, &opts, 0, streams);
+	assert_false(in.dropped);
+	assert_false(streams[0].state.trigger_held);
+	assert_int_equal(read(passthrough_fds[0], out, sizeof(out)), 5 * sizeof(out[0]));
+	assert_int_equal(out[0].code, REL_X);
+	assert_int_equal(out[0].value, 5);
+	assert_int_equal(out[1].code, SYN_REPORT);
+	assert_int_equal(out[2].code, SYN_REPORT);
+	assert_int_equal(out[3].code, REL_Y);
+	assert_int_equal(out[4].code, SYN_REPORT);
+
+	close(device_fds[0]);
+	close(device_fds[1]);
+	close(passthrough_fds[0]);
+	close(passthrough_fds[1]);
+}
+
+static void test_update_click_state_timestamps(void** state)
+{
+	(void)state;
+
+	binding_t b = {.trigger_button = 9, .toggle_button = 8};
+	click_state_t cs = {0};
+
+	update_click_state(&b, &cs, 9, true, 100);
+	assert_int_equal(cs.start_ns, 100);
+
+	// Toggling on while the trigger is held doesn't restart the stream
+	update_click_state(&b, &cs, 8, true, 200);
+	assert_int_equal(cs.start_ns, 100);
+
+	update_click_state(&b, &cs, 9, false, 300);
+	update_click_state(&b, &cs, 8, false, 400);
+	update_click_state(&b, &cs, 8, true, 500);
+	assert_int_equal(cs.stop_ns, 500);
+}
+
+static void test_read_opts_latency(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--latency", "-t", "9"};
+	int argc = 4;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_true(opts.latency_stats);
+}
+
+static void test_read_opts_stats(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--stats"};
+	int argc = 2;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_true(opts.loop_stats);
+	assert_int_equal(opts.stats_interval_ns, 0);
+	assert_null(opts.stats_filename);
+}
+
+static void test_read_opts_stats_interval_and_file(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--stats-interval", "60", "--stats-file", "/tmp/ac.stats"};
+	int argc = 5;
+	opts_t opts = {0};
+
+	bool result = read_opts(argc, argv, &opts);
+
+	assert_true(result);
+	assert_true(opts.loop_stats);
+	assert_int_equal(opts.stats_interval_ns, 60 * NS_PER_SEC);
+	assert_string_equal(opts.stats_filename, "/tmp/ac.stats");
+}
+
+static void test_update_click_state_counts_toggles(void** state)
+{
+	(void)state;
+
+	binding_t b = {.trigger_button = 9, .toggle_button = 8};
+	click_state_t cs = {0};
+
+	update_click_state(&b, &cs, 8, true, 0);
+	update_click_state(&b, &cs, 8, false, 0);
+	update_click_state(&b, &cs, 9, true, 0);
+	update_click_state(&b, &cs, 8, true, 0);
+
+	assert_int_equal(cs.toggles, 2);
+}
+
+static void test_dispatch_button(void** state)
+{
+	(void)state;
+
+	// Two bindings on the mouse and one on the pedal, all on button 9
+	opts_t opts = {
+		.num_bindings = 3,
+		.bindings = {
+			{.device = 0, .trigger_button = 9, .toggle_button = -1},
+			{.device = 0, .trigger_button = -1, .toggle_button = 9},
+			{.device = 1, .trigger_button = 9, .toggle_button = -1},
+		},
+	};
+	click_stream_t streams[3] = {{{0}}};
+
+	dispatch_button(&opts, streams, 0, 9, true, 100);
+	assert_true(should_click(&streams[0].state));
+	assert_true(should_click(&streams[1].state));
+	assert_false(should_click(&streams[2].state));
+
+	// Releasing stops the hold binding; the toggle binding keeps going
+	dispatch_button(&opts, streams, 0, 9, false, 200);
+	assert_false(should_click(&streams[0].state));
+	assert_true(should_click(&streams[1].state));
+	assert_int_equal(streams[0].state.stop_ns, 200);
+}
+
+static void test_apply_button_mask(void** state)
+{
+	(void)state;
+
+	opts_t opts = {
+		.num_bindings = 2,
+		.bindings = {
+			{.device = 0, .trigger_button = 9, .toggle_button = 8},
+			{.device = 1, .trigger_button = 9, .toggle_button = -1},
+		},
+	};
+	click_stream_t streams[2] = {{{0}}};
+	button_mask_t mask = {{0}};
+
+	button_mask_set(&mask, 9);
+	apply_button_mask(&opts, streams, 1, &mask, 100);
+	assert_false(should_click(&streams[0].state));
+	assert_true(should_click(&streams[1].state));
+	assert_int_equal(streams[1].state.start_ns, 100);
+}
+
+static void test_pick_up_held_buttons(void** state)
+{
+	(void)state;
+
+	opts_t opts = {
+		.num_bindings = 2,
+		.bindings = {
+			{.device = 0, .trigger_button = 9, .toggle_button = 8},
+			{.device = 0, .trigger_button = -1, .toggle_button = 7},
+		},
+	};
+	click_stream_t streams[2] = {{{0}}};
+	button_mask_t mask = {{0}};
+
+	// A held trigger counts straight away, but a held toggle doesn't switch anything on
+	button_mask_set(&mask, 9);
+	button_mask_set(&mask, 7);
+	pick_up_held_buttons(&opts, streams, 0, &mask, 100);
+	assert_true(streams[0].state.trigger_held);
+	assert_false(streams[1].state.toggle_active);
+	assert_int_equal(streams[1].state.toggles, 0);
+
+	// Until it's let go and pressed again
+	memset(&mask, 0, sizeof(mask));
+	apply_button_mask(&opts, streams, 0, &mask, 200);
+	button_mask_set(&mask, 7);
+	apply_button_mask(&opts, streams, 0, &mask, 300);
+	assert_true(streams[1].state.toggle_active);
+	assert_int_equal(streams[1].state.start_ns, 300);
+}
+
+static void test_due_streams(void** state)
+{
+	(void)state;
+
+	click_stream_t streams[4] = {{{0}}};
+	int order[4];
+
+	streams[0].clicking = true;
+	streams[0].sched.next_ns = 300;
+	streams[1].clicking = true;
+	streams[1].sched.next_ns = 100;
+	streams[2].clicking = false;  // Not clicking, so never due
+	streams[2].sched.next_ns = 50;
+	streams[3].clicking = true;
+	streams[3].sched.next_ns = 1000;  // Not due yet
+
+	assert_int_equal(due_streams(streams, 4, 500, order), 2);
+	assert_int_equal(order[0], 1);
+	assert_int_equal(order[1], 0);
+}
+
+static void test_stage_end(void** state)
+{
+	(void)state;
+
+	stage_timer_t timer = {0};
+	uint64_t start_ns = monotonic_ns();
+
+	uint64_t end_ns = stage_end(&timer, start_ns);
+	stage_end(&timer, start_ns - 1000);
+
+	assert_true(end_ns >= start_ns);
+	assert_int_equal(timer.count, 2);
+	assert_true(timer.max_ns >= 1000);
+	assert_true(timer.total_ns >= timer.max_ns);
+}
+
+//
+// Tests for the latency histograms
+//
+
+static void test_hist_bucket_bounds(void** state)
+{
+	(void)state;
+
+	// Every value lands in a bucket whose range contains it, and buckets are ordered
+	uint64_t values[] = {0, 1, 63, 64, 65, 1000, 999999, 1000000, 123456789, UINT64_MAX};
+	int prev = -1;
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i)
+	{
+		int bucket = hist_bucket(values[i]);
+		assert_in_range(bucket, 0, HIST_BUCKETS - 1);
+		assert_true(bucket >= prev);
+		assert_true(values[i] <= hist_bucket_max(bucket));
+		if (bucket > 0)
+		{
+			assert_true(values[i] > hist_bucket_max(bucket - 1));
+		}
+		prev = bucket;
+	}
+}
+
+static void test_hist_percentile(void** state)
+{
+	(void)state;
+
+	static hist_t hist;
+	memset(&hist, 0, sizeof(hist));
+
+	// 1..1000 us
+	for (uint64_t i = 1; i <= 1000; ++i)
+	{
+		hist_record(&hist, i * NS_PER_US);
+	}
+
+	assert_int_equal(hist.total, 1000);
+	assert_int_equal(hist.min, NS_PER_US);
+	assert_int_equal(hist.max, 1000 * NS_PER_US);
+	assert_in_range(hist_percentile(&hist, 50), 500 * NS_PER_US, 500 * NS_PER_US * 103 / 100);
+	assert_in_range(hist_percentile(&hist, 99), 990 * NS_PER_US, 1000 * NS_PER_US);
+	assert_int_equal(hist_percentile(&hist, 100), 1000 * NS_PER_US);
+}
+
+static void test_latency_click(void** state)
+{
+	(void)state;
+
+	static latency_t lat;
+	memset(&lat, 0, sizeof(lat));
+	click_stream_t stream = {0};
+
+	// Pressed at 1000, clicks at 1500, 11500 and 21000 with a 10000 period
+	stream.state.start_ns = 1000;
+	stream.sched.period_ns = 10000;
+	stream.first_click_pending = true;
+	latency_click(&lat, &stream, 1500);
+	latency_click(&lat, &stream, 11500);
+	latency_click(&lat, &stream, 21000);
+
+	assert_int_equal(lat.press_to_click.total, 1);
+	assert_int_equal(lat.press_to_click.max, 500);
+	assert_int_equal(lat.interval_error.total, 2);
+	assert_int_equal(lat.interval_error.min, 0);
+	assert_int_equal(lat.interval_error.max, 500);
+
+	// Released at 20000, so one click went out after the release
+	stream.state.stop_ns = 20000;
+	latency_stop(&lat, &stream);
+	assert_int_equal(lat.release_to_last.total, 1);
+	assert_int_equal(lat.release_to_last.max, 1000);
+}
+
+//
+// Tests for xi_version_at_least()
+//
+
+static void test_xi_version_at_least(void** state)
+{
+	(void)state;
+
+	// XIQueryVersion() answers with the server's version when it's older than the one asked for
+	assert_true(xi_version_at_least(2, 1, 2, 1));
+	assert_true(xi_version_at_least(2, 4, 2, 1));
+	assert_true(xi_version_at_least(3, 0, 2, 1));
+	assert_false(xi_version_at_least(2, 0, 2, 1));
+	assert_false(xi_version_at_least(1, 5, 2, 1));
+}
+
+//
+// Tests for the button mask
+//
+
+static void test_button_mask_from_bytes(void** state)
+{
+	(void)state;
+
+	char bytes[32] = {0};
+	button_mask_t mask;
+
+	// Buttons 1, 9, 63, 64 and 255
+	bytes[0] = 1 << 1;
+	bytes[1] = 1 << 1;
+	bytes[7] = (char)(1 << 7);
+	bytes[8] = 1 << 0;
+	bytes[31] = (char)(1 << 7);
+	button_mask_from_bytes(bytes, sizeof(bytes), &mask);
+
+	assert_true(button_mask_test(&mask, 1));
+	assert_true(button_mask_test(&mask, 9));
+	assert_true(button_mask_test(&mask, 63));
+	assert_true(button_mask_test(&mask, 64));
+	assert_true(button_mask_test(&mask, 255));
+	assert_false(button_mask_test(&mask, 0));
+	assert_false(button_mask_test(&mask, 8));
+	assert_false(button_mask_test(&mask, 256));
+	assert_false(button_mask_test(&mask, -1));
+	assert_int_equal(button_mask_count(&mask), 5);
+}
+
+static void test_button_mask_next(void** state)
+{
+	(void)state;
+
+	button_mask_t mask = {{0}};
+	mask.bits[0] = (1ULL << 3) | (1ULL << 20);
+	mask.bits[2] = 1ULL << 5;
+
+	assert_int_equal(button_mask_next(&mask, 0), 3);
+	assert_int_equal(button_mask_next(&mask, 3), 3);
+	assert_int_equal(button_mask_next(&mask, 4), 20);
+	assert_int_equal(button_mask_next(&mask, 21), 133);
+	assert_int_equal(button_mask_next(&mask, 134), -1);
+}
+
+static void test_button_mask_empty(void** state)
+{
+	(void)state;
+
+	button_mask_t mask = {{0}};
+
+	assert_int_equal(button_mask_next(&mask, 1), -1);
+	assert_int_equal(button_mask_count(&mask), 0);
+}
+
+//
+// Tests for config reloading
+//
+
+static void test_reload_compatible(void** state)
+{
+	(void)state;
+
+	opts_t old_opts = {.num_devices = 1, .devices = {{.device_id = 10, .device_name = "Logitech M570"}}};
+	opts_t new_opts = old_opts;
+
+	// Rates, buttons and bindings can change freely
+	new_opts.delay_ns = 5 * NS_PER_MS;
+	new_opts.click_button = 3;
+	assert_true(reload_compatible(&old_opts, &new_opts));
+
+	// The same device, named instead of numbered
+	new_opts.devices[0].device_id = -1;
+	assert_true(reload_compatible(&old_opts, &new_opts));
+
+	new_opts.devices[0].device_name = "Foot Pedal";
+	assert_false(reload_compatible(&old_opts, &new_opts));
+
+	new_opts = old_opts;
+	new_opts.num_devices = 2;
+	assert_false(reload_compatible(&old_opts, &new_opts));
+
+	new_opts = old_opts;
+	new_opts.input = INPUT_EVDEV;
+	assert_false(reload_compatible(&old_opts, &new_opts));
+
+	new_opts = old_opts;
+	new_opts.stats_filename = "/tmp/ac.stats";
+	assert_false(reload_compatible(&old_opts, &new_opts));
+
+	new_opts = old_opts;
+	new_opts.control_path = "/tmp/ac.sock";
+	assert_false(reload_compatible(&old_opts, &new_opts));
+
+	// Realtime mode is only set up at startup
+	new_opts = old_opts;
+	new_opts.realtime = true;
+	assert_false(reload_compatible(&old_opts, &new_opts));
+
+	old_opts.realtime = true;
+	new_opts = old_opts;
+	new_opts.rt_cpu = 2;
+	assert_false(reload_compatible(&old_opts, &new_opts));
+	new_opts = old_opts;
+	new_opts.rt_priority = 50;
+	assert_false(reload_compatible(&old_opts, &new_opts));
+}
+
+static void test_carry_over_streams(void** state)
+{
+	(void)state;
+
+	opts_t old_opts = {
+		.num_bindings = 2,
+		.bindings = {
+			{.device = 0, .trigger_button = 9, .toggle_button = -1, .click_button = 1, .period_ns = 50},
+			{.device = 0, .trigger_button = -1, .toggle_button = 8, .click_button = 3, .period_ns = 200},
+		},
+	};
+	opts_t new_opts = {
+		.overrun = OVERRUN_SKIP,
+		.num_bindings = 2,
+		.bindings = {
+			{.device = 0, .trigger_button = -1, .toggle_button = 8, .click_button = 1, .period_ns = 100},
+			{.device = 0, .trigger_button = 7, .toggle_button = -1, .click_button = 1, .period_ns = 50},
+		},
+	};
+	click_stream_t old_streams[2] = {{{0}}};
+	click_stream_t new_streams[2];
+	static mock_backend_t mock;
+	output_t out = {.ops = &mock_output_ops, .mock = &mock};
+
+	memset(&mock, 0, sizeof(mock));
+	old_streams[0].pressed_button = 2;
+	old_streams[1].state.toggle_active = true;
+	old_streams[1].clicking = true;
+	old_streams[1].sched.next_ns = 12345;
+
+	carry_over_streams(&old_opts, old_streams, &new_opts, new_streams, &out);
+
+	// The hold binding is gone, so the drag it was part way through lets go
+	assert_int_equal(mock.num_events, 1);
+	assert_int_equal(mock.events[0].type, MOCK_RELEASE);
+	assert_int_equal(mock.events[0].button, 2);
+
+	// The toggle keeps running, at the new rate
+	assert_true(new_streams[0].state.toggle_active);
+	assert_true(new_streams[0].clicking);
+	assert_int_equal(new_streams[0].sched.next_ns, 12345);
+	assert_int_equal(new_streams[0].sched.period_ns, 100);
+	assert_int_equal(new_streams[0].sched.policy, OVERRUN_SKIP);
+
+	// The new binding starts from scratch
+	assert_false(should_click(&new_streams[1].state));
+	assert_false(new_streams[1].clicking);
+	assert_int_equal(new_streams[1].sched.period_ns, 50);
+}
+
+static void test_reload_opts(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config("dev_id 10\ntoggle_button 8\ndelay 50\n");
+	assert_non_null(filename);
+
+	char* argv[] = {"ac", "-f", filename};
+	int argc = 3;
+	opts_t opts = {0};
+	input_t in = {.type = INPUT_XI1};  // No devices open, so nothing to grab
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+
+	assert_true(read_opts(argc, argv, &opts) && finish_bindings(&opts));
+	streams[0].state.toggle_active = true;
+
+	// A new rate takes effect without losing the toggle
+	FILE* fp = fopen(filename, "w");
+	fputs("dev_id 10\ntoggle_button 8\nrate 100\nbind hold 9 3 5cps\n", fp);
+	fclose(fp);
+	assert_true(reload_opts(argc, argv, &opts, &in, NULL, streams, NULL));
+	assert_int_equal(opts.num_bindings, 2);
+	assert_int_equal(opts.bindings[1].period_ns, 10 * NS_PER_MS);
+	assert_true(streams[1].state.toggle_active);
+	assert_int_equal(streams[1].sched.period_ns, 10 * NS_PER_MS);
+
+	// A broken file keeps the current settings
+	fp = fopen(filename, "w");
+	fputs("dev_id 10\ntoggle_button 8\nrate fast\n", fp);
+	fclose(fp);
+	assert_false(reload_opts(argc, argv, &opts, &in, NULL, streams, NULL));
+	assert_int_equal(opts.num_bindings, 2);
+	assert_int_equal(opts.bindings[1].period_ns, 10 * NS_PER_MS);
+
+	// So does one that switches to another device
+	fp = fopen(filename, "w");
+	fputs("dev_id 11\ntoggle_button 8\n", fp);
+	fclose(fp);
+	assert_false(reload_opts(argc, argv, &opts, &in, NULL, streams, NULL));
+	assert_int_equal(opts.devices[0].device_id, 10);
+
+	cleanup_temp_config(filename);
+}
+
+static void test_reload_opts_sequence(void** state)
+{
+	(void)state;
+
+	char seq_filename[256];
+	char config[512];
+	snprintf(seq_filename, sizeof(seq_filename), "%s", create_temp_config("click 1\nwait 10\nclick 2\nwait 10\n"));
+	snprintf(config, sizeof(config), "dev_id 10\nbind toggle 8 sequence %s\n", seq_filename);
+	char* filename = create_temp_config(config);
+	assert_non_null(filename);
+
+	char* argv[] = {"ac", "-f", filename};
+	int argc = 3;
+	opts_t opts = {0};
+	input_t in = {.type = INPUT_XI1};
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+
+	assert_true(read_opts(argc, argv, &opts) && finish_bindings(&opts));
+	const sequence_t* seq = opts.bindings[0].sequence;
+	streams[0].sched.seq = seq;
+	streams[0].sched.seq_pos = 1;
+
+	// Reloading an unchanged sequence carries on where it was
+	FILE* fp = fopen(filename, "w");
+	fprintf(fp, "%srate 100\n", config);
+	fclose(fp);
+	assert_true(reload_opts(argc, argv, &opts, &in, NULL, streams, NULL));
+	assert_true(opts.bindings[0].sequence == seq);
+	assert_int_equal(streams[0].sched.seq_pos, 1);
+
+	// An edited one starts from the top
+	fp = fopen(seq_filename, "w");
+	fputs("click 3\nwait 10\n", fp);
+	fclose(fp);
+	assert_true(reload_opts(argc, argv, &opts, &in, NULL, streams, NULL));
+	assert_int_equal(opts.bindings[0].sequence->events[0].button, 3);
+	assert_int_equal(streams[0].sched.seq_pos, 0);
+
+	free_opts(&opts);
+	cleanup_temp_config(filename);
+	cleanup_temp_config(seq_filename);
+}
+
+static void test_free_opts(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config(
+		"dev_name Foot Pedal\n"
+		"bind hold 9 1 10 at 5,5 10,10\n"
+		"bind toggle 8 1 10 window 1,2 title Game\n"
+		"control /tmp/ac.sock\n"
+		"control /tmp/ac2.sock\n");
+	assert_non_null(filename);
+
+	char* argv[] = {"ac", "--stats-file", "/tmp/ac.stats", "-f", filename};
+	opts_t opts;
+
+	// Every string is the options' own copy, including the ones from the command line
+	assert_true(read_opts(5, argv, &opts));
+	cleanup_temp_config(filename);
+	assert_true(opts.stats_filename != argv[2]);
+	assert_string_equal(opts.stats_filename, "/tmp/ac.stats");
+	assert_string_equal(opts.control_path, "/tmp/ac2.sock");
+	assert_non_null(opts.bindings[0].sequence);
+	assert_non_null(opts.bindings[1].window);
+
+	free_opts(&opts);
+	assert_null(opts.devices[0].device_name);
+	assert_null(opts.stats_filename);
+	assert_null(opts.control_path);
+	assert_int_equal(opts.num_bindings, 0);
+}
+
+static void test_config_file_changed(void** state)
+{
+	(void)state;
+
+	char dir[] = "/tmp/autoclick_test_XXXXXX";
+	char path[64];
+	char other[64];
+	config_watch_t watch;
+
+	assert_non_null(mkdtemp(dir));
+	snprintf(path, sizeof(path), "%s/autoclick.conf", dir);
+	snprintf(other, sizeof(other), "%s/other.conf", dir);
+
+	assert_true(watch_config_file(&watch, path));
+	assert_false(config_file_changed(&watch));
+
+	// Other files in the same directory don't count
+	FILE* fp = fopen(other, "w");
+	fclose(fp);
+	assert_false(config_file_changed(&watch));
+
+	// Saving by renaming a new file over the old one does
+	rename(other, path);
+	assert_true(config_file_changed(&watch));
+
+	fp = fopen(path, "w");
+	fputs("delay 10\n", fp);
+	fclose(fp);
+	assert_true(config_file_changed(&watch));
+
+	close(watch.fd);
+	unlink(path);
+	rmdir(dir);
+}
+
+//
+// Tests for the control socket
+//
+
+static void test_read_opts_control(void** state)
+{
+	(void)state;
+
+	// A daemon driven only through the socket needs no device
+	char* argv[] = {"ac", "--control", "/tmp/ac.sock", "-r", "20"};
+	opts_t opts;
+
+	assert_true(read_opts(5, argv, &opts) && finish_bindings(&opts));
+	assert_string_equal(opts.control_path, "/tmp/ac.sock");
+	assert_int_equal(opts.num_devices, 0);
+	assert_int_equal(opts.num_bindings, 1);
+	assert_int_equal(remote_binding(&opts), 0);
+	assert_int_equal(opts.bindings[0].click_button, 1);
+	assert_int_equal(opts.bindings[0].period_ns, 50 * NS_PER_MS);
+	assert_true(validate_opts(&opts));
+
+	// Alongside a device, the remote binding comes last
+	char* argv2[] = {"ac", "-i", "10", "-t", "9", "--control", "/tmp/ac.sock"};
+	assert_true(read_opts(7, argv2, &opts) && finish_bindings(&opts));
+	assert_int_equal(opts.num_devices, 1);
+	assert_int_equal(opts.num_bindings, 2);
+	assert_int_equal(remote_binding(&opts), 1);
+	assert_int_equal(opts.bindings[0].device, 0);
+}
+
+static void test_handle_control_command(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--control", "/tmp/ac.sock"};
+	opts_t opts;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	char reply[128];
+
+	assert_true(read_opts(3, argv, &opts) && finish_bindings(&opts));
+
+	handle_control_command("start", &opts, streams, 100, reply, sizeof(reply));
+	assert_string_equal(reply, "ok");
+	assert_true(should_click(&streams[0].state));
+	assert_int_equal(streams[0].state.start_ns, 100);
+
+	handle_control_command("rate 20", &opts, streams, 200, reply, sizeof(reply));
+	assert_string_equal(reply, "ok");
+	assert_int_equal(opts.bindings[0].period_ns, 50 * NS_PER_MS);
+	assert_int_equal(streams[0].sched.period_ns, 50 * NS_PER_MS);
+
+	handle_control_command("interval 5ms", &opts, streams, 300, reply, sizeof(reply));
+	assert_string_equal(reply, "ok");
+	assert_int_equal(streams[0].sched.period_ns, 5 * NS_PER_MS);
+
+	handle_control_command("button 3", &opts, streams, 400, reply, sizeof(reply));
+	assert_string_equal(reply, "ok");
+	assert_int_equal(opts.bindings[0].click_button, 3);
+
+	streams[0].clicks = 7;
+	handle_control_command("status", &opts, streams, 500, reply, sizeof(reply));
+	assert_string_equal(reply, "clicking=1 button=3 interval_ns=5000000 clicks=7");
+
+	handle_control_command("stop", &opts, streams, 600, reply, sizeof(reply));
+	assert_string_equal(reply, "ok");
+	assert_false(should_click(&streams[0].state));
+	assert_int_equal(streams[0].state.stop_ns, 600);
+	assert_int_equal(streams[0].state.toggles, 2);
+
+	// Bad commands change nothing
+	handle_control_command("rate fast", &opts, streams, 700, reply, sizeof(reply));
+	assert_string_equal(reply, "error invalid rate");
+	handle_control_command("button 0", &opts, streams, 700, reply, sizeof(reply));
+	assert_string_equal(reply, "error invalid button");
+	handle_control_command("starting", &opts, streams, 700, reply, sizeof(reply));
+	assert_string_equal(reply, "error unknown command");
+	assert_int_equal(streams[0].sched.period_ns, 5 * NS_PER_MS);
+	assert_int_equal(opts.bindings[0].click_button, 3);
+	assert_false(should_click(&streams[0].state));
+}
+
+static void test_process_control(void** state)
+{
+	(void)state;
+
+	char dir_template[] = "/tmp/autoclick_test_XXXXXX";
+	char* dir = mkdtemp(dir_template);
+	assert_non_null(dir);
+
+	char path[256];
+	snprintf(path, sizeof(path), "%s/ctl.sock", dir);
+
+	char* argv[] = {"ac", "--control", path};
+	opts_t opts;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	control_t ctl;
+
+	assert_true(read_opts(3, argv, &opts) && finish_bindings(&opts));
+	assert_true(open_control(&ctl, path));
+
+	struct stat st;
+	assert_int_equal(stat(path, &st), 0);
+	assert_int_equal(st.st_mode & 0777, 0600);
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	strcpy(addr.sun_path, path);
+	assert_int_equal(connect(fd, (struct sockaddr*)&addr, sizeof(addr)), 0);
+
+	// A command split across writes only runs once it's complete
+	send(fd, "sta", 3, 0);
+	process_control(&ctl, &opts, streams, 100);
+	assert_false(should_click(&streams[0].state));
+
+	assert_true(ctl.clients[0].fd >= 0);
+
+	// The epoll set says when there's more to read
+	struct epoll_event ep;
+	assert_int_equal(epoll_wait(ctl.epoll_fd, &ep, 1, 0), 0);
+	send(fd, "rt\r\nstatus\n", 12, 0);
+	assert_int_equal(epoll_wait(ctl.epoll_fd, &ep, 1, 0), 1);
+
+	process_control(&ctl, &opts, streams, 200);
+	assert_true(should_click(&streams[0].state));
+
+	char reply[128] = {0};
+	ssize_t len = 0;
+	while (len < 4 || strchr(reply + 3, '\n') == NULL)
+	{
+		ssize_t n = recv(fd, reply + len, sizeof(reply) - 1 - len, 0);
+		assert_true(n > 0);
+		len += n;
+	}
+	assert_string_equal(reply, "ok\nclicking=1 button=1 interval_ns=50000000 clicks=0\n");
+
+	// Hanging up frees the client's slot
+	close(fd);
+	process_control(&ctl, &opts, streams, 300);
+	assert_int_equal(ctl.clients[0].fd, -1);
+
+	close_control(&ctl);
+	assert_int_not_equal(access(path, F_OK), 0);
+	rmdir(dir);
+}
+
+//
+// Tests for the input thread
+//
+
+static void test_click_ring(void** state)
+{
+	(void)state;
+
+	static click_ring_t ring;
+	click_event_t ev = {0};
+
+	assert_false(click_ring_pop(&ring, &ev));
+
+	// Fill it up, going round the end of the buffer on the way
+	for (int i = 0; i < CLICK_RING_SIZE / 2; ++i)
+	{
+		ev.binding = i;
+		assert_true(click_ring_push(&ring, &ev));
+		assert_true(click_ring_pop(&ring, &ev));
+	}
+	for (int i = 0; i < CLICK_RING_SIZE; ++i)
+	{
+		ev.binding = i;
+		assert_true(click_ring_push(&ring, &ev));
+	}
+	assert_false(click_ring_push(&ring, &ev));
+
+	// Events come out in the order they went in
+	for (int i = 0; i < CLICK_RING_SIZE; ++i)
+	{
+		assert_true(click_ring_pop(&ring, &ev));
+		assert_int_equal(ev.binding, i);
+	}
+	assert_false(click_ring_pop(&ring, &ev));
+}
+
+static void test_publish_click_state(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--threads", "-i", "10", "--bind", "hold:9:3:20cps", "-g", "8", "--control", "/tmp/ac.sock"};
+	static opts_t opts;
+	static input_thread_t t;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+
+	assert_true(read_opts(10, argv, &opts) && finish_bindings(&opts));
+	assert_int_equal(opts.num_bindings, 3);
+	assert_true(opts.threads);
+	t.opts = &opts;
+	t.wake_fd = eventfd(0, EFD_NONBLOCK);
+
+	// Nothing to say until a button does something
+	assert_true(publish_click_state(&t));
+	receive_click_events(&t, streams);
+	assert_false(should_click(&streams[0].state));
+
+	dispatch_button(&opts, t.streams, 0, 8, true, 100);
+	dispatch_button(&opts, t.streams, 0, 9, true, 200);
+	assert_true(publish_click_state(&t));
+	receive_click_events(&t, streams);
+	assert_true(should_click(&streams[0].state));
+	assert_int_equal(streams[0].state.start_ns, 200);
+	assert_true(should_click(&streams[1].state));
+	assert_int_equal(streams[1].state.start_ns, 100);
+	assert_int_equal(streams[1].state.toggles, 1);
+
+	// The control socket's binding is left to the clicking thread
+	set_remote_clicking(&streams[2].state, true, 300);
+	dispatch_button(&opts, t.streams, 0, 9, false, 400);
+	assert_true(publish_click_state(&t));
+	receive_click_events(&t, streams);
+	assert_false(should_click(&streams[0].state));
+	assert_int_equal(streams[0].state.stop_ns, 400);
+	assert_true(should_click(&streams[2].state));
+
+	close(t.wake_fd);
+}
+
+static void test_input_thread_start_stop(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--threads", "--control", "/tmp/ac.sock"};
+	static opts_t opts;
+	static input_thread_t t;
+	input_t in = {.type = INPUT_EVDEV};  // No devices, just an empty epoll set to wait on
+
+	assert_true(read_opts(4, argv, &opts) && finish_bindings(&opts));
+	in.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	assert_true(start_input_thread(&t, &in, &opts));
+	stop_input_thread(&t);
+	close(in.epoll_fd);
+}
+
+//
+// Tests for realtime mode
+//
+
+static void test_read_opts_realtime(void** state)
+{
+	(void)state;
+
+	opts_t opts;
+	char* argv[] = {"ac", "-i", "10", "-t", "9"};
+	assert_true(read_opts(5, argv, &opts));
+	assert_false(opts.realtime);
+
+	char* argv2[] = {"ac", "-i", "10", "-t", "9", "--rt-policy", "rr", "--rt-priority", "50", "--cpu", "2"};
+	assert_true(read_opts(11, argv2, &opts));
+	assert_true(opts.realtime);
+	assert_int_equal(opts.rt_policy, SCHED_RR);
+	assert_int_equal(opts.rt_priority, 50);
+	assert_int_equal(opts.rt_cpu, 2);
+
+	char* argv3[] = {"ac", "-i", "10", "-t", "9", "--realtime"};
+	assert_true(read_opts(6, argv3, &opts));
+	assert_true(opts.realtime);
+	assert_int_equal(opts.rt_policy, SCHED_FIFO);
+	assert_int_equal(opts.rt_priority, 10);
+	assert_int_equal(opts.rt_cpu, -1);
+
+	char* bad_priority[] = {"ac", "-i", "10", "-t", "9", "--rt-priority", "100"};
+	assert_false(read_opts(7, bad_priority, &opts));
+	char* bad_cpu[] = {"ac", "-i", "10", "-t", "9", "--cpu", "x"};
+	assert_false(read_opts(7, bad_cpu, &opts));
+	char* bad_policy[] = {"ac", "-i", "10", "-t", "9", "--rt-policy", "idle"};
+	assert_false(read_opts(7, bad_policy, &opts));
+}
+
+static void test_realtime_describe(void** state)
+{
+	(void)state;
+
+	opts_t opts = {.realtime = true, .rt_policy = SCHED_FIFO, .rt_priority = 10, .rt_cpu = -1};
+	realtime_status_t status = {.sched = false, .mlock = false, .slack = true};
+	char desc[160];
+
+	// Without privileges, only the timer slack sticks
+	realtime_describe(&opts, &status, desc, sizeof(desc));
+	assert_string_equal(desc, "SCHED_FIFO priority 10 failed, mlockall failed, timer slack on");
+
+	opts.rt_policy = SCHED_RR;
+	opts.rt_cpu = 3;
+	status = (realtime_status_t){true, true, true, true};
+	realtime_describe(&opts, &status, desc, sizeof(desc));
+	assert_string_equal(desc, "SCHED_RR priority 10 on, mlockall on, cpu 3 on, timer slack on");
+}
+
+//
+// Tests for the event loop
+//
+
+static void test_wait_for_events(void** state)
+{
+	(void)state;
+
+	event_loop_t loop;
+	assert_true(open_event_loop(&loop));
+
+	// The timer fires at the deadline, and not before
+	uint64_t deadline_ns = monotonic_ns() + 2 * NS_PER_MS;
+	assert_int_equal(wait_for_events(&loop, deadline_ns), WAKE_TIMER);
+	assert_true(monotonic_ns() >= deadline_ns);
+
+	// Another source, like the config watch
+	int fds[2];
+	assert_int_equal(pipe(fds), 0);
+	assert_true(watch_event_source(&loop, fds[0], WAKE_CONFIG));
+	assert_int_equal(write(fds[1], "x", 1), 1);
+	assert_int_equal(wait_for_events(&loop, 0), WAKE_CONFIG);
+
+	close(fds[0]);
+	close(fds[1]);
+	close_event_loop(&loop);
+}
+
+static void test_read_signals(void** state)
+{
+	(void)state;
+
+	event_loop_t loop;
+	bool reload = false;
+	assert_true(open_event_loop(&loop));
+
+	// The signals are blocked, so they only show up through the loop
+	raise(SIGUSR1);
+	raise(SIGHUP);
+	assert_int_equal(wait_for_events(&loop, 0), WAKE_SIGNAL);
+	read_signals(&loop, &reload);
+	assert_true(dump_requested);
+	assert_true(reload);
+	assert_true(running);
+
+	raise(SIGTERM);
+	assert_int_equal(wait_for_events(&loop, 0), WAKE_SIGNAL);
+	read_signals(&loop, &reload);
+	assert_false(running);
+
+	running = 1;
+	dump_requested = 0;
+	close_event_loop(&loop);
+}
+
+static void test_defer_signals(void** state)
+{
+	(void)state;
+
+	struct sigaction sa, old;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = handle_dump_signal;
+	sigaction(SIGUSR1, &sa, &old);
+	defer_signals();
+
+	// A signal that arrives before the wait is held for it, and cuts it short
+	raise(SIGUSR1);
+	assert_false(dump_requested);
+	uint64_t start_ns = monotonic_ns();
+	wait_for_fds(NULL, 0, start_ns + NS_PER_SEC);
+	assert_true(dump_requested);
+	assert_true(monotonic_ns() - start_ns < NS_PER_SEC / 2);
+
+	signals_deferred = false;
+	dump_requested = 0;
+	sigaction(SIGUSR1, &old, NULL);
+}
+
+//
+// Tests for recording and replay
+//
+
+static void test_read_opts_record_replay(void** state)
+{
+	(void)state;
+
+	char* record_argv[] = {"ac", "--record", "session.rec", "-i", "10"};
+	char* replay_argv[] = {"ac", "--replay", "session.rec", "--speed", "2.5", "--output", "uinput"};
+	char* zero_argv[] = {"ac", "--replay", "session.rec", "--speed", "0"};
+	char* bad_argv[] = {"ac", "--replay", "session.rec", "--speed", "fast"};
+	char* missing_argv[] = {"ac", "--record"};
+	opts_t opts = {0};
+
+	assert_true(read_opts(5, record_argv, &opts));
+	assert_string_equal(opts.record_filename, "session.rec");
+	assert_null(opts.replay_filename);
+	assert_int_equal(opts.devices[0].device_id, 10);
+	assert_true(opts.replay_speed == 1.0);
+
+	assert_true(read_opts(7, replay_argv, &opts));
+	assert_null(opts.record_filename);
+	assert_string_equal(opts.replay_filename, "session.rec");
+	assert_true(opts.replay_speed == 2.5);
+
+	assert_false(read_opts(5, zero_argv, &opts));
+	assert_false(read_opts(5, bad_argv, &opts));
+	assert_false(read_opts(2, missing_argv, &opts));
+}
+
+static void test_record_and_open_recording(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config("");
+	recorder_t rec;
+	recording_t recording;
+	assert_non_null(filename);
+
+	FILE* fp = fopen(filename, "wb");
+	assert_non_null(fp);
+	assert_true(start_recording(&rec, fp, 1000));
+
+	// Deltas are whole microseconds, and the rounding doesn't add up over several records
+	assert_true(write_record(&rec, 1000 + 2500, REC_PRESS, 1, 0, 0));
+	assert_true(write_record(&rec, 1000 + 5000, REC_RELEASE, 1, 0, 0));
+
+	// A gap too long for one delta gets a wait record in front
+	uint64_t long_ns = 1000 + 5000 + ((uint64_t)UINT32_MAX + 7) * NS_PER_US;
+	unsigned char mask[1] = {0x3};
+	double values[2] = {1.5, -0.75};
+	XIRawEvent raw = {.valuators = {1, mask, values}};
+	assert_true(record_raw_event(&rec, XI_RawMotion, &raw, long_ns));
+
+	// Fractions of a pixel are carried over to the next motion
+	assert_true(record_raw_event(&rec, XI_RawMotion, &raw, long_ns + NS_PER_MS));
+	assert_int_equal(rec.records, 5);
+	fclose(fp);
+
+	assert_true(open_recording(&recording, filename));
+	cleanup_temp_config(filename);
+	assert_int_equal(recording.num_records, 5);
+
+	const record_t* r = recording.records;
+	assert_int_equal(r[0].type, REC_PRESS);
+	assert_int_equal(r[0].button, 1);
+	assert_int_equal(r[0].delta_us, 2);
+	assert_int_equal(r[1].type, REC_RELEASE);
+	assert_int_equal(r[1].delta_us, 3);
+	assert_int_equal(r[2].type, REC_WAIT);
+	assert_int_equal(r[2].delta_us, UINT32_MAX);
+	assert_int_equal(r[3].type, REC_MOTION);
+	assert_int_equal(r[3].delta_us, 7);
+	assert_int_equal(r[3].dx, 1);
+	assert_int_equal(r[3].dy, 0);
+	assert_int_equal(r[4].delta_us, 1000);
+	assert_int_equal(r[4].dx, 2);
+	assert_int_equal(r[4].dy, -1);
+
+	close_recording(&recording);
+}
+
+static void test_open_recording_invalid(void** state)
+{
+	(void)state;
+
+	recording_t recording;
+	record_header_t header = {RECORD_MAGIC, sizeof(record_t), 0};
+	char contents[sizeof(header) + 3];
+
+	assert_false(open_recording(&recording, "/nonexistent/session.rec"));
+
+	// Too short for a header
+	char* filename = create_temp_config("ACREC");
+	assert_false(open_recording(&recording, filename));
+	cleanup_temp_config(filename);
+
+	// Not a recording
+	filename = create_temp_config("# autoclick config\ndelay 50\n");
+	assert_false(open_recording(&recording, filename));
+	cleanup_temp_config(filename);
+
+	// Cut off partway through a record
+	memcpy(contents, &header, sizeof(header));
+	memset(contents + sizeof(header), 0, 3);
+	filename = create_temp_config("");
+	FILE* fp = fopen(filename, "wb");
+	fwrite(contents, sizeof(contents), 1, fp);
+	fclose(fp);
+	assert_false(open_recording(&recording, filename));
+	cleanup_temp_config(filename);
+}
+
+static void test_replay_recording(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config("");
+	recorder_t rec;
+	recording_t recording;
+	assert_non_null(filename);
+
+	// 100ms of recording: a left click, a move and a right button that's never released
+	FILE* fp = fopen(filename, "wb");
+	assert_true(start_recording(&rec, fp, 0));
+	assert_true(write_record(&rec, 10 * NS_PER_MS, REC_PRESS, 1, 0, 0));
+	assert_true(write_record(&rec, 20 * NS_PER_MS, REC_RELEASE, 1, 0, 0));
+	assert_true(write_record(&rec, 50 * NS_PER_MS, REC_MOTION, 0, 3, -2));
+	assert_true(write_record(&rec, 100 * NS_PER_MS, REC_PRESS, 3, 0, 0));
+	fclose(fp);
+	assert_true(open_recording(&recording, filename));
+	cleanup_temp_config(filename);
+
+	int fds[2];
+	assert_int_equal(pipe(fds), 0);
+	output_t out = {&uinput_output_ops, OUTPUT_UINPUT, NULL, fds[1], NULL};
+
+	// Ten times as fast takes a tenth of the time
+	uint64_t start_ns = monotonic_ns();
+	assert_int_equal(replay_recording(&recording, &out, 10.0), 4);
+	assert_true(monotonic_ns() - start_ns >= 10 * NS_PER_MS);
+	close_recording(&recording);
+
+	struct input_event ev[16];
+	ssize_t len = read(fds[0], ev, sizeof(ev));
+	assert_int_equal(len, 11 * sizeof(ev[0]));
+
+	assert_int_equal(ev[0].code, BTN_LEFT);
+	assert_int_equal(ev[0].value, 1);
+	assert_int_equal(ev[1].type, EV_SYN);
+	assert_int_equal(ev[2].code, BTN_LEFT);
+	assert_int_equal(ev[2].value, 0);
+	assert_int_equal(ev[4].type, EV_REL);
+	assert_int_equal(ev[4].code, REL_X);
+	assert_int_equal(ev[4].value, 3);
+	assert_int_equal(ev[5].code, REL_Y);
+	assert_int_equal(ev[5].value, -2);
+	assert_int_equal(ev[6].type, EV_SYN);
+	assert_int_equal(ev[7].code, BTN_RIGHT);
+	assert_int_equal(ev[7].value, 1);
+
+	// The held button is let go at the end
+	assert_int_equal(ev[9].code, BTN_RIGHT);
+	assert_int_equal(ev[9].value, 0);
+	assert_int_equal(ev[10].type, EV_SYN);
+
+	close(fds[0]);
+	close(fds[1]);
+}
+
+//
+// Tests for the mock backend
+//
+
+static void test_mock_input(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-i", "10", "-t", "9", "-g", "8"};
+	opts_t opts = {0};
+	static mock_backend_t mock;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+
+	memset(&mock, 0, sizeof(mock));
+	assert_true(read_opts(7, argv, &opts));
+	assert_true(finish_bindings(&opts));
+	opts.mock = &mock;
+
+	// Mock input is polled, and the bound buttons are grabbed
+	assert_true(open_input(&in, &opts, NULL, streams));
+	assert_int_equal(in.type, INPUT_XI1);
+	assert_true(mock.devices[0].open);
+	assert_true(button_mask_test(&mock.devices[0].grabbed, 9));
+	assert_true(button_mask_test(&mock.devices[0].grabbed, 8));
+
+	mock_set_button(&mock, 10, 9, true);
+	process_input(&in, &opts, streams);
+	assert_true(streams[0].state.trigger_held);
+	assert_int_equal(mock.queries, 1);
+
+	mock_set_button(&mock, 10, 9, false);
+	mock_set_button(&mock, 10, 8, true);
+	process_input(&in, &opts, streams);
+	mock_set_button(&mock, 10, 8, false);
+	process_input(&in, &opts, streams);
+	assert_false(streams[0].state.trigger_held);
+	assert_true(streams[0].state.toggle_active);
+
+	// Closing gives the buttons back
+	close_input(&in);
+	assert_false(mock.devices[0].open);
+	assert_int_equal(button_mask_count(&mock.devices[0].grabbed), 0);
+}
+
+static void test_mock_input_full(void** state)
+{
+	(void)state;
+
+	static mock_backend_t mock;
+	input_t in = {.mock = &mock};
+	input_device_t d = {.device_id = 99};
+
+	// With no room for another device, an unknown one can't be grabbed, and the rest do nothing
+	memset(&mock, 0, sizeof(mock));
+	mock.num_devices = MAX_DEVICES;
+	assert_false(mock_open_device(&in, &d));
+	assert_false(mock_grab_button(&in, &d, 9));
+	mock_ungrab_button(&in, &d, 9);
+	mock_close_device(&in, &d);
+	assert_int_equal(mock.num_devices, MAX_DEVICES);
+}
+
+static void test_run_clicks(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-i", "10", "-t", "9", "-d", "10", "-b", "3"};
+	opts_t opts = {0};
+	static mock_backend_t mock;
+	static loop_stats_t stats;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+	output_t out;
+
+	memset(&mock, 0, sizeof(mock));
+	memset(&stats, 0, sizeof(stats));
+	assert_true(read_opts(9, argv, &opts));
+	assert_true(finish_bindings(&opts));
+	opts.mock = &mock;
+	streams[0].sched.period_ns = opts.bindings[0].period_ns;
+	assert_true(open_input(&in, &opts, NULL, streams));
+	assert_true(open_output(&out, &opts, NULL));
+
+	// Nothing held, nothing to do
+	process_input(&in, &opts, streams);
+	assert_int_equal(run_clicks(&opts, streams, &out, 1000, &stats, NULL), 0);
+
+	// The first click goes out straight away, the next one is a period later
+	mock_set_button(&mock, 10, 9, true);
+	process_input(&in, &opts, streams);
+	assert_int_equal(run_clicks(&opts, streams, &out, 1000, &stats, NULL), 1000 + 10 * NS_PER_MS);
+	assert_int_equal(mock.num_events, 1);
+	assert_int_equal(mock.events[0].type, MOCK_CLICK);
+	assert_int_equal(mock.events[0].button, 3);
+	assert_int_equal(run_clicks(&opts, streams, &out, 1000 + 5 * NS_PER_MS, &stats, NULL), 1000 + 10 * NS_PER_MS);
+	assert_int_equal(mock.num_events, 1);
+
+	// Waking up late catches up on the missed clicks
+	assert_int_equal(run_clicks(&opts, streams, &out, 1000 + 30 * NS_PER_MS, &stats, NULL), 1000 + 40 * NS_PER_MS);
+	assert_int_equal(mock.num_events, 4);
+	assert_int_equal(stats.clicks, 4);
+	assert_int_equal(streams[0].clicks, 4);
+	assert_int_equal(stats.emit.count, 4);
+	for (int i = 1; i < mock.num_events; ++i)
+	{
+		assert_true(mock.events[i].time_ns >= mock.events[i - 1].time_ns);
+	}
+
+	// Letting go stops the stream
+	mock_set_button(&mock, 10, 9, false);
+	process_input(&in, &opts, streams);
+	assert_int_equal(run_clicks(&opts, streams, &out, 1000 + 45 * NS_PER_MS, &stats, NULL), 0);
+	assert_false(streams[0].clicking);
+	assert_int_equal(mock.total_events, 4);
+
+	emit_motion(&out, 4, -1);
+	emit_button(&out, 2, true);
+	assert_int_equal(mock.events[4].type, MOCK_MOTION);
+	assert_int_equal(mock.events[4].dx, 4);
+	assert_int_equal(mock.events[5].type, MOCK_PRESS);
+
+	close_output(&out);
+	close_input(&in);
+}
+
+static void test_run_clicks_drag(void** state)
+{
+	(void)state;
+
+	char* filename = create_temp_config("drag 1 4ms 0,0 40,0\nwait 10\n");
+	char bind[300];
+	char* argv[] = {"ac", "-i", "10", "--bind", bind};
+	opts_t opts = {0};
+	static mock_backend_t mock;
+	static loop_stats_t stats;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+	output_t out;
+
+	assert_non_null(filename);
+	snprintf(bind, sizeof(bind), "hold:8:sequence:%s", filename);
+	memset(&mock, 0, sizeof(mock));
+	memset(&stats, 0, sizeof(stats));
+	assert_true(read_opts(5, argv, &opts));
+	assert_true(finish_bindings(&opts));
+	cleanup_temp_config(filename);
+	opts.mock = &mock;
+	init_streams(&opts, streams);
+	assert_true(open_input(&in, &opts, NULL, streams));
+	assert_true(open_output(&out, &opts, NULL));
+
+	// The move to the start and the press go out in one flush
+	mock_set_button(&mock, 10, 8, true);
+	process_input(&in, &opts, streams);
+	run_clicks(&opts, streams, &out, 1000, &stats, NULL);
+	assert_int_equal(mock.num_events, 2);
+	assert_int_equal(mock.events[0].type, MOCK_MOVE_TO);
+	assert_int_equal(mock.events[0].dx, 0);
+	assert_int_equal(mock.events[1].type, MOCK_PRESS);
+	assert_int_equal(mock.flushes, 1);
+	assert_int_equal(streams[0].pressed_button, 1);
+
+	// Each move is a flush of its own
+	run_clicks(&opts, streams, &out, 1000 + 2 * NS_PER_MS, &stats, NULL);
+	assert_int_equal(mock.num_events, 4);
+	assert_int_equal(mock.events[3].type, MOCK_MOVE_TO);
+	assert_int_equal(mock.events[3].dx, 20);
+	assert_int_equal(mock.flushes, 3);
+	assert_int_equal(stats.clicks, 1);
+
+	// Letting go part way through lets go of the drag's button too
+	mock_set_button(&mock, 10, 8, false);
+	process_input(&in, &opts, streams);
+	run_clicks(&opts, streams, &out, 1000 + 3 * NS_PER_MS, &stats, NULL);
+	assert_int_equal(mock.num_events, 5);
+	assert_int_equal(mock.events[4].type, MOCK_RELEASE);
+	assert_int_equal(mock.events[4].button, 1);
+	assert_int_equal(streams[0].pressed_button, 0);
+
+	close_output(&out);
+	close_input(&in);
+}
+
+static void test_run_clicks_interleaved(void** state)
+{
+	(void)state;
+
+	opts_t opts = {
+		.num_bindings = 2,
+		.bindings = {
+			{.device = 0, .trigger_button = 9, .toggle_button = -1, .click_button = 1, .period_ns = 10 * NS_PER_MS},
+			{.device = 0, .trigger_button = 8, .toggle_button = -1, .click_button = 3, .period_ns = 15 * NS_PER_MS},
+		},
+	};
+	static mock_backend_t mock;
+	static loop_stats_t stats;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	output_t out;
+
+	memset(&mock, 0, sizeof(mock));
+	memset(&stats, 0, sizeof(stats));
+	opts.mock = &mock;
+	init_streams(&opts, streams);
+	assert_true(open_output(&out, &opts, NULL));
+	streams[0].state.trigger_held = true;
+	streams[1].state.trigger_held = true;
+	run_clicks(&opts, streams, &out, 1000, &stats, NULL);
+	assert_int_equal(mock.num_events, 2);
+
+	// Both streams catch up, their missed clicks going out in the order they were due
+	int buttons[] = {1, 3, 1, 1, 3, 1};
+	assert_int_equal(run_clicks(&opts, streams, &out, 1000 + 40 * NS_PER_MS, &stats, NULL), 1000 + 45 * NS_PER_MS);
+	assert_int_equal(mock.num_events, 8);
+	for (int i = 0; i < 6; ++i)
+	{
+		assert_int_equal(mock.events[2 + i].button, buttons[i]);
+	}
+	assert_int_equal(streams[0].clicks, 5);
+	assert_int_equal(streams[1].clicks, 3);
+
+	close_output(&out);
+}
+
+//
+// Tests for the XCB backend
+//
+
+static void test_read_opts_xcb(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "--xcb", "-i", "10", "-t", "9"};
+	opts_t opts = {0};
+
+#ifdef HAVE_XCB
+	assert_true(read_opts(6, argv, &opts));
+	assert_true(opts.xcb);
+#else
+	assert_false(read_opts(6, argv, &opts));
+#endif
+}
+
+#ifdef HAVE_XCB
+static void test_xcb_button_mask(void** state)
+{
+	(void)state;
+
+	// A key class, then buttons 1 and 9 held
+	static uint8_t buf[sizeof(xcb_input_query_device_state_reply_t) + 36 + 36];
+	xcb_input_query_device_state_reply_t* reply = (xcb_input_query_device_state_reply_t*)buf;
+	uint8_t* classes = (uint8_t*)(reply + 1);
+	button_mask_t mask;
+
+	memset(buf, 0, sizeof(buf));
+	reply->num_classes = 2;
+	reply->length = (36 + 36) / 4;
+	classes[0] = KeyClass;
+	classes[1] = 36;
+	classes[36] = ButtonClass;
+	classes[37] = 36;
+	classes[38] = 16;
+	classes[40] = 1 << 1;
+	classes[41] = 1 << 1;
+
+	assert_true(xcb_button_mask(reply, &mask));
+	assert_true(button_mask_test(&mask, 1));
+	assert_true(button_mask_test(&mask, 9));
+	assert_int_equal(button_mask_count(&mask), 2);
+
+	// A reply that's cut short has no buttons in it
+	reply->length = 36 / 4;
+	assert_false(xcb_button_mask(reply, &mask));
+}
+#endif
+
+//
+// Tests for device hotplug
+//
+
+static void test_device_table(void** state)
+{
+	(void)state;
+
+	device_table_t table = {0};
+
+	assert_true(device_table_add(&table, 2, "Virtual core pointer"));
+	assert_true(device_table_add(&table, 11, "Logitech M570"));
+	assert_string_equal(device_table_name(&table, 11), "Logitech M570");
+	assert_null(device_table_name(&table, 12));
+
+	// An ID that's reused gets the new device's name
+	assert_true(device_table_add(&table, 11, "Logitech G502"));
+	assert_int_equal(table.count, 2);
+	assert_string_equal(device_table_name(&table, 11), "Logitech G502");
+
+	device_table_remove(&table, 2);
+	assert_null(device_table_name(&table, 2));
+	assert_string_equal(device_table_name(&table, 11), "Logitech G502");
+	device_table_remove(&table, 2);
+	assert_int_equal(table.count, 1);
+
+	device_table_clear(&table);
+	assert_int_equal(table.count, 0);
+}
+
+static void test_hotplug_device(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-n", "Logitech M570", "-t", "9"};
+	opts_t opts = {0};
+	static mock_backend_t mock;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+
+	memset(&mock, 0, sizeof(mock));
+	assert_true(read_opts(5, argv, &opts));
+	assert_true(finish_bindings(&opts));
+	opts.devices[0].device_id = 10;  // What resolve_devices() would have found
+	opts.mock = &mock;
+	assert_true(open_input(&in, &opts, NULL, streams));
+
+	mock_set_button(&mock, 10, 9, true);
+	process_input(&in, &opts, streams);
+	assert_true(streams[0].state.trigger_held);
+
+	// Unplugging lets go of the trigger, and the device isn't polled any more
+	assert_int_equal(hotplug_device(&in, &opts, streams, 10, NULL, false), -1);
+	assert_false(streams[0].state.trigger_held);
+	assert_int_equal(in.devices[0].device_id, -1);
+	assert_false(mock_device(&mock, 10)->open);
+	int queries = mock.queries;
+	process_input(&in, &opts, streams);
+	assert_int_equal(mock.queries, queries);
+
+	// Some other device coming along doesn't count
+	assert_int_equal(hotplug_device(&in, &opts, streams, 12, "Some Keyboard", true), -1);
+	assert_int_equal(in.devices[0].device_id, -1);
+
+	// The same device comes back under a new ID, grabbed and with its trigger already held
+	mock_set_button(&mock, 14, 9, true);
+	assert_int_equal(hotplug_device(&in, &opts, streams, 14, "Logitech M570", true), 0);
+	assert_int_equal(in.devices[0].device_id, 14);
+	assert_true(mock_device(&mock, 14)->open);
+	assert_true(button_mask_test(&mock_device(&mock, 14)->grabbed, 9));
+	assert_true(streams[0].state.trigger_held);
+
+	mock_set_button(&mock, 14, 9, false);
+	process_input(&in, &opts, streams);
+	assert_false(streams[0].state.trigger_held);
+
+	close_input(&in);
+	assert_false(mock_device(&mock, 14)->open);
+	assert_int_equal(button_mask_count(&mock_device(&mock, 14)->grabbed), 0);
+}
+
+static void test_hotplug_device_toggle(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-i", "10", "-g", "8"};
+	opts_t opts = {0};
+	static mock_backend_t mock;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+
+	memset(&mock, 0, sizeof(mock));
+	assert_true(read_opts(5, argv, &opts));
+	assert_true(finish_bindings(&opts));
+	opts.mock = &mock;
+	assert_true(open_input(&in, &opts, NULL, streams));
+
+	mock_set_button(&mock, 10, 8, true);
+	process_input(&in, &opts, streams);
+	mock_set_button(&mock, 10, 8, false);
+	process_input(&in, &opts, streams);
+	assert_true(streams[0].state.toggle_active);
+
+	// An unplugged device's toggle can't be switched off any more, so it stops with the device
+	assert_int_equal(hotplug_device(&in, &opts, streams, 10, NULL, false), -1);
+	assert_false(streams[0].state.toggle_active);
+	assert_false(should_click(&streams[0].state));
+
+	// Coming back with the toggle held down doesn't switch it back on
+	mock_set_button(&mock, 10, 8, true);
+	assert_int_equal(hotplug_device(&in, &opts, streams, 10, NULL, true), 0);
+	assert_false(streams[0].state.toggle_active);
+
+	close_input(&in);
+}
+
+//
+// Tests for multi-display mode
+//
+
+static void test_read_opts_displays(void** state)
+{
+	(void)state;
+
+	char* filename = strdup(create_temp_config("dev_id 10\ntrigger_button 9\ndisplay :1\ndisplay :2 /etc/ac/two.conf # rig 2\n"));
+	char* argv[] = {"ac", "--display", ":3", "-f", filename};
+	opts_t opts = {0};
+
+	assert_true(read_opts(5, argv, &opts));
+	assert_int_equal(opts.num_displays, 3);
+	assert_string_equal(opts.displays[0].name, ":3");
+	assert_null(opts.displays[0].config_filename);
+	assert_string_equal(opts.displays[1].name, ":1");
+	assert_null(opts.displays[1].config_filename);
+	assert_string_equal(opts.displays[2].name, ":2");
+	assert_string_equal(opts.displays[2].config_filename, "/etc/ac/two.conf");
+
+	char* argv_bad[] = {"ac", "--display", " "};
+	assert_false(read_opts(3, argv_bad, &opts));
+
+	cleanup_temp_config(filename);
+	free(filename);
+}
+
+static void test_read_display_opts(void** state)
+{
+	(void)state;
+
+	char* filename = strdup(create_temp_config("dev_name Xvfb mouse\ntoggle_button 1\nrate 100\n"));
+	char* argv[] = {"ac", "-i", "10", "-t", "9", "--display", ":1", "--display", ":2"};
+	opts_t opts = {0};
+	static opts_t display_opts;
+	display_opts_t own = {":3", filename};
+
+	assert_true(read_opts(9, argv, &opts));
+	assert_true(finish_bindings(&opts));
+
+	// Displays without a config file of their own share the main options
+	assert_true(read_display_opts(&opts, &opts.displays[0], "ac", &display_opts));
+	assert_true(validate_display_opts(&opts.displays[0], &display_opts));
+	assert_int_equal(display_opts.num_displays, 0);
+	assert_int_equal(display_opts.devices[0].device_id, 10);
+	assert_int_equal(display_opts.bindings[0].trigger_button, 9);
+
+	// ...and the others get only what's in their file
+	assert_true(read_display_opts(&opts, &own, "ac", &display_opts));
+	assert_true(validate_display_opts(&own, &display_opts));
+	assert_string_equal(display_opts.devices[0].device_name, "Xvfb mouse");
+	assert_int_equal(display_opts.bindings[0].toggle_button, 1);
+	assert_int_equal(display_opts.bindings[0].period_ns, 10 * NS_PER_MS);
+
+	// Nothing that doesn't belong to one display
+	display_opts.input = INPUT_EVDEV;
+	assert_false(validate_display_opts(&own, &display_opts));
+	display_opts.input = INPUT_XI2;
+	display_opts.threads = true;
+	assert_false(validate_display_opts(&own, &display_opts));
+
+	cleanup_temp_config(filename);
+	free(filename);
+}
+
+/**
+ * Set up a display session on the mock backend, clicking button 1 every period_ms while button 9
+ * on device 10 is held.
+ */
+static void open_mock_session(display_session_t* s, mock_backend_t* mock, const char* name, const char* period_ms)
+{
+	char* argv[] = {"ac", "-i", "10", "-t", "9", "-d", (char*)period_ms};
+
+	memset(s, 0, sizeof(*s));
+	memset(mock, 0, sizeof(*mock));
+	s->name = name;
+	assert_true(read_opts(7, argv, &s->opts));
+	assert_true(finish_bindings(&s->opts));
+	s->opts.mock = mock;
+	init_streams(&s->opts, s->streams);
+	s->poll_ns = poll_interval(&s->opts);
+	assert_true(open_input(&s->input, &s->opts, NULL, s->streams));
+	assert_true(open_output(&s->output, &s->opts, NULL));
+}
+
+static void test_service_display(void** state)
+{
+	(void)state;
+
+	static display_session_t sessions[2];
+	static mock_backend_t mocks[2];
+
+	open_mock_session(&sessions[0], &mocks[0], ":1", "10");
+	open_mock_session(&sessions[1], &mocks[1], ":2", "4");
+
+	// Both are polled straight away, with nothing held
+	assert_int_equal(service_display(&sessions[0], 1000), sessions[0].next_poll_ns);
+	assert_int_equal(service_display(&sessions[1], 1000), sessions[1].next_poll_ns);
+	assert_int_equal(mocks[0].queries, 1);
+	assert_int_equal(mocks[1].queries, 1);
+
+	// A display that isn't due anything isn't touched
+	assert_int_not_equal(service_display(&sessions[0], 2000), 0);
+	assert_int_equal(mocks[0].queries, 1);
+
+	// Holding the trigger on one display only clicks there, on that display's schedule
+	mock_set_button(&mocks[1], 10, 9, true);
+	uint64_t now_ns = monotonic_ns();
+	service_display(&sessions[0], sessions[0].next_poll_ns);
+	service_display(&sessions[1], sessions[1].next_poll_ns);
+	assert_int_equal(mocks[0].num_events, 0);
+	assert_int_equal(mocks[1].num_events, 1);
+	assert_true(sessions[1].next_click_ns >= now_ns + 4 * NS_PER_MS);
+	assert_true(sessions[1].next_click_ns <= monotonic_ns() + 4 * NS_PER_MS);
+	assert_int_equal(sessions[0].next_click_ns, 0);
+	assert_int_equal(sessions[1].stats.clicks, 1);
+	assert_int_equal(sessions[0].stats.clicks, 0);
+
+	for (int d = 0; d < 2; ++d)
+	{
+		close_output(&sessions[d].output);
+		close_input(&sessions[d].input);
+	}
+}
+
+static void test_display_window_targets(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-i", "10", "--bind", "hold:8:1:10:window:30,40:class:Game", "--display", ":1", "--display", ":2"};
+	opts_t opts = {0};
+	static display_session_t sessions[2];
+
+	assert_true(read_opts(9, argv, &opts));
+	assert_true(finish_bindings(&opts));
+
+	// Displays sharing the main options each look the window up on their own connection
+	for (int d = 0; d < 2; ++d)
+	{
+		memset(&sessions[d], 0, sizeof(sessions[d]));
+		assert_true(read_display_opts(&opts, &opts.displays[d], "ac", &sessions[d].opts));
+	}
+	window_target_t* first = sessions[0].opts.bindings[0].window;
+	window_target_t* second = sessions[1].opts.bindings[0].window;
+	assert_true(first != opts.bindings[0].window);
+	assert_true(first != second);
+	assert_string_equal(second->value, "Game");
+	assert_int_equal(second->x, 30);
+
+	// What one display finds stays with it
+	first->window = 0x200001;
+	first->subwindow = 0x200002;
+	first->lookup_due = false;
+	assert_int_equal(second->window, None);
+	assert_int_equal(second->subwindow, None);
+	assert_true(second->lookup_due);
+	assert_int_equal(opts.bindings[0].window->window, None);
+
+	for (int d = 0; d < 2; ++d)
+	{
+		free_display_opts(&opts.displays[d], &sessions[d].opts);
+		assert_null(sessions[d].opts.bindings[0].window);
+	}
+	assert_string_equal(opts.bindings[0].window->value, "Game");
+	free_opts(&opts);
+}
+
+//
+// Tests for window targets
+//
+
+static void test_parse_binding_window(void** state)
+{
+	(void)state;
+
+	binding_t b;
+
+	assert_true(parse_binding("toggle:8:1:20cps:window:100,200:class:Firefox", NULL, &b));
+	assert_int_equal(b.toggle_button, 8);
+	assert_int_equal(b.click_button, 1);
+	assert_int_equal(b.period_ns, 50 * NS_PER_MS);
+	assert_non_null(b.window);
+	assert_int_equal(b.window->match, WINDOW_BY_CLASS);
+	assert_string_equal(b.window->value, "Firefox");
+	assert_int_equal(b.window->x, 100);
+	assert_int_equal(b.window->y, 200);
+	assert_int_equal(b.window->window, None);
+	assert_true(b.window->lookup_due);
+
+	// A title runs to the end of the line, spaces and colons included
+	assert_true(parse_binding("hold 9 3 10 window 5,6 title Idle Game: Part 2  # comment\n", NULL, &b));
+	assert_int_equal(b.window->match, WINDOW_BY_TITLE);
+	assert_string_equal(b.window->value, "Idle Game: Part 2");
+
+	assert_true(parse_binding("hold 9 1 10 window 0,0 id 0x3a00007", NULL, &b));
+	assert_int_equal(b.window->match, WINDOW_BY_ID);
+	assert_int_equal(strtoul(b.window->value, NULL, 0), 0x3a00007);
+
+	assert_true(parse_binding("hold 9 1 10", NULL, &b));
+	assert_null(b.window);
+
+	assert_false(parse_binding("hold 9 1 10 window", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 window 100 class Firefox", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 window -1,5 class Firefox", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 window 1,5 name Firefox", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 window 1,5 class", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 window 1,5 id firefox", NULL, &b));
+	assert_false(parse_binding("hold 9 1 10 windows 1,5 class Firefox", NULL, &b));
+}
+
+static void test_run_clicks_window(void** state)
+{
+	(void)state;
+
+	char* argv[] = {"ac", "-i", "10", "-t", "9", "--bind", "hold:8:2:10:window:30,40:class:Game"};
+	opts_t opts = {0};
+	static mock_backend_t mock;
+	static loop_stats_t stats;
+	click_stream_t streams[MAX_BINDINGS] = {{{0}}};
+	input_t in;
+	output_t out;
+
+	memset(&mock, 0, sizeof(mock));
+	memset(&stats, 0, sizeof(stats));
+	assert_true(read_opts(7, argv, &opts));
+	assert_true(finish_bindings(&opts));
+	assert_true(has_window_targets(&opts));
+	opts.mock = &mock;
+	for (int i = 0; i < opts.num_bindings; ++i)
+	{
+		streams[i].sched.period_ns = opts.bindings[i].period_ns;
+	}
+	assert_true(open_input(&in, &opts, NULL, streams));
+	assert_true(open_output(&out, &opts, NULL));
+
+	// The window binding clicks into its window, the plain one through the output
+	mock_set_button(&mock, 10, 8, true);
+	process_input(&in, &opts, streams);
+	run_clicks(&opts, streams, &out, 1000, &stats, NULL);
+	assert_int_equal(mock.num_events, 1);
+	assert_int_equal(mock.events[0].type, MOCK_WINDOW_CLICK);
+	assert_int_equal(mock.events[0].button, 2);
+	assert_int_equal(mock.events[0].dx, 30);
+	assert_int_equal(mock.events[0].dy, 40);
+
+	mock_set_button(&mock, 10, 8, false);
+	mock_set_button(&mock, 10, 9, true);
+	process_input(&in, &opts, streams);
+	run_clicks(&opts, streams, &out, 2000, &stats, NULL);
+	assert_int_equal(mock.num_events, 2);
+	assert_int_equal(mock.events[1].type, MOCK_CLICK);
+
+	close_output(&out);
+	close_input(&in);
+
+	// Without a display, there's nowhere to look for the window
+	opts.mock = NULL;
+	assert_false(open_output(&out, &opts, NULL));
+}
+
+static int x_errors_passed_on;
+
+static int count_x_error(Display* display, XErrorEvent* err)
+{
+	(void)display;
+	(void)err;
+	return ++x_errors_passed_on;
+}
+
+static void test_handle_x_error_window(void** state)
+{
+	(void)state;
+
+	Display* window_display = (Display*)&x_errors_passed_on;
+	Display* other_display = (Display*)&window_display;
+	XErrorEvent err = {.error_code = BadWindow};
+
+	default_x_error_handler = count_x_error;
+	x_error_filter(window_display, true)->bad_window = true;
+	x_errors_passed_on = 0;
+
+	// BadWindow only means a window target went away on the targets' own connection
+	assert_int_equal(handle_x_error(window_display, &err), 0);
+	assert_int_equal(x_errors_passed_on, 0);
+	handle_x_error(other_display, &err);
+	assert_int_equal(x_errors_passed_on, 1);
+
+	err.error_code = BadAccess;
+	handle_x_error(window_display, &err);
+	assert_int_equal(x_errors_passed_on, 2);
+
+	forget_x_errors(window_display);
+	assert_null(x_error_filter(window_display, false));
+	default_x_error_handler = NULL;
+}
+
+static void test_handle_x_error_bad_device(void** state)
+{
+	(void)state;
+
+	Display* first = (Display*)&x_errors_passed_on;
+	Display* second = (Display*)&first;
+	XErrorEvent err = {.error_code = 150};
+
+	default_x_error_handler = count_x_error;
+	x_errors_passed_on = 0;
+
+	// Each connection has its own XInput error base, so one display's BadDevice can be another's
+	// real error
+	x_error_filter(first, true)->bad_device = 150;
+	x_error_filter(second, true)->bad_device = 160;
+	assert_int_equal(handle_x_error(first, &err), 0);
+	assert_int_equal(x_errors_passed_on, 0);
+	handle_x_error(second, &err);
+	assert_int_equal(x_errors_passed_on, 1);
+	err.error_code = 160;
+	handle_x_error(second, &err);
+	assert_int_equal(x_errors_passed_on, 1);
+
+	forget_x_errors(first);
+	forget_x_errors(second);
+	default_x_error_handler = NULL;
 }
 
 //
@@ -615,11 +3630,14 @@ int main(void)
 	const struct CMUnitTest tests[] = {
 		// get_config_type tests
 		cmocka_unit_test(test_get_config_type_delay),
+		cmocka_unit_test(test_get_config_type_delay_us),
+		cmocka_unit_test(test_get_config_type_rate),
 		cmocka_unit_test(test_get_config_type_click_button),
 		cmocka_unit_test(test_get_config_type_trigger_button),
 		cmocka_unit_test(test_get_config_type_toggle_button),
 		cmocka_unit_test(test_get_config_type_dev_id),
 		cmocka_unit_test(test_get_config_type_dev_name),
+		cmocka_unit_test(test_get_config_type_input),
 		cmocka_unit_test(test_get_config_type_comment),
 		cmocka_unit_test(test_get_config_type_blank),
 		cmocka_unit_test(test_get_config_type_blank_with_whitespace),
@@ -629,9 +3647,19 @@ int main(void)
 		cmocka_unit_test(test_parse_config_file_valid),
 		cmocka_unit_test(test_parse_config_file_with_comments),
 		cmocka_unit_test(test_parse_config_file_with_device_name),
+		cmocka_unit_test(test_parse_config_file_multiple_devices),
+		cmocka_unit_test(test_parse_config_file_with_bind),
 		cmocka_unit_test(test_parse_config_file_nonexistent),
 		cmocka_unit_test(test_parse_config_file_with_toggle_button),
 		cmocka_unit_test(test_parse_config_file_with_trigger_and_toggle),
+		cmocka_unit_test(test_parse_config_file_with_delay_us),
+		cmocka_unit_test(test_parse_config_file_with_rate),
+		cmocka_unit_test(test_parse_config_file_with_delay_unit),
+		cmocka_unit_test(test_parse_config_file_zero_delay),
+		cmocka_unit_test(test_parse_config_file_invalid_rate),
+		cmocka_unit_test(test_parse_config_file_with_output),
+		cmocka_unit_test(test_parse_config_file_with_input),
+		cmocka_unit_test(test_parse_config_file_with_stats),
 
 		// comp tests
 		cmocka_unit_test(test_comp_exact_match),
@@ -641,12 +3669,23 @@ int main(void)
 		// read_opts tests
 		cmocka_unit_test(test_read_opts_defaults),
 		cmocka_unit_test(test_read_opts_delay),
+		cmocka_unit_test(test_read_opts_delay_units),
+		cmocka_unit_test(test_read_opts_delay_invalid),
+		cmocka_unit_test(test_read_opts_out_of_range),
+		cmocka_unit_test(test_read_opts_rate),
+		cmocka_unit_test(test_read_opts_rate_zero),
 		cmocka_unit_test(test_read_opts_button),
 		cmocka_unit_test(test_read_opts_trigger),
 		cmocka_unit_test(test_read_opts_device_id),
 		cmocka_unit_test(test_read_opts_device_name),
 		cmocka_unit_test(test_read_opts_multiple_options),
+		cmocka_unit_test(test_read_opts_multiple_devices),
+		cmocka_unit_test(test_read_opts_bind),
+		cmocka_unit_test(test_parse_binding),
+		cmocka_unit_test(test_read_opts_too_many_devices),
+		cmocka_unit_test(test_read_opts_device_id_and_name),
 		cmocka_unit_test(test_read_opts_calibrate_mode),
+		cmocka_unit_test(test_read_opts_calibrate_continuous),
 		cmocka_unit_test(test_read_opts_list_mode),
 		cmocka_unit_test(test_read_opts_config_file),
 		cmocka_unit_test(test_read_opts_invalid_option),
@@ -657,6 +3696,130 @@ int main(void)
 		cmocka_unit_test(test_read_opts_toggle_button),
 		cmocka_unit_test(test_read_opts_trigger_and_toggle),
 		cmocka_unit_test(test_read_opts_toggle_default),
+		cmocka_unit_test(test_read_opts_input_default),
+		cmocka_unit_test(test_read_opts_input_xi1),
+		cmocka_unit_test(test_read_opts_input_evdev),
+		cmocka_unit_test(test_read_opts_input_invalid),
+		cmocka_unit_test(test_read_opts_overrun),
+		cmocka_unit_test(test_read_opts_overrun_default),
+		cmocka_unit_test(test_read_opts_output_uinput),
+		cmocka_unit_test(test_read_opts_output_default),
+
+		// update_click_state tests
+		cmocka_unit_test(test_update_click_state_trigger),
+		cmocka_unit_test(test_update_click_state_toggle),
+		cmocka_unit_test(test_update_click_state_other_button),
+		cmocka_unit_test(test_update_click_state_timestamps),
+		cmocka_unit_test(test_read_opts_latency),
+		cmocka_unit_test(test_read_opts_stats),
+		cmocka_unit_test(test_read_opts_stats_interval_and_file),
+		cmocka_unit_test(test_update_click_state_counts_toggles),
+		cmocka_unit_test(test_dispatch_button),
+		cmocka_unit_test(test_apply_button_mask),
+		cmocka_unit_test(test_pick_up_held_buttons),
+		cmocka_unit_test(test_due_streams),
+		cmocka_unit_test(test_stage_end),
+
+		// latency histogram tests
+		cmocka_unit_test(test_hist_bucket_bounds),
+		cmocka_unit_test(test_hist_percentile),
+		cmocka_unit_test(test_latency_click),
+
+		// xi_version_at_least tests
+		cmocka_unit_test(test_xi_version_at_least),
+
+		// click scheduler tests
+		cmocka_unit_test(test_sched_due_on_time),
+		cmocka_unit_test(test_sched_due_catchup),
+		cmocka_unit_test(test_sched_due_catchup_limit),
+		cmocka_unit_test(test_sched_due_skip),
+
+		// click sequence tests
+		cmocka_unit_test(test_load_sequence),
+		cmocka_unit_test(test_load_sequence_errors),
+		cmocka_unit_test(test_parse_binding_sequence),
+		cmocka_unit_test(test_load_sequence_moves),
+		cmocka_unit_test(test_load_sequence_drag),
+		cmocka_unit_test(test_parse_binding_points),
+		cmocka_unit_test(test_seq_due),
+		cmocka_unit_test(test_seq_due_skip),
+		cmocka_unit_test(test_seq_due_drag),
+
+		// uinput tests
+		cmocka_unit_test(test_build_click_events_left),
+		cmocka_unit_test(test_build_click_events_side_buttons),
+		cmocka_unit_test(test_build_click_events_wheel),
+		cmocka_unit_test(test_build_click_events_unmapped),
+		cmocka_unit_test(test_evdev_to_x_button),
+		cmocka_unit_test(test_process_evdev_events_dropped),
+
+		// button mask tests
+		cmocka_unit_test(test_button_mask_from_bytes),
+		cmocka_unit_test(test_button_mask_next),
+		cmocka_unit_test(test_button_mask_empty),
+
+		// config reload tests
+		cmocka_unit_test(test_reload_compatible),
+		cmocka_unit_test(test_carry_over_streams),
+		cmocka_unit_test(test_reload_opts),
+		cmocka_unit_test(test_reload_opts_sequence),
+		cmocka_unit_test(test_free_opts),
+		cmocka_unit_test(test_config_file_changed),
+
+		// control socket tests
+		cmocka_unit_test(test_read_opts_control),
+		cmocka_unit_test(test_handle_control_command),
+		cmocka_unit_test(test_process_control),
+
+		// input thread tests
+		cmocka_unit_test(test_click_ring),
+		cmocka_unit_test(test_publish_click_state),
+		cmocka_unit_test(test_input_thread_start_stop),
+
+		// realtime tests
+		cmocka_unit_test(test_read_opts_realtime),
+		cmocka_unit_test(test_realtime_describe),
+
+		// event loop tests
+		cmocka_unit_test(test_wait_for_events),
+		cmocka_unit_test(test_read_signals),
+		cmocka_unit_test(test_defer_signals),
+
+		// record and replay tests
+		cmocka_unit_test(test_read_opts_record_replay),
+		cmocka_unit_test(test_record_and_open_recording),
+		cmocka_unit_test(test_open_recording_invalid),
+		cmocka_unit_test(test_replay_recording),
+
+		// mock backend tests
+		cmocka_unit_test(test_mock_input),
+		cmocka_unit_test(test_mock_input_full),
+		cmocka_unit_test(test_run_clicks),
+		cmocka_unit_test(test_run_clicks_drag),
+		cmocka_unit_test(test_run_clicks_interleaved),
+
+		// XCB backend tests
+		cmocka_unit_test(test_read_opts_xcb),
+#ifdef HAVE_XCB
+		cmocka_unit_test(test_xcb_button_mask),
+#endif
+
+		// device hotplug tests
+		cmocka_unit_test(test_device_table),
+		cmocka_unit_test(test_hotplug_device),
+		cmocka_unit_test(test_hotplug_device_toggle),
+
+		// multi-display tests
+		cmocka_unit_test(test_read_opts_displays),
+		cmocka_unit_test(test_read_display_opts),
+		cmocka_unit_test(test_service_display),
+		cmocka_unit_test(test_display_window_targets),
+
+		// window target tests
+		cmocka_unit_test(test_parse_binding_window),
+		cmocka_unit_test(test_run_clicks_window),
+		cmocka_unit_test(test_handle_x_error_window),
+		cmocka_unit_test(test_handle_x_error_bad_device),
 	};
 
 	return cmocka_run_group_tests(tests, NULL, NULL);